@@ -0,0 +1,124 @@
+/*
+ * Packs PNG files into an asset file for cairosdl_assets_open().  Each
+ * image is named after its file with the directory and .png taken
+ * off, like
+ *
+ *   asset-pack sprites.csa art/ball.png art/gear.png
+ *
+ * makes images "ball" and "gear".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-assets.h"
+
+/* Returns a new copy of the file's name without directories or .png. */
+static char *
+asset_name (char const *filename)
+{
+    char const *base = strrchr (filename, '/');
+    size_t len;
+    char *name;
+
+    base = base ? base + 1 : filename;
+    len = strlen (base);
+    if (len > 4 && 0 == strcmp (base + len - 4, ".png"))
+        len -= 4;
+    if (len > CAIROSDL_ASSETS_NAME_SIZE - 1) {
+        fprintf (stderr, "warning: name of %s cut to %i bytes\n",
+                 filename, CAIROSDL_ASSETS_NAME_SIZE - 1);
+        len = CAIROSDL_ASSETS_NAME_SIZE - 1;
+    }
+    name = malloc (len + 1);
+    if (name) {
+        memcpy (name, base, len);
+        name[len] = '\0';
+    }
+    return name;
+}
+
+/* Returns the PNG as an ARGB32 image, converting it if cairo loaded
+ * it as something else. */
+static cairo_surface_t *
+load_png (char const *filename)
+{
+    cairo_surface_t *png = cairo_image_surface_create_from_png (filename);
+    cairo_surface_t *image;
+    cairo_t *cr;
+
+    if (cairo_surface_status (png) != CAIRO_STATUS_SUCCESS) {
+        fprintf (stderr, "Unable to load %s: %s\n", filename,
+                 cairo_status_to_string (cairo_surface_status (png)));
+        cairo_surface_destroy (png);
+        return NULL;
+    }
+    if (cairo_image_surface_get_format (png) == CAIRO_FORMAT_ARGB32)
+        return png;
+
+    image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                        cairo_image_surface_get_width (png),
+                                        cairo_image_surface_get_height (png));
+    cr = cairo_create (image);
+    cairo_set_source_surface (cr, png, 0, 0);
+    cairo_paint (cr);
+    cairo_destroy (cr);
+    cairo_surface_destroy (png);
+    return image;
+}
+
+int
+main (int argc, char **argv)
+{
+    cairo_surface_t **images;
+    char **names;
+    int num_images = argc - 2;
+    int status = 0;
+    int i;
+
+    if (argc < 3) {
+        fprintf (stderr, "usage: asset-pack OUTPUT file.png...\n");
+        return 1;
+    }
+
+    images = calloc (num_images, sizeof (*images));
+    names = calloc (num_images, sizeof (*names));
+    if (images == NULL || names == NULL) {
+        fprintf (stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (i = 0; i < num_images && status == 0; i++) {
+        int j;
+        names[i] = asset_name (argv[i + 2]);
+        images[i] = load_png (argv[i + 2]);
+        if (names[i] == NULL || images[i] == NULL) {
+            status = 1;
+            break;
+        }
+        for (j = 0; j < i; j++) {
+            if (0 == strcmp (names[i], names[j])) {
+                fprintf (stderr, "%s and %s are both named %s\n",
+                         argv[j + 2], argv[i + 2], names[i]);
+                status = 1;
+            }
+        }
+    }
+
+    if (status == 0 &&
+        cairosdl_assets_write (argv[1], num_images,
+                               (char const *const *)names, images) != 0)
+    {
+        fprintf (stderr, "Unable to write %s: %s\n", argv[1],
+                 SDL_GetError ());
+        status = 1;
+    }
+
+    for (i = 0; i < num_images; i++) {
+        if (images[i])
+            cairo_surface_destroy (images[i]);
+        free (names[i]);
+    }
+    free (images);
+    free (names);
+    return status;
+}
@@ -0,0 +1,418 @@
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-assets.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  define CAIROSDL_HAVE_MMAP 1
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 num_images;
+    Uint32 index_offset;
+} _cairosdl_assets_header_t;
+
+typedef struct {
+    char name[CAIROSDL_ASSETS_NAME_SIZE];
+    Uint32 width;
+    Uint32 height;
+    Uint32 stride;
+    Uint32 offset;
+    Uint32 reserved[2];
+} _cairosdl_assets_entry_t;
+
+struct _cairosdl_assets {
+    int ref_count;              /* the caller's and one per surface */
+    unsigned char *data;
+    size_t size;
+    int mapped;                 /* munmap() rather than free() the data */
+    _cairosdl_assets_entry_t const *index;
+    int num_images;
+};
+
+static cairo_user_data_key_t const CAIROSDL_ASSETS_KEY[1];
+
+#define ALIGN_UP(x) \
+    (((x) + CAIROSDL_ASSETS_ALIGN - 1) & ~(size_t)(CAIROSDL_ASSETS_ALIGN - 1))
+
+static int
+_cairosdl_assets_write_padding (FILE *file, size_t *offset, size_t to)
+{
+    static unsigned char const zeros[CAIROSDL_ASSETS_ALIGN];
+
+    while (*offset < to) {
+        size_t n = to - *offset < sizeof (zeros) ? to - *offset
+                                                 : sizeof (zeros);
+        if (fwrite (zeros, 1, n, file) != n)
+            return -1;
+        *offset += n;
+    }
+    return 0;
+}
+
+int
+cairosdl_assets_write (char const             *filename,
+                       int                     num_images,
+                       char const *const      *names,
+                       cairo_surface_t *const *images)
+{
+    _cairosdl_assets_header_t header;
+    _cairosdl_assets_entry_t *index;
+    size_t offset;
+    FILE *file;
+    int i;
+
+    for (i = 0; i < num_images; i++) {
+        if (cairo_surface_get_type (images[i]) != CAIRO_SURFACE_TYPE_IMAGE ||
+            cairo_image_surface_get_format (images[i]) != CAIRO_FORMAT_ARGB32)
+        {
+            SDL_SetError ("cairosdl_assets_write: %s isn't an ARGB32 image",
+                          names[i]);
+            return -1;
+        }
+    }
+
+    index = (_cairosdl_assets_entry_t *)calloc (num_images + 1,
+                                                sizeof (*index));
+    if (index == NULL) {
+        SDL_OutOfMemory ();
+        return -1;
+    }
+
+    header.magic = CAIROSDL_ASSETS_MAGIC;
+    header.version = CAIROSDL_ASSETS_VERSION;
+    header.num_images = num_images;
+    header.index_offset = sizeof (header);
+
+    offset = ALIGN_UP (sizeof (header) + num_images * sizeof (*index));
+    for (i = 0; i < num_images; i++) {
+        int width = cairo_image_surface_get_width (images[i]);
+        int height = cairo_image_surface_get_height (images[i]);
+
+        strncpy (index[i].name, names[i], sizeof (index[i].name) - 1);
+        index[i].width = width;
+        index[i].height = height;
+        index[i].stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,
+                                                         width);
+        if (offset > 0xFFFFFFFFu) {
+            SDL_SetError ("cairosdl_assets_write: %s starts past 4 GB",
+                          names[i]);
+            free (index);
+            return -1;
+        }
+        index[i].offset = (Uint32)offset;
+        offset = ALIGN_UP (offset + (size_t)index[i].stride * height);
+    }
+
+    file = fopen (filename, "wb");
+    if (file == NULL) {
+        SDL_SetError ("cairosdl_assets_write: %s: %s", filename,
+                      strerror (errno));
+        free (index);
+        return -1;
+    }
+
+    offset = sizeof (header) + num_images * sizeof (*index);
+    if (fwrite (&header, sizeof (header), 1, file) != 1 ||
+        (num_images > 0 &&
+         fwrite (index, sizeof (*index), num_images, file) !=
+         (size_t)num_images))
+    {
+        goto FAIL;
+    }
+
+    for (i = 0; i < num_images; i++) {
+        unsigned char const *row;
+        int src_stride;
+        Uint32 y;
+
+        cairo_surface_flush (images[i]);
+        row = cairo_image_surface_get_data (images[i]);
+        src_stride = cairo_image_surface_get_stride (images[i]);
+
+        if (_cairosdl_assets_write_padding (file, &offset,
+                                            index[i].offset) != 0)
+            goto FAIL;
+        for (y = 0; y < index[i].height; y++, row += src_stride) {
+            size_t row_size = 4 * (size_t)index[i].width;
+            if (fwrite (row, 1, row_size, file) != row_size)
+                goto FAIL;
+            offset += row_size;
+            if (_cairosdl_assets_write_padding (
+                    file, &offset,
+                    index[i].offset + (size_t)(y + 1) * index[i].stride) != 0)
+                goto FAIL;
+        }
+    }
+
+    free (index);
+    if (fclose (file) != 0) {
+        SDL_SetError ("cairosdl_assets_write: %s: %s", filename,
+                      strerror (errno));
+        return -1;
+    }
+    return 0;
+
+ FAIL:
+    SDL_SetError ("cairosdl_assets_write: %s: %s", filename,
+                  strerror (errno));
+    free (index);
+    fclose (file);
+    remove (filename);
+    return -1;
+}
+
+/* Reads or maps the whole file into OUT_data. */
+static int
+_cairosdl_assets_load (char const *filename,
+                       unsigned char **OUT_data,
+                       size_t *OUT_size,
+                       int *OUT_mapped)
+{
+#ifdef CAIROSDL_HAVE_MMAP
+    struct stat st;
+    void *data;
+    int fd = open (filename, O_RDONLY);
+
+    if (fd < 0 || fstat (fd, &st) != 0) {
+        if (fd >= 0)
+            close (fd);
+        return -1;
+    }
+    /* Private and writable so that drawing into an image copies the
+     * pages rather than crashing or changing the file. */
+    data = st.st_size > 0
+        ? mmap (NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+    close (fd);
+    if (data == MAP_FAILED) {
+        if (st.st_size == 0)
+            errno = EINVAL;
+        return -1;
+    }
+    *OUT_data = (unsigned char *)data;
+    *OUT_size = st.st_size;
+    *OUT_mapped = 1;
+    return 0;
+#else
+    FILE *file = fopen (filename, "rb");
+    unsigned char *data;
+    long size;
+
+    if (file == NULL)
+        return -1;
+    if (fseek (file, 0, SEEK_END) != 0 ||
+        (size = ftell (file)) <= 0 ||
+        fseek (file, 0, SEEK_SET) != 0 ||
+        (data = (unsigned char *)malloc (size)) == NULL)
+    {
+        fclose (file);
+        errno = EINVAL;
+        return -1;
+    }
+    if (fread (data, 1, size, file) != (size_t)size) {
+        free (data);
+        fclose (file);
+        return -1;
+    }
+    fclose (file);
+    *OUT_data = data;
+    *OUT_size = size;
+    *OUT_mapped = 0;
+    return 0;
+#endif
+}
+
+static void
+_cairosdl_assets_release (void *closure)
+{
+    cairosdl_assets_t *assets = (cairosdl_assets_t *)closure;
+
+    if (--assets->ref_count > 0)
+        return;
+#ifdef CAIROSDL_HAVE_MMAP
+    if (assets->mapped)
+        munmap (assets->data, assets->size);
+    else
+#endif
+        free (assets->data);
+    free (assets);
+}
+
+/* Returns zero if the index doesn't fit the file. */
+static int
+_cairosdl_assets_check_index (cairosdl_assets_t const *assets)
+{
+    int i;
+
+    for (i = 0; i < assets->num_images; i++) {
+        _cairosdl_assets_entry_t const *entry = assets->index + i;
+        if (entry->name[sizeof (entry->name) - 1] != '\0' ||
+            entry->stride < 4 * (size_t)entry->width ||
+            entry->stride % 4 != 0 ||
+            entry->offset % CAIROSDL_ASSETS_ALIGN != 0 ||
+            entry->offset > assets->size ||
+            (assets->size - entry->offset) / (entry->stride ? entry->stride : 1)
+            < entry->height)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+cairosdl_assets_t *
+cairosdl_assets_open (char const *filename)
+{
+    _cairosdl_assets_header_t header;
+    cairosdl_assets_t *assets;
+
+    assets = (cairosdl_assets_t *)calloc (1, sizeof (*assets));
+    if (assets == NULL) {
+        SDL_OutOfMemory ();
+        return NULL;
+    }
+    assets->ref_count = 1;
+
+    if (_cairosdl_assets_load (filename, &assets->data, &assets->size,
+                               &assets->mapped) != 0)
+    {
+        SDL_SetError ("cairosdl_assets_open: %s: %s", filename,
+                      strerror (errno));
+        free (assets);
+        return NULL;
+    }
+
+    if (assets->size < sizeof (header))
+        goto BAD;
+    memcpy (&header, assets->data, sizeof (header));
+    if (header.magic == SDL_Swap32 (CAIROSDL_ASSETS_MAGIC)) {
+        SDL_SetError ("cairosdl_assets_open: %s: wrong byte order",
+                      filename);
+        _cairosdl_assets_release (assets);
+        return NULL;
+    }
+    if (header.magic != CAIROSDL_ASSETS_MAGIC ||
+        header.version != CAIROSDL_ASSETS_VERSION ||
+        header.index_offset % 4 != 0 ||
+        header.index_offset > assets->size ||
+        (assets->size - header.index_offset) /
+        sizeof (_cairosdl_assets_entry_t) < header.num_images)
+    {
+        goto BAD;
+    }
+    assets->index = (_cairosdl_assets_entry_t const *)
+        (assets->data + header.index_offset);
+    assets->num_images = header.num_images;
+    if (!_cairosdl_assets_check_index (assets))
+        goto BAD;
+    return assets;
+
+ BAD:
+    SDL_SetError ("cairosdl_assets_open: %s: not an asset file", filename);
+    _cairosdl_assets_release (assets);
+    return NULL;
+}
+
+void
+cairosdl_assets_destroy (cairosdl_assets_t *assets)
+{
+    if (assets != NULL)
+        _cairosdl_assets_release (assets);
+}
+
+int
+cairosdl_assets_get_num_images (cairosdl_assets_t *assets)
+{
+    return assets->num_images;
+}
+
+char const *
+cairosdl_assets_get_name (cairosdl_assets_t *assets,
+                          int                index)
+{
+    if (index < 0 || index >= assets->num_images)
+        return NULL;
+    return assets->index[index].name;
+}
+
+int
+cairosdl_assets_find (cairosdl_assets_t *assets,
+                      char const        *name)
+{
+    int i;
+    for (i = 0; i < assets->num_images; i++) {
+        if (0 == strcmp (assets->index[i].name, name))
+            return i;
+    }
+    return -1;
+}
+
+cairo_surface_t *
+cairosdl_assets_get_surface (cairosdl_assets_t *assets,
+                             int                index)
+{
+    _cairosdl_assets_entry_t const *entry;
+    cairo_surface_t *surface;
+
+    if (index < 0 || index >= assets->num_images) {
+        SDL_SetError ("cairosdl_assets_get_surface: no image %d", index);
+        return NULL;
+    }
+    entry = assets->index + index;
+
+    surface = cairo_image_surface_create_for_data (
+        assets->data + entry->offset, CAIRO_FORMAT_ARGB32,
+        entry->width, entry->height, entry->stride);
+    if (cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS ||
+        cairo_surface_set_user_data (surface, CAIROSDL_ASSETS_KEY,
+                                     assets, _cairosdl_assets_release) !=
+        CAIRO_STATUS_SUCCESS)
+    {
+        SDL_SetError ("cairosdl_assets_get_surface: %s",
+                      cairo_status_to_string (cairo_surface_status (surface)));
+        cairo_surface_destroy (surface);
+        return NULL;
+    }
+    assets->ref_count++;
+    return surface;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,109 @@
+#ifndef CAIROSDL_ASSETS_H
+#define CAIROSDL_ASSETS_H
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cairosdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Files of images ready for cairo.
+ *
+ * An asset file holds any number of named images as premultiplied
+ * ARGB32 rows with cairo's stride, so they can be used straight from
+ * the file mapped into memory with no decoding or premultiplying.
+ * The pixels are in the byte order of the machine that wrote the
+ * file, and files of the other byte order are rejected.
+ *
+ * The file starts with a header and an index, all Uint32s:
+ *
+ *   magic, version, number of images, offset of the index
+ *
+ * and each entry of the index is 64 bytes:
+ *
+ *   char name[40], NUL terminated
+ *   width, height, stride, offset of the first row, 2 reserved
+ *
+ * The rows of every image start at a multiple of
+ * CAIROSDL_ASSETS_ALIGN bytes into the file.
+ *
+ * Where mmap() isn't available the file is read into memory
+ * instead.  bin/asset-pack makes asset files from PNG files. */
+
+#define CAIROSDL_ASSETS_MAGIC 0x31415343 /* "CSA1" */
+#define CAIROSDL_ASSETS_VERSION 1
+#define CAIROSDL_ASSETS_NAME_SIZE 40
+#define CAIROSDL_ASSETS_ALIGN 64
+
+typedef struct _cairosdl_assets cairosdl_assets_t;
+
+/* Write the images into an asset file.  The surfaces must be ARGB32
+ * image surfaces.  Names longer than CAIROSDL_ASSETS_NAME_SIZE - 1
+ * bytes are cut short.  Every image must start within the first 4 GB
+ * of the file.  Returns 0 on success and -1 with SDL_GetError() set
+ * on failure. */
+int
+cairosdl_assets_write (char const             *filename,
+                       int                     num_images,
+                       char const *const      *names,
+                       cairo_surface_t *const *images);
+
+/* Map an asset file.  Returns NULL with SDL_GetError() set if it
+ * can't be read or isn't an asset file of this machine's byte
+ * order. */
+cairosdl_assets_t *
+cairosdl_assets_open (char const *filename);
+
+/* Drops the caller's hold on the file.  It stays mapped while any of
+ * its surfaces are alive. */
+void
+cairosdl_assets_destroy (cairosdl_assets_t *assets);
+
+int
+cairosdl_assets_get_num_images (cairosdl_assets_t *assets);
+
+char const *
+cairosdl_assets_get_name (cairosdl_assets_t *assets,
+                          int                index);
+
+/* Returns the index of the image of the given name or -1. */
+int
+cairosdl_assets_find (cairosdl_assets_t *assets,
+                      char const        *name);
+
+/* Returns a new ARGB32 image surface over the image's pixels in the
+ * mapped file.  The pixels are mapped copy-on-write, so drawing into
+ * the surface is allowed, but it copies the pages drawn on and the
+ * file doesn't change.  Returns NULL with SDL_GetError() set if the
+ * index is out of range. */
+cairo_surface_t *
+cairosdl_assets_get_surface (cairosdl_assets_t *assets,
+                             int                index);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CAIROSDL_ASSETS_H */
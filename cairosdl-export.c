@@ -0,0 +1,512 @@
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-export.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <errno.h>
+#  include <fcntl.h>
+#  include <time.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  define CAIROSDL_HAVE_SHM 1
+#  ifdef __linux__
+#    include <linux/futex.h>
+#    include <sys/syscall.h>
+#    define CAIROSDL_HAVE_FUTEX 1
+#  endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CAIROSDL_HAVE_SHM
+
+/* The header, the stamps and every slot start on a page boundary of
+ * their own so that a consumer could map slots separately. */
+#define PAGE_SIZE_ROUNDING 4096
+#define ROUND_UP(x) (((x) + PAGE_SIZE_ROUNDING - 1) & ~(size_t)(PAGE_SIZE_ROUNDING - 1))
+
+/* How often a consumer looks for a new frame without a futex. */
+#define POLL_INTERVAL 0.001
+
+struct _cairosdl_export {
+    char *name;                 /* NULL for consumers */
+    unsigned char *map;
+    size_t map_size;
+    cairosdl_export_header_t *header;
+    cairosdl_export_stamp_t *stamps;
+    SDL_Surface *frame;         /* over the slot being written */
+    Uint32 next;                /* number of the frame being written */
+};
+
+#if defined(__GNUC__)
+#  define load_acquire(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#  define store_release(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+#  define full_barrier() __atomic_thread_fence (__ATOMIC_SEQ_CST)
+#else
+#  define load_acquire(p) (*(volatile Uint32 *)(p))
+#  define store_release(p, v) (*(volatile Uint32 *)(p) = (v))
+#  define full_barrier() ((void)0)
+#endif
+
+static double
+_cairosdl_export_now (void)
+{
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return SDL_GetTicks () / 1000.0;
+#endif
+}
+
+#ifndef CAIROSDL_HAVE_FUTEX
+static void
+_cairosdl_export_sleep (double seconds)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep (&ts, NULL);
+}
+#endif
+
+static unsigned char *
+_cairosdl_export_slot (cairosdl_export_t *export_, Uint32 n)
+{
+    cairosdl_export_header_t const *header = export_->header;
+    return export_->map + header->data_offset +
+        (size_t)(n % header->num_slots) * header->slot_size;
+}
+
+/* Hands out the slot for the next frame and marks it as being
+ * written. */
+static unsigned char *
+_cairosdl_export_begin_frame (cairosdl_export_t *export_)
+{
+    Uint32 slot = export_->next % export_->header->num_slots;
+
+    store_release (&export_->stamps[slot], 0);
+    /* The stamp must be seen to be cleared before any of the pixels
+     * are seen to change. */
+    full_barrier ();
+    return _cairosdl_export_slot (export_, export_->next);
+}
+
+cairosdl_export_t *
+cairosdl_export_create (char const              *name,
+                        int                      width,
+                        int                      height,
+                        cairosdl_export_format_t format,
+                        int                      num_slots)
+{
+    cairosdl_export_t *export_;
+    cairosdl_export_header_t *header;
+    size_t stride = (size_t)width * 4;
+    size_t stamps_offset = ROUND_UP (sizeof (cairosdl_export_header_t));
+    size_t data_offset;
+    size_t slot_size = ROUND_UP (stride * height);
+    size_t map_size;
+    int fd;
+
+    if (width <= 0 || height <= 0 || num_slots <= 0) {
+        SDL_SetError ("cairosdl_export_create: invalid size");
+        return NULL;
+    }
+    data_offset = stamps_offset +
+        ROUND_UP (num_slots * sizeof (cairosdl_export_stamp_t));
+    map_size = data_offset + slot_size * num_slots;
+
+    export_ = calloc (1, sizeof (*export_));
+    if (export_ == NULL) {
+        SDL_OutOfMemory ();
+        return NULL;
+    }
+    export_->name = malloc (strlen (name) + 1);
+    if (export_->name == NULL) {
+        SDL_OutOfMemory ();
+        free (export_);
+        return NULL;
+    }
+    strcpy (export_->name, name);
+
+    /* Truncating an object a consumer still has mapped would get it
+     * killed with SIGBUS, so start over with a new one. */
+    shm_unlink (name);
+    fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        SDL_SetError ("cairosdl_export_create: %s: %s", name,
+                      strerror (errno));
+        free (export_->name);
+        free (export_);
+        return NULL;
+    }
+    if (ftruncate (fd, map_size) != 0) {
+        SDL_SetError ("cairosdl_export_create: %s: %s", name,
+                      strerror (errno));
+        goto FAIL;
+    }
+    export_->map = mmap (NULL, map_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED, fd, 0);
+    if (export_->map == MAP_FAILED) {
+        SDL_SetError ("cairosdl_export_create: %s: %s", name,
+                      strerror (errno));
+        export_->map = NULL;
+        goto FAIL;
+    }
+    close (fd);
+    fd = -1;
+    export_->map_size = map_size;
+
+    header = export_->header = (cairosdl_export_header_t *)export_->map;
+    export_->stamps =
+        (cairosdl_export_stamp_t *)(export_->map + stamps_offset);
+    header->version = CAIROSDL_EXPORT_VERSION;
+    header->width = width;
+    header->height = height;
+    header->stride = stride;
+    header->format = format;
+    header->num_slots = num_slots;
+    header->slot_size = slot_size;
+    header->data_offset = data_offset;
+    header->published = 0;
+    export_->next = 1;
+
+    export_->frame = SDL_CreateRGBSurfaceFrom (
+        _cairosdl_export_slot (export_, export_->next),
+        width, height, 32, stride,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK,
+        format == CAIROSDL_EXPORT_ARGB32 ? CAIROSDL_AMASK : 0);
+    if (export_->frame == NULL)
+        goto FAIL;
+
+    /* Consumers opening the export before now see a bad magic. */
+    store_release (&header->magic, CAIROSDL_EXPORT_MAGIC);
+    return export_;
+
+ FAIL:
+    if (fd >= 0)
+        close (fd);
+    shm_unlink (name);
+    if (export_->map != NULL)
+        munmap (export_->map, map_size);
+    free (export_->name);
+    free (export_);
+    return NULL;
+}
+
+void
+cairosdl_export_destroy (cairosdl_export_t *export_)
+{
+    if (export_ == NULL)
+        return;
+    if (export_->frame != NULL)
+        SDL_FreeSurface (export_->frame);
+    munmap (export_->map, export_->map_size);
+    if (export_->name != NULL) {
+        shm_unlink (export_->name);
+        free (export_->name);
+    }
+    free (export_);
+}
+
+SDL_Surface *
+cairosdl_export_get_frame (cairosdl_export_t *export_)
+{
+    export_->frame->pixels = _cairosdl_export_begin_frame (export_);
+    return export_->frame;
+}
+
+void
+cairosdl_export_publish (cairosdl_export_t *export_)
+{
+    cairosdl_export_header_t *header = export_->header;
+    Uint32 n = export_->next;
+
+    store_release (&export_->stamps[n % header->num_slots], n);
+    store_release (&header->published, n);
+#ifdef CAIROSDL_HAVE_FUTEX
+    syscall (SYS_futex, &header->published, FUTEX_WAKE, 0x7fffffff,
+             NULL, NULL, 0);
+#endif
+
+    /* Frame numbers wrap around but skip zero, which marks a slot
+     * being written. */
+    if (++export_->next == 0)
+        export_->next = 1;
+    export_->frame->pixels = _cairosdl_export_slot (export_, export_->next);
+}
+
+int
+cairosdl_export_frame (cairosdl_export_t *export_,
+                       SDL_Surface       *frame)
+{
+    cairosdl_export_header_t const *header = export_->header;
+    SDL_PixelFormat const *format = frame->format;
+    Uint32 amask = header->format == CAIROSDL_EXPORT_ARGB32
+        ? CAIROSDL_AMASK : 0;
+    unsigned char *dst;
+    unsigned char const *src = frame->pixels;
+    size_t row_size;
+    int height;
+    int y;
+
+    if (format->BitsPerPixel != 32 ||
+        format->Rmask != CAIROSDL_RMASK ||
+        format->Gmask != CAIROSDL_GMASK ||
+        format->Bmask != CAIROSDL_BMASK ||
+        format->Amask != amask)
+    {
+        SDL_SetError ("cairosdl_export_frame: the frame's format doesn't "
+                      "match the export's");
+        return -1;
+    }
+
+    row_size = 4 * (size_t)(frame->w < (int)header->width
+                            ? frame->w : (int)header->width);
+    height = frame->h < (int)header->height
+        ? frame->h : (int)header->height;
+
+    dst = _cairosdl_export_begin_frame (export_);
+    for (y = 0; y < height; y++) {
+        memcpy (dst, src, row_size);
+        if (row_size < header->stride)
+            memset (dst + row_size, 0, header->stride - row_size);
+        dst += header->stride;
+        src += frame->pitch;
+    }
+    for (; y < (int)header->height; y++) {
+        memset (dst, 0, header->stride);
+        dst += header->stride;
+    }
+
+    cairosdl_export_publish (export_);
+    return 0;
+}
+
+cairosdl_export_t *
+cairosdl_export_open (char const *name)
+{
+    cairosdl_export_t *export_;
+    cairosdl_export_header_t header;
+    struct stat st;
+    unsigned char *map;
+    Uint32 magic;
+    int fd;
+
+    fd = shm_open (name, O_RDONLY, 0);
+    if (fd < 0) {
+        SDL_SetError ("cairosdl_export_open: %s: %s", name,
+                      strerror (errno));
+        return NULL;
+    }
+    if (fstat (fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof (cairosdl_export_header_t))
+    {
+        SDL_SetError ("cairosdl_export_open: %s: not an export", name);
+        close (fd);
+        return NULL;
+    }
+    map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close (fd);
+    if (map == MAP_FAILED) {
+        SDL_SetError ("cairosdl_export_open: %s: %s", name,
+                      strerror (errno));
+        return NULL;
+    }
+
+    magic = load_acquire (&((cairosdl_export_header_t *)map)->magic);
+    memcpy (&header, map, sizeof (header));
+    if (magic != CAIROSDL_EXPORT_MAGIC ||
+        header.version != CAIROSDL_EXPORT_VERSION ||
+        header.num_slots == 0 ||
+        header.data_offset + (size_t)header.slot_size * header.num_slots >
+        (size_t)st.st_size)
+    {
+        SDL_SetError ("cairosdl_export_open: %s: not an export", name);
+        munmap (map, st.st_size);
+        return NULL;
+    }
+
+    export_ = calloc (1, sizeof (*export_));
+    if (export_ == NULL) {
+        SDL_OutOfMemory ();
+        munmap (map, st.st_size);
+        return NULL;
+    }
+    export_->map = map;
+    export_->map_size = st.st_size;
+    export_->header = (cairosdl_export_header_t *)map;
+    export_->stamps = (cairosdl_export_stamp_t *)
+        (map + ROUND_UP (sizeof (cairosdl_export_header_t)));
+    return export_;
+}
+
+cairosdl_export_header_t const *
+cairosdl_export_get_header (cairosdl_export_t *export_)
+{
+    return export_->header;
+}
+
+Uint32
+cairosdl_export_wait (cairosdl_export_t *export_,
+                      Uint32             last_seen,
+                      int                timeout_ms)
+{
+    Uint32 *published = &export_->header->published;
+    double deadline = _cairosdl_export_now () + timeout_ms / 1000.0;
+    Uint32 latest;
+
+    while ((latest = load_acquire (published)) == last_seen) {
+        double remaining = deadline - _cairosdl_export_now ();
+
+        if (timeout_ms >= 0 && remaining <= 0)
+            break;
+#ifdef CAIROSDL_HAVE_FUTEX
+        {
+            struct timespec ts;
+            ts.tv_sec = (time_t)remaining;
+            ts.tv_nsec = (long)((remaining - ts.tv_sec) * 1e9);
+            syscall (SYS_futex, published, FUTEX_WAIT, last_seen,
+                     timeout_ms >= 0 ? &ts : NULL, NULL, 0);
+        }
+#else
+        _cairosdl_export_sleep (timeout_ms >= 0 && remaining < POLL_INTERVAL
+                                ? remaining : POLL_INTERVAL);
+#endif
+    }
+    return latest;
+}
+
+unsigned char const *
+cairosdl_export_get_pixels (cairosdl_export_t *export_,
+                            Uint32             n)
+{
+    if (n == 0 || !cairosdl_export_frame_is_intact (export_, n))
+        return NULL;
+    return _cairosdl_export_slot (export_, n);
+}
+
+int
+cairosdl_export_frame_is_intact (cairosdl_export_t *export_,
+                                 Uint32             n)
+{
+    /* The pixels must have been read before the stamp is. */
+    full_barrier ();
+    return n != 0 &&
+        load_acquire (&export_->stamps[n % export_->header->num_slots]) == n;
+}
+
+#else /* !CAIROSDL_HAVE_SHM */
+
+cairosdl_export_t *
+cairosdl_export_create (char const              *name,
+                        int                      width,
+                        int                      height,
+                        cairosdl_export_format_t format,
+                        int                      num_slots)
+{
+    (void)name; (void)width; (void)height; (void)format; (void)num_slots;
+    SDL_SetError ("cairosdl_export_create: no shared memory here");
+    return NULL;
+}
+
+void
+cairosdl_export_destroy (cairosdl_export_t *export_)
+{
+    (void)export_;
+}
+
+SDL_Surface *
+cairosdl_export_get_frame (cairosdl_export_t *export_)
+{
+    (void)export_;
+    return NULL;
+}
+
+void
+cairosdl_export_publish (cairosdl_export_t *export_)
+{
+    (void)export_;
+}
+
+int
+cairosdl_export_frame (cairosdl_export_t *export_,
+                       SDL_Surface       *frame)
+{
+    (void)export_; (void)frame;
+    return -1;
+}
+
+cairosdl_export_t *
+cairosdl_export_open (char const *name)
+{
+    (void)name;
+    SDL_SetError ("cairosdl_export_open: no shared memory here");
+    return NULL;
+}
+
+cairosdl_export_header_t const *
+cairosdl_export_get_header (cairosdl_export_t *export_)
+{
+    (void)export_;
+    return NULL;
+}
+
+Uint32
+cairosdl_export_wait (cairosdl_export_t *export_,
+                      Uint32             last_seen,
+                      int                timeout_ms)
+{
+    (void)export_; (void)timeout_ms;
+    return last_seen;
+}
+
+unsigned char const *
+cairosdl_export_get_pixels (cairosdl_export_t *export_,
+                            Uint32             n)
+{
+    (void)export_; (void)n;
+    return NULL;
+}
+
+int
+cairosdl_export_frame_is_intact (cairosdl_export_t *export_,
+                                 Uint32             n)
+{
+    (void)export_; (void)n;
+    return 0;
+}
+
+#endif /* CAIROSDL_HAVE_SHM */
+
+#ifdef __cplusplus
+}
+#endif
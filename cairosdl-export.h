@@ -0,0 +1,154 @@
+#ifndef CAIROSDL_EXPORT_H
+#define CAIROSDL_EXPORT_H
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cairosdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Exporting frames to other processes through POSIX shared memory.
+ *
+ * The producer owns a shared memory object holding a header and a
+ * ring of frame slots.  Each published frame goes into the next slot,
+ * is stamped with its sequence number and the header's count of
+ * published frames is bumped.  On Linux that count is also a futex
+ * that consumers can sleep on; elsewhere they have to poll.
+ *
+ * The producer never waits for consumers.  A consumer that falls more
+ * than a ring behind finds its slot restamped and skips ahead, so it
+ * should check the slot's stamp again after reading the pixels.
+ *
+ * This is only available on POSIX systems.  Elsewhere creating or
+ * opening an export fails. */
+
+#define CAIROSDL_EXPORT_MAGIC 0x58455343 /* "CSEX" */
+#define CAIROSDL_EXPORT_VERSION 1
+
+/* Pixel formats of exported frames.  All are 32 bits per pixel with
+ * the cairosdl channel masks. */
+typedef enum {
+    CAIROSDL_EXPORT_XRGB32,           /* Amask=0, the top byte unused */
+    CAIROSDL_EXPORT_ARGB32            /* with alpha, not premultiplied */
+} cairosdl_export_format_t;
+
+/* The layout of the start of the shared memory object.  The slot
+ * stamps follow the header and the slots themselves start at
+ * data_offset, slot_size bytes apart. */
+typedef struct {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 width;
+    Uint32 height;
+    Uint32 stride;
+    Uint32 format;
+    Uint32 num_slots;
+    Uint32 slot_size;
+    Uint32 data_offset;
+    Uint32 published;       /* frames published so far, the futex word */
+} cairosdl_export_header_t;
+
+/* Frame n goes into slot n % num_slots and that slot's stamp is set
+ * to n once the frame is complete.  A stamp of 0 means the slot is
+ * being written. */
+typedef Uint32 cairosdl_export_stamp_t;
+
+typedef struct _cairosdl_export cairosdl_export_t;
+
+/* Create a shared memory object of the given name, like "/gears",
+ * for exporting frames of the given size and format through a ring
+ * of num_slots frames.  An object left with that name is unlinked
+ * first rather than reused, so consumers still mapping it keep the
+ * old frames instead of having the memory cut from under them.
+ * Returns NULL with SDL_GetError() set if it can't be created. */
+cairosdl_export_t *
+cairosdl_export_create (char const              *name,
+                        int                      width,
+                        int                      height,
+                        cairosdl_export_format_t format,
+                        int                      num_slots);
+
+/* Destroys the producer's export and unlinks its shared memory object,
+ * or closes a consumer's mapping. */
+void
+cairosdl_export_destroy (cairosdl_export_t *export_);
+
+/* Returns an SDL_Surface over the slot the next frame goes into.  It
+ * can be drawn into with cairosdl_surface_create() and then published
+ * with cairosdl_export_publish() without copying the frame.  The
+ * surface belongs to the export and changes with every publish. */
+SDL_Surface *
+cairosdl_export_get_frame (cairosdl_export_t *export_);
+
+/* Publishes the frame drawn into the surface from
+ * cairosdl_export_get_frame() and wakes up waiting consumers. */
+void
+cairosdl_export_publish (cairosdl_export_t *export_);
+
+/* Copies the SDL_Surface into the next slot and publishes it.  The
+ * surface must be 32 bits with the cairosdl channel masks, and locked
+ * or not need locking.  Anything outside the export's size is cut
+ * off.  Returns 0 on success and -1 with SDL_GetError() set if the
+ * format doesn't match. */
+int
+cairosdl_export_frame (cairosdl_export_t *export_,
+                       SDL_Surface       *frame);
+
+
+/* Consumers. */
+
+/* Map an existing export read only.  Returns NULL with SDL_GetError()
+ * set if it doesn't exist or isn't an export. */
+cairosdl_export_t *
+cairosdl_export_open (char const *name);
+
+cairosdl_export_header_t const *
+cairosdl_export_get_header (cairosdl_export_t *export_);
+
+/* Waits up to timeout_ms milliseconds, or forever if negative, for a
+ * frame later than last_seen to be published and returns the number
+ * of the latest one.  Returns last_seen if none came in time. */
+Uint32
+cairosdl_export_wait (cairosdl_export_t *export_,
+                      Uint32             last_seen,
+                      int                timeout_ms);
+
+/* Returns the pixels of frame n if it's still in the ring, or NULL if
+ * it has been overwritten.  The frame is only known to be intact if
+ * cairosdl_export_frame_is_intact() still says so after the pixels
+ * have been used. */
+unsigned char const *
+cairosdl_export_get_pixels (cairosdl_export_t *export_,
+                            Uint32             n);
+
+int
+cairosdl_export_frame_is_intact (cairosdl_export_t *export_,
+                                 Uint32             n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CAIROSDL_EXPORT_H */
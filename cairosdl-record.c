@@ -0,0 +1,510 @@
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-record.h"
+
+#ifdef _WIN32
+#  include <io.h>
+#else
+#  include <unistd.h>
+#endif
+#ifndef O_BINARY
+#  define O_BINARY 0
+#endif
+
+#if defined(__SSE2__) && !defined(CAIROSDL_NO_SSE2)
+#  define CAIROSDL_USE_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define CAIROSDL_USE_SSE2 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define Y4M_FRAME_HEADER "FRAME\n"
+#define Y4M_FRAME_HEADER_SIZE (sizeof (Y4M_FRAME_HEADER) - 1)
+
+struct _cairosdl_record {
+    int fd;
+    cairosdl_record_format_t format;
+    int width;
+    int height;
+    size_t frame_size;          /* bytes written per frame */
+    unsigned char *buffers[2];
+    int back;                   /* the buffer converted into next */
+
+    /* Shared with the writer thread under the mutex. */
+    SDL_mutex *mutex;
+    SDL_cond *cond;
+    SDL_Thread *writer;
+    int queued[2];              /* waiting for or being written */
+    int quit;
+    int write_errno;            /* of the first failed write, or 0 */
+};
+
+static int
+_cairosdl_record_write_all (int fd, unsigned char const *data, size_t size)
+{
+    while (size > 0) {
+        int n = write (fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+/* Writes the queued buffers in the order they were queued until told
+ * to quit with nothing left to write. */
+static int
+_cairosdl_record_writer (void *param)
+{
+    cairosdl_record_t *record = (cairosdl_record_t *)param;
+    int next = 0;
+
+    SDL_LockMutex (record->mutex);
+    for (;;) {
+        int error;
+
+        while (!record->queued[next] && !record->quit)
+            SDL_CondWait (record->cond, record->mutex);
+        if (!record->queued[next])
+            break;
+
+        SDL_UnlockMutex (record->mutex);
+        error = record->write_errno ? 0 : _cairosdl_record_write_all (
+            record->fd, record->buffers[next], record->frame_size);
+        SDL_LockMutex (record->mutex);
+
+        if (error != 0)
+            record->write_errno = error;
+        record->queued[next] = 0;
+        next ^= 1;
+        SDL_CondBroadcast (record->cond);
+    }
+    SDL_UnlockMutex (record->mutex);
+    return 0;
+}
+
+/* BT.601 limited range RGB to YUV.  The SSE2 converter computes the
+ * same in 16 bit lanes: the luma sums fit unsigned and the chroma sums
+ * signed, and the chroma is the rounded mean of each 2x2 block. */
+#define R(p) (((p) >> CAIROSDL_RSHIFT) & 255)
+#define G(p) (((p) >> CAIROSDL_GSHIFT) & 255)
+#define B(p) (((p) >> CAIROSDL_BSHIFT) & 255)
+#define LUMA(r, g, b) ((((66*(r) + 129*(g) + 25*(b) + 128) >> 8) + 16))
+/* The 128 << 8 added keeps the sums positive for the shift. */
+#define CHROMA_U(r, g, b) ((-38*(r) - 74*(g) + 112*(b) + 128 + (128 << 8)) >> 8)
+#define CHROMA_V(r, g, b) ((112*(r) - 94*(g) - 18*(b) + 128 + (128 << 8)) >> 8)
+
+#if CAIROSDL_USE_SSE2
+/* Splits 8 pixels into 16 bit channels. */
+static void
+_cairosdl_record_split8 (Uint32 const *src,
+                         __m128i *OUT_r, __m128i *OUT_g, __m128i *OUT_b)
+{
+    __m128i const mask = _mm_set1_epi32 (255);
+    __m128i p0 = _mm_loadu_si128 ((__m128i const *)src);
+    __m128i p1 = _mm_loadu_si128 ((__m128i const *)(src + 4));
+
+    *OUT_r = _mm_packs_epi32 (
+        _mm_and_si128 (_mm_srli_epi32 (p0, CAIROSDL_RSHIFT), mask),
+        _mm_and_si128 (_mm_srli_epi32 (p1, CAIROSDL_RSHIFT), mask));
+    *OUT_g = _mm_packs_epi32 (
+        _mm_and_si128 (_mm_srli_epi32 (p0, CAIROSDL_GSHIFT), mask),
+        _mm_and_si128 (_mm_srli_epi32 (p1, CAIROSDL_GSHIFT), mask));
+    *OUT_b = _mm_packs_epi32 (
+        _mm_and_si128 (_mm_srli_epi32 (p0, CAIROSDL_BSHIFT), mask),
+        _mm_and_si128 (_mm_srli_epi32 (p1, CAIROSDL_BSHIFT), mask));
+}
+
+static __m128i
+_cairosdl_record_luma8 (__m128i r, __m128i g, __m128i b)
+{
+    __m128i y = _mm_add_epi16 (
+        _mm_add_epi16 (_mm_mullo_epi16 (r, _mm_set1_epi16 (66)),
+                       _mm_mullo_epi16 (g, _mm_set1_epi16 (129))),
+        _mm_add_epi16 (_mm_mullo_epi16 (b, _mm_set1_epi16 (25)),
+                       _mm_set1_epi16 (128)));
+    return _mm_add_epi16 (_mm_srli_epi16 (y, 8), _mm_set1_epi16 (16));
+}
+
+/* Means of the 2x2 blocks of two rows of 16 pixels, as 8 lanes. */
+static __m128i
+_cairosdl_record_mean8 (__m128i a0, __m128i b0, __m128i a1, __m128i b1)
+{
+    __m128i const ones = _mm_set1_epi16 (1);
+    __m128i sums = _mm_packs_epi32 (
+        _mm_madd_epi16 (_mm_add_epi16 (a0, a1), ones),
+        _mm_madd_epi16 (_mm_add_epi16 (b0, b1), ones));
+    return _mm_srli_epi16 (_mm_add_epi16 (sums, _mm_set1_epi16 (2)), 2);
+}
+
+static __m128i
+_cairosdl_record_chroma8 (__m128i r, __m128i g, __m128i b,
+                          short cr, short cg, short cb)
+{
+    __m128i c = _mm_add_epi16 (
+        _mm_add_epi16 (_mm_mullo_epi16 (r, _mm_set1_epi16 (cr)),
+                       _mm_mullo_epi16 (g, _mm_set1_epi16 (cg))),
+        _mm_add_epi16 (_mm_mullo_epi16 (b, _mm_set1_epi16 (cb)),
+                       _mm_set1_epi16 (128)));
+    c = _mm_add_epi16 (_mm_srai_epi16 (c, 8), _mm_set1_epi16 (128));
+    return _mm_packus_epi16 (c, c);
+}
+
+/* Converts 16 pixels of two rows. */
+static void
+_cairosdl_record_yuv420_16 (Uint32 const *row0, Uint32 const *row1,
+                            unsigned char *y0, unsigned char *y1,
+                            unsigned char *u, unsigned char *v)
+{
+    __m128i r0a, g0a, b0a, r0b, g0b, b0b;
+    __m128i r1a, g1a, b1a, r1b, g1b, b1b;
+    __m128i r, g, b;
+
+    _cairosdl_record_split8 (row0, &r0a, &g0a, &b0a);
+    _cairosdl_record_split8 (row0 + 8, &r0b, &g0b, &b0b);
+    _cairosdl_record_split8 (row1, &r1a, &g1a, &b1a);
+    _cairosdl_record_split8 (row1 + 8, &r1b, &g1b, &b1b);
+
+    _mm_storeu_si128 ((__m128i *)y0, _mm_packus_epi16 (
+        _cairosdl_record_luma8 (r0a, g0a, b0a),
+        _cairosdl_record_luma8 (r0b, g0b, b0b)));
+    _mm_storeu_si128 ((__m128i *)y1, _mm_packus_epi16 (
+        _cairosdl_record_luma8 (r1a, g1a, b1a),
+        _cairosdl_record_luma8 (r1b, g1b, b1b)));
+
+    r = _cairosdl_record_mean8 (r0a, r0b, r1a, r1b);
+    g = _cairosdl_record_mean8 (g0a, g0b, g1a, g1b);
+    b = _cairosdl_record_mean8 (b0a, b0b, b1a, b1b);
+    _mm_storel_epi64 ((__m128i *)u,
+                      _cairosdl_record_chroma8 (r, g, b, -38, -74, 112));
+    _mm_storel_epi64 ((__m128i *)v,
+                      _cairosdl_record_chroma8 (r, g, b, 112, -94, -18));
+}
+#endif
+
+/* Converts the top left width x height pixels of the source into the
+ * planes of a frame chroma_stride / 2 pixels wide. */
+static void
+_cairosdl_record_convert_yuv420 (unsigned char *y_plane,
+                                 unsigned char *u_plane,
+                                 unsigned char *v_plane,
+                                 int            y_stride,
+                                 int            chroma_stride,
+                                 Uint32 const  *src,
+                                 int            src_stride,
+                                 int            width,
+                                 int            height)
+{
+    int y;
+
+    for (y = 0; y < height; y += 2) {
+        Uint32 const *row0 = src + y*src_stride;
+        Uint32 const *row1 = y + 1 < height ? row0 + src_stride : row0;
+        unsigned char *y0 = y_plane + y*y_stride;
+        unsigned char *y1 = y0 + y_stride;
+        unsigned char *u = u_plane + y/2*chroma_stride;
+        unsigned char *v = v_plane + y/2*chroma_stride;
+        int x = 0;
+
+#if CAIROSDL_USE_SSE2
+        if (y + 1 < height) {
+            for (; x + 16 <= width; x += 16) {
+                _cairosdl_record_yuv420_16 (row0 + x, row1 + x,
+                                            y0 + x, y1 + x,
+                                            u + x/2, v + x/2);
+            }
+        }
+#endif
+        for (; x < width; x += 2) {
+            int x1 = x + 1 < width ? x + 1 : x;
+            Uint32 p00 = row0[x], p01 = row0[x1];
+            Uint32 p10 = row1[x], p11 = row1[x1];
+            int r = (R(p00) + R(p01) + R(p10) + R(p11) + 2) >> 2;
+            int g = (G(p00) + G(p01) + G(p10) + G(p11) + 2) >> 2;
+            int b = (B(p00) + B(p01) + B(p10) + B(p11) + 2) >> 2;
+
+            y0[x] = LUMA (R(p00), G(p00), B(p00));
+            if (x1 != x)
+                y0[x1] = LUMA (R(p01), G(p01), B(p01));
+            if (row1 != row0) {
+                y1[x] = LUMA (R(p10), G(p10), B(p10));
+                if (x1 != x)
+                    y1[x1] = LUMA (R(p11), G(p11), B(p11));
+            }
+            u[x/2] = CHROMA_U (r, g, b);
+            v[x/2] = CHROMA_V (r, g, b);
+        }
+    }
+}
+
+static void
+_cairosdl_record_convert_bgra (unsigned char *dst,
+                               int            dst_stride,
+                               Uint32 const  *src,
+                               int            src_stride,
+                               int            width,
+                               int            height,
+                               Uint32         amask)
+{
+    Uint32 const opaque = CAIROSDL_AMASK & ~amask;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        Uint32 *d = (Uint32 *)(dst + y*dst_stride);
+        Uint32 const *s = src + y*src_stride;
+        for (x = 0; x < width; x++) {
+            Uint32 p = s[x] | opaque;
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+            p = SDL_Swap32 (p);
+#endif
+            d[x] = p;
+        }
+    }
+}
+
+cairosdl_record_t *
+cairosdl_record_create (int                      fd,
+                        cairosdl_record_format_t format,
+                        int                      width,
+                        int                      height,
+                        int                      fps)
+{
+    cairosdl_record_t *record;
+    int i;
+
+    if (width <= 0 || height <= 0) {
+        SDL_SetError ("cairosdl_record_create: invalid size");
+        return NULL;
+    }
+    if (format == CAIROSDL_RECORD_Y4M && fps > 0) {
+        char header[128];
+        int error;
+        sprintf (header, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n",
+                 width, height, fps);
+        error = _cairosdl_record_write_all (
+            fd, (unsigned char const *)header, strlen (header));
+        if (error != 0) {
+            SDL_SetError ("cairosdl_record_create: %s", strerror (error));
+            return NULL;
+        }
+    }
+    else if (format == CAIROSDL_RECORD_Y4M) {
+        SDL_SetError ("cairosdl_record_create: invalid frame rate");
+        return NULL;
+    }
+
+    record = (cairosdl_record_t *)calloc (1, sizeof (*record));
+    if (record == NULL) {
+        SDL_OutOfMemory ();
+        return NULL;
+    }
+    record->fd = fd;
+    record->format = format;
+    record->width = width;
+    record->height = height;
+    if (format == CAIROSDL_RECORD_Y4M) {
+        record->frame_size = Y4M_FRAME_HEADER_SIZE + (size_t)width*height +
+            2 * (size_t)((width + 1)/2) * ((height + 1)/2);
+    }
+    else {
+        record->frame_size = 4 * (size_t)width*height;
+    }
+
+    for (i = 0; i < 2; i++) {
+        record->buffers[i] = (unsigned char *)malloc (record->frame_size);
+        if (record->buffers[i] == NULL) {
+            SDL_OutOfMemory ();
+            goto FAIL;
+        }
+        if (format == CAIROSDL_RECORD_Y4M) {
+            memcpy (record->buffers[i], Y4M_FRAME_HEADER,
+                    Y4M_FRAME_HEADER_SIZE);
+        }
+    }
+
+    record->mutex = SDL_CreateMutex ();
+    record->cond = SDL_CreateCond ();
+    if (record->mutex == NULL || record->cond == NULL)
+        goto FAIL;
+    record->writer = SDL_CreateThread (_cairosdl_record_writer, record);
+    if (record->writer == NULL)
+        goto FAIL;
+    return record;
+
+ FAIL:
+    if (record->cond)
+        SDL_DestroyCond (record->cond);
+    if (record->mutex)
+        SDL_DestroyMutex (record->mutex);
+    free (record->buffers[0]);
+    free (record->buffers[1]);
+    free (record);
+    return NULL;
+}
+
+cairosdl_record_t *
+cairosdl_record_open (char const *filename,
+                      int         width,
+                      int         height,
+                      int         fps)
+{
+    size_t len = strlen (filename);
+    cairosdl_record_format_t format =
+        len >= 4 && 0 == strcmp (filename + len - 4, ".y4m")
+        ? CAIROSDL_RECORD_Y4M : CAIROSDL_RECORD_BGRA;
+    cairosdl_record_t *record;
+    int fd;
+
+    /* Whatever reads the standard output, like ffmpeg -i -, needs the
+     * header to know the size and rate. */
+    if (0 == strcmp (filename, "-")) {
+        format = CAIROSDL_RECORD_Y4M;
+        fd = dup (1);
+    }
+    else
+        fd = open (filename, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0644);
+    if (fd < 0) {
+        SDL_SetError ("cairosdl_record_open: %s: %s", filename,
+                      strerror (errno));
+        return NULL;
+    }
+
+    record = cairosdl_record_create (fd, format, width, height, fps);
+    if (record == NULL)
+        close (fd);
+    return record;
+}
+
+int
+cairosdl_record_destroy (cairosdl_record_t *record)
+{
+    int error;
+
+    if (record == NULL)
+        return 0;
+
+    SDL_LockMutex (record->mutex);
+    record->quit = 1;
+    SDL_CondBroadcast (record->cond);
+    SDL_UnlockMutex (record->mutex);
+    SDL_WaitThread (record->writer, NULL);
+
+    error = record->write_errno;
+    if (close (record->fd) != 0 && error == 0)
+        error = errno;
+    SDL_DestroyCond (record->cond);
+    SDL_DestroyMutex (record->mutex);
+    free (record->buffers[0]);
+    free (record->buffers[1]);
+    free (record);
+
+    if (error != 0) {
+        SDL_SetError ("cairosdl_record_destroy: %s", strerror (error));
+        return -1;
+    }
+    return 0;
+}
+
+int
+cairosdl_record_frame (cairosdl_record_t *record,
+                       SDL_Surface       *frame)
+{
+    SDL_PixelFormat const *format = frame->format;
+    unsigned char *buffer = record->buffers[record->back];
+    int width = frame->w < record->width ? frame->w : record->width;
+    int height = frame->h < record->height ? frame->h : record->height;
+    int error;
+
+    if (format->BitsPerPixel != 32 ||
+        format->Rmask != CAIROSDL_RMASK ||
+        format->Gmask != CAIROSDL_GMASK ||
+        format->Bmask != CAIROSDL_BMASK ||
+        (format->Amask != 0 && format->Amask != CAIROSDL_AMASK))
+    {
+        SDL_SetError ("cairosdl_record_frame: unsupported frame format");
+        return -1;
+    }
+
+    /* Wait for the writer to be done with the buffer. */
+    SDL_LockMutex (record->mutex);
+    while (record->queued[record->back])
+        SDL_CondWait (record->cond, record->mutex);
+    error = record->write_errno;
+    SDL_UnlockMutex (record->mutex);
+    if (error != 0) {
+        SDL_SetError ("cairosdl_record_frame: %s", strerror (error));
+        return -1;
+    }
+
+    if (record->format == CAIROSDL_RECORD_Y4M) {
+        int chroma_width = (record->width + 1)/2;
+        size_t y_size = (size_t)record->width*record->height;
+        size_t chroma_size = (size_t)chroma_width*((record->height + 1)/2);
+        unsigned char *y_plane = buffer + Y4M_FRAME_HEADER_SIZE;
+        unsigned char *u_plane = y_plane + y_size;
+        unsigned char *v_plane = u_plane + chroma_size;
+
+        if (width != record->width || height != record->height) {
+            memset (y_plane, 16, y_size);
+            memset (u_plane, 128, 2*chroma_size);
+        }
+        _cairosdl_record_convert_yuv420 (
+            y_plane, u_plane, v_plane, record->width, chroma_width,
+            (Uint32 const *)frame->pixels, frame->pitch / 4,
+            width, height);
+    }
+    else {
+        if (width != record->width || height != record->height)
+            memset (buffer, 0, record->frame_size);
+        _cairosdl_record_convert_bgra (
+            buffer, 4*record->width,
+            (Uint32 const *)frame->pixels, frame->pitch / 4,
+            width, height, format->Amask);
+    }
+
+    SDL_LockMutex (record->mutex);
+    record->queued[record->back] = 1;
+    SDL_CondBroadcast (record->cond);
+    SDL_UnlockMutex (record->mutex);
+    record->back ^= 1;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
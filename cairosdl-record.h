@@ -0,0 +1,93 @@
+#ifndef CAIROSDL_RECORD_H
+#define CAIROSDL_RECORD_H
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cairosdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Recording frames as raw video.
+ *
+ * A recording takes finished frames, converts them to the recording's
+ * pixel format and writes them to a file descriptor from a thread of
+ * its own.  There are two frame buffers, so one frame can be
+ * converted while the one before it is being written.  Recording
+ * only waits for the writer when both buffers are full.
+ *
+ * Y4M recordings are YUV 4:2:0 with BT.601 limited range colours that
+ * encoders like ffmpeg and x264 read directly.  BGRA recordings are
+ * headerless frames of 4 bytes per pixel in the order B, G, R, A,
+ * with opaque alpha for frames without an alpha channel. */
+
+typedef enum {
+    CAIROSDL_RECORD_Y4M,
+    CAIROSDL_RECORD_BGRA
+} cairosdl_record_format_t;
+
+typedef struct _cairosdl_record cairosdl_record_t;
+
+/* Start recording frames of the given size to a file descriptor.
+ * The frame rate only goes into the Y4M header.  The descriptor is
+ * closed when the recording is destroyed.  Returns NULL with
+ * SDL_GetError() set on failure. */
+cairosdl_record_t *
+cairosdl_record_create (int                      fd,
+                        cairosdl_record_format_t format,
+                        int                      width,
+                        int                      height,
+                        int                      fps);
+
+/* Like cairosdl_record_create(), but records into a file that's
+ * created.  Files with a name ending in .y4m get Y4M, others BGRA.  A
+ * file name of "-" records Y4M to the standard output. */
+cairosdl_record_t *
+cairosdl_record_open (char const *filename,
+                      int         width,
+                      int         height,
+                      int         fps);
+
+/* Waits for the frames recorded to be written and destroys the
+ * recording.  Returns 0 if everything was written and -1 with
+ * SDL_GetError() set if a write failed. */
+int
+cairosdl_record_destroy (cairosdl_record_t *record);
+
+/* Converts a frame and queues it to be written.  The frame must be a
+ * 32 bit SDL_Surface with the cairosdl channel masks, locked or not
+ * needing locking, such as the target of a flushed cairosdl surface.
+ * A frame of a different size from the recording is cut off or
+ * padded with black.  Returns 0 on success and -1 with SDL_GetError()
+ * set if the frame's format doesn't fit or an earlier write
+ * failed. */
+int
+cairosdl_record_frame (cairosdl_record_t *record,
+                       SDL_Surface       *frame);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CAIROSDL_RECORD_H */
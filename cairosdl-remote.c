@@ -0,0 +1,767 @@
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-remote.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#  include <errno.h>
+#  include <netdb.h>
+#  include <poll.h>
+#  include <time.h>
+#  include <unistd.h>
+#  include <netinet/in.h>
+#  include <netinet/tcp.h>
+#  include <sys/socket.h>
+#  include <sys/un.h>
+#  define CAIROSDL_HAVE_SOCKETS 1
+#  ifndef MSG_NOSIGNAL
+#    define MSG_NOSIGNAL 0
+#  endif
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef CAIROSDL_HAVE_SOCKETS
+
+#define TILE CAIROSDL_REMOTE_TILE_SIZE
+#define FRAME_HEADER_SIZE 16
+#define TILE_HEADER_SIZE 12
+#define MAX_RUN 256
+
+struct _cairosdl_remote {
+    int fd;
+
+    /* The sender's copy of the last frame sent, width x height. */
+    Uint32 *previous;
+    int width;
+    int height;
+
+    /* Messages being built or received. */
+    unsigned char *buffer;
+    size_t buffer_size;
+
+    /* The receiver's frame. */
+    SDL_Surface *frame;
+};
+
+static double
+_cairosdl_remote_now (void)
+{
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return SDL_GetTicks () / 1000.0;
+#endif
+}
+
+static void
+_cairosdl_remote_put16 (unsigned char *p, Uint32 x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+}
+
+static void
+_cairosdl_remote_put32 (unsigned char *p, Uint32 x)
+{
+    p[0] = x;
+    p[1] = x >> 8;
+    p[2] = x >> 16;
+    p[3] = x >> 24;
+}
+
+static Uint32
+_cairosdl_remote_get16 (unsigned char const *p)
+{
+    return p[0] | (Uint32)p[1] << 8;
+}
+
+static Uint32
+_cairosdl_remote_get32 (unsigned char const *p)
+{
+    return p[0] | (Uint32)p[1] << 8 | (Uint32)p[2] << 16 | (Uint32)p[3] << 24;
+}
+
+static int
+_cairosdl_remote_reserve (cairosdl_remote_t *remote, size_t size)
+{
+    unsigned char *buffer;
+
+    if (size <= remote->buffer_size)
+        return 0;
+    buffer = (unsigned char *)realloc (remote->buffer, size);
+    if (buffer == NULL) {
+        SDL_OutOfMemory ();
+        return -1;
+    }
+    remote->buffer = buffer;
+    remote->buffer_size = size;
+    return 0;
+}
+
+/* Splits an address into a Unix socket path or a TCP host and port.
+ * Returns a socket address in OUT_addr or zero with SDL_GetError()
+ * set. */
+static int
+_cairosdl_remote_resolve (char const *address, int passive,
+                          struct sockaddr_storage *OUT_addr,
+                          socklen_t *OUT_addr_len)
+{
+    struct addrinfo hints, *info;
+    char host[256];
+    char const *port = strrchr (address, ':');
+    size_t host_len;
+    int error;
+
+    memset (OUT_addr, 0, sizeof (*OUT_addr));
+
+    if (strchr (address, '/') != NULL) {
+        struct sockaddr_un *unix_addr = (struct sockaddr_un *)OUT_addr;
+        if (strlen (address) >= sizeof (unix_addr->sun_path)) {
+            SDL_SetError ("cairosdl_remote: socket path too long");
+            return 0;
+        }
+        unix_addr->sun_family = AF_UNIX;
+        strcpy (unix_addr->sun_path, address);
+        *OUT_addr_len = sizeof (*unix_addr);
+        return 1;
+    }
+
+    host_len = port ? (size_t)(port - address) : 0;
+    if (port == NULL || host_len >= sizeof (host)) {
+        SDL_SetError ("cairosdl_remote: %s isn't host:port or a path",
+                      address);
+        return 0;
+    }
+    memcpy (host, address, host_len);
+    host[host_len] = '\0';
+
+    memset (&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    error = getaddrinfo (host_len ? host : NULL, port + 1, &hints, &info);
+    if (error != 0) {
+        SDL_SetError ("cairosdl_remote: %s: %s", address,
+                      gai_strerror (error));
+        return 0;
+    }
+    memcpy (OUT_addr, info->ai_addr, info->ai_addrlen);
+    *OUT_addr_len = info->ai_addrlen;
+    freeaddrinfo (info);
+    return 1;
+}
+
+static cairosdl_remote_t *
+_cairosdl_remote_create (int fd)
+{
+    cairosdl_remote_t *remote =
+        (cairosdl_remote_t *)calloc (1, sizeof (*remote));
+    if (remote == NULL) {
+        SDL_OutOfMemory ();
+        close (fd);
+        return NULL;
+    }
+    remote->fd = fd;
+    return remote;
+}
+
+cairosdl_remote_t *
+cairosdl_remote_connect (char const *address)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int one = 1;
+    int fd;
+
+    if (!_cairosdl_remote_resolve (address, 0, &addr, &addr_len))
+        return NULL;
+
+    fd = socket (addr.ss_family, SOCK_STREAM, 0);
+    if (fd < 0 || connect (fd, (struct sockaddr *)&addr, addr_len) != 0) {
+        SDL_SetError ("cairosdl_remote_connect: %s: %s", address,
+                      strerror (errno));
+        if (fd >= 0)
+            close (fd);
+        return NULL;
+    }
+    /* Frames are written in one go, so don't wait for more. */
+    if (addr.ss_family != AF_UNIX)
+        setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+    return _cairosdl_remote_create (fd);
+}
+
+cairosdl_remote_t *
+cairosdl_remote_accept (char const *address)
+{
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    int one = 1;
+    int listener;
+    int fd;
+
+    if (!_cairosdl_remote_resolve (address, 1, &addr, &addr_len))
+        return NULL;
+
+    listener = socket (addr.ss_family, SOCK_STREAM, 0);
+    if (listener < 0) {
+        SDL_SetError ("cairosdl_remote_accept: %s", strerror (errno));
+        return NULL;
+    }
+    if (addr.ss_family == AF_UNIX)
+        unlink (address);
+    else
+        setsockopt (listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof (one));
+
+    if (bind (listener, (struct sockaddr *)&addr, addr_len) != 0 ||
+        listen (listener, 1) != 0 ||
+        (fd = accept (listener, NULL, NULL)) < 0)
+    {
+        SDL_SetError ("cairosdl_remote_accept: %s: %s", address,
+                      strerror (errno));
+        close (listener);
+        if (addr.ss_family == AF_UNIX)
+            unlink (address);
+        return NULL;
+    }
+    close (listener);
+    if (addr.ss_family == AF_UNIX)
+        unlink (address);
+    return _cairosdl_remote_create (fd);
+}
+
+void
+cairosdl_remote_destroy (cairosdl_remote_t *remote)
+{
+    if (remote == NULL)
+        return;
+    close (remote->fd);
+    free (remote->previous);
+    free (remote->buffer);
+    if (remote->frame)
+        SDL_FreeSurface (remote->frame);
+    free (remote);
+}
+
+/* Returns nonzero if the rows' colour channels differ anywhere. */
+static int
+_cairosdl_remote_row_changed (Uint32 const *previous,
+                              Uint32 const *src,
+                              int width)
+{
+    Uint32 const rgb_mask = CAIROSDL_RMASK | CAIROSDL_GMASK | CAIROSDL_BMASK;
+    int x;
+
+    if (0 == memcmp (previous, src, 4 * (size_t)width))
+        return 0;
+    for (x = 0; x < width; x++) {
+        if ((previous[x] ^ src[x]) & rgb_mask)
+            return 1;
+    }
+    return 0;
+}
+
+/* Compares a tile of the frame with the last frame sent and copies
+ * it over if it changed.  Like the encoder it ignores the X byte, so
+ * a frame that only scribbles there isn't sent again.  Returns zero
+ * if it didn't change. */
+static int
+_cairosdl_remote_update_tile (Uint32 *previous, int previous_stride,
+                              Uint32 const *src, int src_stride,
+                              int width, int height)
+{
+    size_t row_size = 4 * (size_t)width;
+    int y = 0;
+
+    while (y < height &&
+           !_cairosdl_remote_row_changed (previous + y*previous_stride,
+                                          src + y*src_stride, width))
+    {
+        y++;
+    }
+    if (y == height)
+        return 0;
+    for (; y < height; y++)
+        memcpy (previous + y*previous_stride, src + y*src_stride, row_size);
+    return 1;
+}
+
+static unsigned char *
+_cairosdl_remote_put_pixel (unsigned char *out, Uint32 p)
+{
+    out[0] = p >> CAIROSDL_BSHIFT;
+    out[1] = p >> CAIROSDL_GSHIFT;
+    out[2] = p >> CAIROSDL_RSHIFT;
+    return out + 3;
+}
+
+/* Run length encodes a tile into at most limit bytes.  Returns the
+ * number of bytes used or zero if they didn't fit. */
+static size_t
+_cairosdl_remote_encode_rle (unsigned char *out, size_t limit,
+                             Uint32 const *src, int stride,
+                             int width, int height)
+{
+    unsigned char *end = out + limit;
+    unsigned char *p = out;
+    Uint32 const rgb_mask = CAIROSDL_RMASK | CAIROSDL_GMASK | CAIROSDL_BMASK;
+    Uint32 run_pixel = 0;
+    int run = 0;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        Uint32 const *row = src + y*stride;
+        for (x = 0; x < width; x++) {
+            Uint32 pixel = row[x] & rgb_mask;
+            if (run > 0 && pixel == run_pixel && run < MAX_RUN) {
+                run++;
+                continue;
+            }
+            if (run > 0) {
+                if (end - p < 4)
+                    return 0;
+                *p = run - 1;
+                p = _cairosdl_remote_put_pixel (p + 1, run_pixel);
+            }
+            run_pixel = pixel;
+            run = 1;
+        }
+    }
+    if (end - p < 4)
+        return 0;
+    *p = run - 1;
+    p = _cairosdl_remote_put_pixel (p + 1, run_pixel);
+    return p - out;
+}
+
+static size_t
+_cairosdl_remote_encode_raw (unsigned char *out,
+                             Uint32 const *src, int stride,
+                             int width, int height)
+{
+    unsigned char *p = out;
+    int x, y;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++)
+            p = _cairosdl_remote_put_pixel (p, src[y*stride + x]);
+    }
+    return p - out;
+}
+
+static int
+_cairosdl_remote_send_all (int fd, unsigned char const *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = send (fd, data, size, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+    return 0;
+}
+
+int
+cairosdl_remote_send_frame (cairosdl_remote_t       *remote,
+                            SDL_Surface             *frame,
+                            cairosdl_remote_stats_t *stats)
+{
+    SDL_PixelFormat const *format = frame->format;
+    double start = _cairosdl_remote_now ();
+    Uint32 const *pixels = (Uint32 const *)frame->pixels;
+    int stride = frame->pitch / 4;
+    int width = frame->w;
+    int height = frame->h;
+    int columns = (width + TILE - 1) / TILE;
+    int rows = (height + TILE - 1) / TILE;
+    int full = 0;
+    int num_tiles = 0;
+    unsigned char *out;
+    int column, row;
+
+    if (stats)
+        memset (stats, 0, sizeof (*stats));
+
+    if (format->BitsPerPixel != 32 ||
+        format->Rmask != CAIROSDL_RMASK ||
+        format->Gmask != CAIROSDL_GMASK ||
+        format->Bmask != CAIROSDL_BMASK ||
+        width > 0xffff || height > 0xffff)
+    {
+        SDL_SetError ("cairosdl_remote_send_frame: unsupported frame");
+        return -1;
+    }
+
+    if (remote->previous == NULL ||
+        remote->width != width || remote->height != height)
+    {
+        free (remote->previous);
+        remote->previous = (Uint32 *)malloc (4 * (size_t)width * height);
+        if (remote->previous == NULL && width * height > 0) {
+            SDL_OutOfMemory ();
+            return -1;
+        }
+        remote->width = width;
+        remote->height = height;
+        full = 1;
+    }
+
+    /* Every tile might go raw. */
+    if (_cairosdl_remote_reserve (
+            remote, FRAME_HEADER_SIZE + (size_t)columns * rows *
+            (TILE_HEADER_SIZE + 3 * TILE * TILE)) != 0)
+    {
+        return -1;
+    }
+
+    out = remote->buffer + FRAME_HEADER_SIZE;
+    for (row = 0; row < rows; row++) {
+        for (column = 0; column < columns; column++) {
+            int x = column * TILE;
+            int y = row * TILE;
+            int w = width - x < TILE ? width - x : TILE;
+            int h = height - y < TILE ? height - y : TILE;
+            Uint32 const *src = pixels + y*stride + x;
+            Uint32 *previous = remote->previous + y*width + x;
+            size_t raw_size = 3 * (size_t)w * h;
+            cairosdl_remote_codec_t codec = CAIROSDL_REMOTE_RLE;
+            size_t size;
+
+            if (full) {
+                int i;
+                for (i = 0; i < h; i++)
+                    memcpy (previous + i*width, src + i*stride, 4 * (size_t)w);
+            }
+            else if (!_cairosdl_remote_update_tile (previous, width,
+                                                    src, stride, w, h))
+            {
+                continue;
+            }
+
+            size = _cairosdl_remote_encode_rle (out + TILE_HEADER_SIZE,
+                                                raw_size - 1,
+                                                src, stride, w, h);
+            if (size == 0) {
+                codec = CAIROSDL_REMOTE_RAW;
+                size = _cairosdl_remote_encode_raw (out + TILE_HEADER_SIZE,
+                                                    src, stride, w, h);
+            }
+            _cairosdl_remote_put16 (out, column);
+            _cairosdl_remote_put16 (out + 2, row);
+            out[4] = codec;
+            out[5] = out[6] = out[7] = 0;
+            _cairosdl_remote_put32 (out + 8, size);
+            out += TILE_HEADER_SIZE + size;
+            num_tiles++;
+        }
+    }
+
+    if (stats) {
+        stats->encode_time = _cairosdl_remote_now () - start;
+        stats->tiles = num_tiles;
+    }
+    if (num_tiles == 0)
+        return 0;
+
+    _cairosdl_remote_put32 (remote->buffer, CAIROSDL_REMOTE_MAGIC);
+    _cairosdl_remote_put16 (remote->buffer + 4, width);
+    _cairosdl_remote_put16 (remote->buffer + 6, height);
+    _cairosdl_remote_put32 (remote->buffer + 8, num_tiles);
+    _cairosdl_remote_put32 (remote->buffer + 12,
+                            out - remote->buffer - FRAME_HEADER_SIZE);
+
+    if (_cairosdl_remote_send_all (remote->fd, remote->buffer,
+                                   out - remote->buffer) != 0)
+    {
+        SDL_SetError ("cairosdl_remote_send_frame: %s", strerror (errno));
+        return -1;
+    }
+    if (stats)
+        stats->bytes = out - remote->buffer;
+    return 0;
+}
+
+int
+cairosdl_remote_wait (cairosdl_remote_t *remote,
+                      int                timeout_ms)
+{
+    struct pollfd pfd;
+    int n;
+
+    pfd.fd = remote->fd;
+    pfd.events = POLLIN;
+    do {
+        n = poll (&pfd, 1, timeout_ms);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        SDL_SetError ("cairosdl_remote_wait: %s", strerror (errno));
+        return -1;
+    }
+    return n > 0;
+}
+
+/* Reads exactly size bytes.  Returns 1 on success, 0 if the sender
+ * hung up before any were read and -1 otherwise. */
+static int
+_cairosdl_remote_receive_all (int fd, unsigned char *data, size_t size)
+{
+    size_t done = 0;
+
+    while (done < size) {
+        ssize_t n = recv (fd, data + done, size - done, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n == 0 && done == 0)
+            return 0;
+        if (n <= 0) {
+            SDL_SetError ("cairosdl_remote_receive_frame: %s",
+                          n == 0 ? "truncated frame" : strerror (errno));
+            return -1;
+        }
+        done += n;
+    }
+    return 1;
+}
+
+static Uint32
+_cairosdl_remote_get_pixel (unsigned char const *p)
+{
+    return (Uint32)p[0] << CAIROSDL_BSHIFT |
+        (Uint32)p[1] << CAIROSDL_GSHIFT |
+        (Uint32)p[2] << CAIROSDL_RSHIFT;
+}
+
+/* Decodes a tile into the frame.  Returns zero if the data is bad. */
+static int
+_cairosdl_remote_decode_tile (cairosdl_remote_codec_t codec,
+                              unsigned char const *data, size_t size,
+                              Uint32 *dst, int stride,
+                              int width, int height)
+{
+    unsigned char const *end = data + size;
+    int x = 0, y = 0;
+
+    if (codec == CAIROSDL_REMOTE_RAW) {
+        if (size != 3 * (size_t)width * height)
+            return 0;
+        for (y = 0; y < height; y++) {
+            for (x = 0; x < width; x++, data += 3)
+                dst[y*stride + x] = _cairosdl_remote_get_pixel (data);
+        }
+        return 1;
+    }
+
+    if (codec != CAIROSDL_REMOTE_RLE || size % 4 != 0)
+        return 0;
+    for (; data < end; data += 4) {
+        Uint32 pixel = _cairosdl_remote_get_pixel (data + 1);
+        int run = data[0] + 1;
+        while (run-- > 0) {
+            if (y == height)
+                return 0;
+            dst[y*stride + x] = pixel;
+            if (++x == width) {
+                x = 0;
+                y++;
+            }
+        }
+    }
+    return y == height;
+}
+
+int
+cairosdl_remote_receive_frame (cairosdl_remote_t       *remote,
+                               cairosdl_remote_stats_t *stats)
+{
+    unsigned char header[FRAME_HEADER_SIZE];
+    unsigned char const *p;
+    unsigned char const *end;
+    double start;
+    int width, height, num_tiles, status;
+    Uint32 *pixels;
+    int stride;
+    size_t size;
+    int i;
+
+    if (stats)
+        memset (stats, 0, sizeof (*stats));
+
+    status = _cairosdl_remote_receive_all (remote->fd, header,
+                                           sizeof (header));
+    if (status <= 0)
+        return status;
+    if (_cairosdl_remote_get32 (header) != CAIROSDL_REMOTE_MAGIC) {
+        SDL_SetError ("cairosdl_remote_receive_frame: not a frame");
+        return -1;
+    }
+    width = _cairosdl_remote_get16 (header + 4);
+    height = _cairosdl_remote_get16 (header + 6);
+    num_tiles = _cairosdl_remote_get32 (header + 8);
+    size = _cairosdl_remote_get32 (header + 12);
+
+    if (size > FRAME_HEADER_SIZE + (size_t)((width + TILE - 1) / TILE) *
+        ((height + TILE - 1) / TILE) * (TILE_HEADER_SIZE + 3 * TILE * TILE))
+    {
+        SDL_SetError ("cairosdl_remote_receive_frame: frame too big");
+        return -1;
+    }
+    if (_cairosdl_remote_reserve (remote, size) != 0)
+        return -1;
+    status = _cairosdl_remote_receive_all (remote->fd, remote->buffer, size);
+    if (status == 0)
+        SDL_SetError ("cairosdl_remote_receive_frame: truncated frame");
+    if (status <= 0)
+        return -1;
+
+    start = _cairosdl_remote_now ();
+    if (remote->frame == NULL ||
+        remote->frame->w != width || remote->frame->h != height)
+    {
+        if (remote->frame)
+            SDL_FreeSurface (remote->frame);
+        remote->frame = SDL_CreateRGBSurface (
+            SDL_SWSURFACE, width, height, 32,
+            CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, 0);
+        if (remote->frame == NULL)
+            return -1;
+    }
+    pixels = (Uint32 *)remote->frame->pixels;
+    stride = remote->frame->pitch / 4;
+
+    p = remote->buffer;
+    end = p + size;
+    for (i = 0; i < num_tiles; i++) {
+        int column, row, x, y;
+        size_t tile_size;
+
+        if (end - p < TILE_HEADER_SIZE)
+            break;
+        column = _cairosdl_remote_get16 (p);
+        row = _cairosdl_remote_get16 (p + 2);
+        tile_size = _cairosdl_remote_get32 (p + 8);
+        x = column * TILE;
+        y = row * TILE;
+        if (x >= width || y >= height ||
+            (size_t)(end - p - TILE_HEADER_SIZE) < tile_size ||
+            !_cairosdl_remote_decode_tile (
+                (cairosdl_remote_codec_t)p[4],
+                p + TILE_HEADER_SIZE, tile_size,
+                pixels + y*stride + x, stride,
+                width - x < TILE ? width - x : TILE,
+                height - y < TILE ? height - y : TILE))
+        {
+            break;
+        }
+        p += TILE_HEADER_SIZE + tile_size;
+    }
+    if (i < num_tiles || p != end) {
+        SDL_SetError ("cairosdl_remote_receive_frame: bad tile");
+        return -1;
+    }
+
+    if (stats) {
+        stats->bytes = FRAME_HEADER_SIZE + size;
+        stats->tiles = num_tiles;
+        stats->encode_time = _cairosdl_remote_now () - start;
+    }
+    return 1;
+}
+
+SDL_Surface *
+cairosdl_remote_get_frame (cairosdl_remote_t *remote)
+{
+    return remote->frame;
+}
+
+#else /* !CAIROSDL_HAVE_SOCKETS */
+
+cairosdl_remote_t *
+cairosdl_remote_connect (char const *address)
+{
+    (void)address;
+    SDL_SetError ("cairosdl_remote_connect: no sockets here");
+    return NULL;
+}
+
+cairosdl_remote_t *
+cairosdl_remote_accept (char const *address)
+{
+    (void)address;
+    SDL_SetError ("cairosdl_remote_accept: no sockets here");
+    return NULL;
+}
+
+void
+cairosdl_remote_destroy (cairosdl_remote_t *remote)
+{
+    (void)remote;
+}
+
+int
+cairosdl_remote_send_frame (cairosdl_remote_t       *remote,
+                            SDL_Surface             *frame,
+                            cairosdl_remote_stats_t *stats)
+{
+    (void)remote; (void)frame; (void)stats;
+    return -1;
+}
+
+int
+cairosdl_remote_wait (cairosdl_remote_t *remote,
+                      int                timeout_ms)
+{
+    (void)remote; (void)timeout_ms;
+    return -1;
+}
+
+int
+cairosdl_remote_receive_frame (cairosdl_remote_t       *remote,
+                               cairosdl_remote_stats_t *stats)
+{
+    (void)remote; (void)stats;
+    return -1;
+}
+
+SDL_Surface *
+cairosdl_remote_get_frame (cairosdl_remote_t *remote)
+{
+    (void)remote;
+    return NULL;
+}
+
+#endif /* CAIROSDL_HAVE_SOCKETS */
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,125 @@
+#ifndef CAIROSDL_REMOTE_H
+#define CAIROSDL_REMOTE_H
+/*
+ * Copyright (c) 2009  M Joonas Pihlaja
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include "cairosdl.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Shipping frames to a remote display.
+ *
+ * The sender splits each frame into tiles of CAIROSDL_REMOTE_TILE_SIZE
+ * pixels square, compares them with the frame sent before and sends
+ * only the tiles that changed.  A changed tile is sent run length
+ * encoded, or as raw RGB if that's smaller.  The receiver keeps the
+ * whole frame and patches the tiles into it.
+ *
+ * Addresses containing a '/' are Unix domain socket paths and others
+ * are host:port for TCP.  The receiver listens and the sender
+ * connects to it.  This is only available on POSIX systems.
+ *
+ * Every message is a frame: a header of four little endian fields
+ *
+ *   Uint32 magic, Uint16 width, Uint16 height,
+ *   Uint32 number of tiles, Uint32 bytes of tiles following
+ *
+ * and then the tiles, each with a header of
+ *
+ *   Uint16 column, Uint16 row, Uint8 codec, 3 bytes padding,
+ *   Uint32 bytes of data following
+ *
+ * The raw codec has 3 bytes per pixel, B, G and R, row after row.
+ * The run length codec has runs of 4 bytes: the run length minus one
+ * and then B, G and R of the pixels of the run.  Runs go on from one
+ * row of the tile to the next.  The first frame after a change of
+ * size has every tile. */
+
+#define CAIROSDL_REMOTE_MAGIC 0x46525343 /* "CSRF" */
+#define CAIROSDL_REMOTE_TILE_SIZE 64
+
+typedef enum {
+    CAIROSDL_REMOTE_RAW,
+    CAIROSDL_REMOTE_RLE
+} cairosdl_remote_codec_t;
+
+typedef struct _cairosdl_remote cairosdl_remote_t;
+
+/* What sending a frame cost. */
+typedef struct {
+    size_t bytes;               /* sent, headers included */
+    int tiles;                  /* changed and sent */
+    double encode_time;         /* seconds comparing and compressing */
+} cairosdl_remote_stats_t;
+
+/* Connect to a receiver.  Returns NULL with SDL_GetError() set on
+ * failure. */
+cairosdl_remote_t *
+cairosdl_remote_connect (char const *address);
+
+/* Listen at the address and wait for a sender to connect.  Returns
+ * NULL with SDL_GetError() set on failure. */
+cairosdl_remote_t *
+cairosdl_remote_accept (char const *address);
+
+void
+cairosdl_remote_destroy (cairosdl_remote_t *remote);
+
+/* Sends the tiles of a frame that changed since the last one sent.
+ * Nothing is sent if none did.  The frame must be 32 bits with the
+ * cairosdl channel masks and locked or not need locking.  Its alpha
+ * isn't sent.  If stats isn't NULL it's filled in.  Returns 0 on
+ * success and -1 with SDL_GetError() set on failure. */
+int
+cairosdl_remote_send_frame (cairosdl_remote_t       *remote,
+                            SDL_Surface             *frame,
+                            cairosdl_remote_stats_t *stats);
+
+/* Waits up to timeout_ms milliseconds, or forever if negative, for a
+ * frame to start arriving.  Returns 1 if one is, 0 if not and -1 on
+ * failure. */
+int
+cairosdl_remote_wait (cairosdl_remote_t *remote,
+                      int                timeout_ms);
+
+/* Receives a frame and patches it into the received frame.  If stats
+ * isn't NULL it's filled in with what was received.  Returns 1 when
+ * a frame was received, 0 when the sender has hung up and -1 with
+ * SDL_GetError() set on failure. */
+int
+cairosdl_remote_receive_frame (cairosdl_remote_t       *remote,
+                               cairosdl_remote_stats_t *stats);
+
+/* Returns the frame received so far as an XRGB SDL_Surface owned by
+ * the remote, or NULL if none has been received.  It may change with
+ * every frame received. */
+SDL_Surface *
+cairosdl_remote_get_frame (cairosdl_remote_t *remote);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* CAIROSDL_REMOTE_H */
@@ -24,8 +24,24 @@
  * OTHER DEALINGS IN THE SOFTWARE.
  */
 #include <assert.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 #include "cairosdl.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#  include <unistd.h>
+#  include <time.h>
+#endif
+
+#if defined(__SSE2__) && !defined(CAIROSDL_NO_SSE2)
+#  define CAIROSDL_USE_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define CAIROSDL_USE_SSE2 0
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -49,6 +65,29 @@ _cairosdl_blit_and_premultiply (
     int         width,
     int         height);
 
+typedef struct _cairosdl_binding _cairosdl_binding_t;
+typedef struct _cairosdl_async _cairosdl_async_t;
+
+static void
+_cairosdl_async_wait (_cairosdl_async_t *async);
+
+static void
+_cairosdl_async_destroy (_cairosdl_async_t *async);
+
+static void
+_cairosdl_flush_scaled_rects (
+    cairo_surface_t           *surface,
+    _cairosdl_binding_t const *binding,
+    int                        num_rects,
+    SDL_Rect const            *rects);
+
+static void
+_cairosdl_mark_dirty_scaled_rects (
+    cairo_surface_t           *surface,
+    _cairosdl_binding_t const *binding,
+    int                        num_rects,
+    SDL_Rect const            *rects);
+
 /*
  * Surface functions
  */
@@ -58,6 +97,36 @@ _cairosdl_blit_and_premultiply (
  * to initialise it for C++. */
 static cairo_user_data_key_t const CAIROSDL_TARGET_KEY[1] = {{1}};
 
+/* Surfaces that aren't a plain image of their SDL_Surface, like
+ * those from cairosdl_surface_create_scaled(), have their extra
+ * state hung on them using this key. */
+static cairo_user_data_key_t const CAIROSDL_BINDING_KEY[1] = {{1}};
+
+struct _cairosdl_binding {
+    double scale;               /* image size / SDL_Surface size */
+    cairosdl_scale_filter_t filter;
+
+    /* Shared by the two surfaces of cairosdl_surface_flush_async()
+     * and owned by the first. */
+    _cairosdl_async_t *async;
+    int owns_async;
+
+    /* The shadow image's pixels.  They're freed here rather than by
+     * cairo, which frees its own before the binding goes, so that a
+     * flush still pending when the surface is destroyed can finish. */
+    unsigned char *shadow;
+
+    unsigned flags;             /* from cairosdl_surface_create_with_flags() */
+    double lock_time;           /* seconds the SDL_Surface was locked */
+
+    /* The SDL_Surface of a CAIROSDL_IN_PLACE surface, referenced so
+     * its pixels can be put back when the surface goes, and a bit per
+     * pixel set from marking it dirty until it's flushed again, in
+     * rows of (w + 7)/8 bytes. */
+    SDL_Surface *in_place;
+    unsigned char *premultiplied;
+};
+
 static void
 sdl_surface_destroy_func (void *param)
 {
@@ -66,36 +135,344 @@ sdl_surface_destroy_func (void *param)
         SDL_FreeSurface (sdl_surface);
 }
 
-cairo_surface_t *
-cairosdl_surface_create (
-    SDL_Surface *sdl_surface)
+static _cairosdl_binding_t *
+_cairosdl_surface_get_binding (cairo_surface_t *surface)
 {
-    cairo_surface_t *target;
-    cairo_format_t format;
-    int is_dirty;
+    return (_cairosdl_binding_t *)
+        cairo_surface_get_user_data (surface, CAIROSDL_BINDING_KEY);
+}
+
+/* Clips the rectangle to a CAIROSDL_IN_PLACE surface.  Returns zero
+ * if nothing's left. */
+static int
+_cairosdl_binding_clip_in_place (
+    _cairosdl_binding_t *binding,
+    SDL_Rect const      *rect,
+    int                 *OUT_x0,
+    int                 *OUT_y0,
+    int                 *OUT_x1,
+    int                 *OUT_y1)
+{
+    SDL_Surface *sdl_surface = binding->in_place;
+
+    *OUT_x0 = rect->x > 0 ? rect->x : 0;
+    *OUT_y0 = rect->y > 0 ? rect->y : 0;
+    *OUT_x1 = rect->x + rect->w;
+    *OUT_y1 = rect->y + rect->h;
+    if (*OUT_x1 > sdl_surface->w) *OUT_x1 = sdl_surface->w;
+    if (*OUT_y1 > sdl_surface->h) *OUT_y1 = sdl_surface->h;
+    return *OUT_x0 < *OUT_x1 && *OUT_y0 < *OUT_y1;
+}
+
+/* Sets or clears the premultiplied bits of a CAIROSDL_IN_PLACE
+ * surface's pixels in the rectangle. */
+static void
+_cairosdl_binding_mark_premultiplied (
+    _cairosdl_binding_t *binding,
+    SDL_Rect const      *rect,
+    int                  premultiplied)
+{
+    size_t row_bytes = (binding->in_place->w + 7) / 8;
+    int x0, y0, x1, y1;
+    int x, y;
+
+    if (!_cairosdl_binding_clip_in_place (binding, rect, &x0, &y0, &x1, &y1))
+        return;
+
+    for (y = y0; y < y1; y++) {
+        unsigned char *row = binding->premultiplied + row_bytes*y;
+
+        /* The ragged ends a bit at a time, whole bytes in between. */
+        for (x = x0; x < x1 && (x & 7) != 0; x++) {
+            if (premultiplied)
+                row[x/8] |= 1 << (x & 7);
+            else
+                row[x/8] &= ~(1 << (x & 7));
+        }
+        if (x1 - x >= 8) {
+            memset (row + x/8, premultiplied ? 0xFF : 0, (x1 - x)/8);
+            x += (x1 - x) & ~7;
+        }
+        for (; x < x1; x++) {
+            if (premultiplied)
+                row[x/8] |= 1 << (x & 7);
+            else
+                row[x/8] &= ~(1 << (x & 7));
+        }
+    }
+}
+
+/* Premultiply, or unpremultiply, the pixels of a CAIROSDL_IN_PLACE
+ * surface in the rectangle that aren't that way already.  Converting
+ * a pixel twice would darken or lighten it, so the runs whose bits
+ * say they're done are skipped.  The bits are only read, so threads
+ * may convert rectangles that share them as long as they don't
+ * overlap; _cairosdl_binding_mark_premultiplied() updates them after. */
+static void
+_cairosdl_binding_convert_in_place (
+    _cairosdl_binding_t *binding,
+    SDL_Rect const      *rect,
+    int                  premultiply)
+{
+    SDL_Surface *sdl_surface = binding->in_place;
+    size_t row_bytes = (sdl_surface->w + 7) / 8;
+    unsigned char done = premultiply ? 0xFF : 0;
+    int x0, y0, x1, y1;
+    int x, y;
+
+    if (!_cairosdl_binding_clip_in_place (binding, rect, &x0, &y0, &x1, &y1))
+        return;
+    premultiply = premultiply != 0;
+
+    for (y = y0; y < y1; y++) {
+        unsigned char const *row = binding->premultiplied + row_bytes*y;
+        unsigned char *pixels =
+            (unsigned char *)sdl_surface->pixels + sdl_surface->pitch*y;
+
+        x = x0;
+        while (x < x1) {
+            int start;
+            if ((x & 7) == 0 && x + 8 <= x1 && row[x/8] == done) {
+                x += 8;
+                continue;
+            }
+            if (((row[x/8] >> (x & 7)) & 1) == premultiply) {
+                x++;
+                continue;
+            }
+            start = x;
+            while (x < x1) {
+                if ((x & 7) == 0 && x + 8 <= x1 && row[x/8] == (done ^ 0xFF))
+                    x += 8;
+                else if (((row[x/8] >> (x & 7)) & 1) != premultiply)
+                    x++;
+                else
+                    break;
+            }
+            if (premultiply) {
+                _cairosdl_blit_and_premultiply (
+                    pixels + 4*start, sdl_surface->pitch,
+                    pixels + 4*start, sdl_surface->pitch,
+                    x - start, 1);
+            }
+            else {
+                _cairosdl_blit_and_unpremultiply (
+                    pixels + 4*start, sdl_surface->pitch,
+                    pixels + 4*start, sdl_surface->pitch,
+                    x - start, 1);
+            }
+        }
+    }
+}
+
+/* Convert the rectangle of a CAIROSDL_IN_PLACE surface and note that
+ * it's done. */
+static void
+_cairosdl_binding_flip_in_place (
+    _cairosdl_binding_t *binding,
+    SDL_Rect const      *rect,
+    int                  premultiply)
+{
+    _cairosdl_binding_convert_in_place (binding, rect, premultiply);
+    _cairosdl_binding_mark_premultiplied (binding, rect, premultiply);
+}
+
+static void
+_cairosdl_binding_destroy (void *param)
+{
+    _cairosdl_binding_t *binding = (_cairosdl_binding_t *)param;
+
+    if (binding->async != NULL && binding->owns_async)
+        _cairosdl_async_destroy (binding->async);
+    free (binding->shadow);
+    if (binding->in_place != NULL) {
+        /* Don't leave the SDL_Surface darkened by pixels that were
+         * marked dirty and never flushed. */
+        SDL_Rect all;
+        all.x = all.y = 0;
+        all.w = binding->in_place->w;
+        all.h = binding->in_place->h;
+        _cairosdl_binding_convert_in_place (binding, &all, 0);
+        SDL_FreeSurface (binding->in_place);
+    }
+    free (binding->premultiplied);
+    free (binding);
+}
+
+/* Attach a binding to the surface if it hasn't got one yet. */
+static _cairosdl_binding_t *
+_cairosdl_surface_bind (cairo_surface_t *surface)
+{
+    _cairosdl_binding_t *binding = _cairosdl_surface_get_binding (surface);
+    if (binding != NULL)
+        return binding;
+
+    binding = (_cairosdl_binding_t *)malloc (sizeof (*binding));
+    if (binding == NULL)
+        return NULL;
+    binding->scale = 1.0;
+    binding->filter = CAIROSDL_SCALE_NEAREST;
+    binding->async = NULL;
+    binding->owns_async = 0;
+    binding->shadow = NULL;
+    binding->flags = 0;
+    binding->lock_time = 0.0;
+    binding->in_place = NULL;
+    binding->premultiplied = NULL;
+    if (cairo_surface_set_user_data (surface, CAIROSDL_BINDING_KEY,
+                                     binding, _cairosdl_binding_destroy)
+        != CAIRO_STATUS_SUCCESS)
+    {
+        free (binding);
+        return NULL;
+    }
+    return binding;
+}
+
+static int
+_cairosdl_binding_is_scaled (_cairosdl_binding_t const *binding)
+{
+    return binding != NULL && binding->scale < 1.0;
+}
+
+/* Finish any flush_async() of the surface or its partner before the
+ * SDL_Surface's pixels are touched again. */
+static void
+_cairosdl_surface_wait_async (cairo_surface_t *surface)
+{
+    _cairosdl_binding_t *binding = _cairosdl_surface_get_binding (surface);
+    if (binding != NULL && binding->async != NULL)
+        _cairosdl_async_wait (binding->async);
+}
+
+static int
+_cairosdl_binding_locks (_cairosdl_binding_t const *binding)
+{
+    return binding != NULL && (binding->flags & CAIROSDL_LOCK_ON_FLUSH);
+}
+
+/* A monotonic clock in seconds for timing how long surfaces are
+ * locked. */
+static double
+_cairosdl_now (void)
+{
+#if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0 && defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return SDL_GetTicks () / 1000.0;
+#endif
+}
+
+/* CAIROSDL_LOCK_ON_FLUSH surfaces lock their SDL_Surface only around
+ * touching its pixels.  Returns zero if the lock failed and the pixels
+ * mustn't be touched.  Other surfaces are assumed to be locked
+ * already.  Each successful lock must be paired with an unlock that
+ * is passed the start time stored. */
+static int
+_cairosdl_surface_lock (cairo_surface_t *surface, double *OUT_start)
+{
+    SDL_Surface *sdl_surface = cairosdl_surface_get_target (surface);
+
+    *OUT_start = 0.0;
+    if (sdl_surface == NULL ||
+        !_cairosdl_binding_locks (_cairosdl_surface_get_binding (surface)))
+        return 1;
+
+    if (SDL_LockSurface (sdl_surface) != 0)
+        return 0;
+    *OUT_start = _cairosdl_now ();
+    return 1;
+}
+
+static void
+_cairosdl_surface_unlock (cairo_surface_t *surface, double start)
+{
+    SDL_Surface *sdl_surface = cairosdl_surface_get_target (surface);
+    _cairosdl_binding_t *binding = _cairosdl_surface_get_binding (surface);
+
+    if (sdl_surface == NULL || !_cairosdl_binding_locks (binding))
+        return;
+
+    binding->lock_time += _cairosdl_now () - start;
+    SDL_UnlockSurface (sdl_surface);
+}
 
-    /* Cairo only supports a limited number of pixels formats.  Make
-     * sure the surface format is compatible. */
+/* Cairo only supports a limited number of pixels formats.  Returns
+ * zero if the SDL_Surface's format isn't compatible. */
+static int
+_cairosdl_format_for_sdl_surface (
+    SDL_Surface    *sdl_surface,
+    cairo_format_t *OUT_format)
+{
     if (sdl_surface->format->BytesPerPixel != 4 ||
         sdl_surface->format->BitsPerPixel != 32)
-        goto unsupported_format;
+        return 0;
 
     if (sdl_surface->format->Rmask != CAIROSDL_RMASK ||
         sdl_surface->format->Gmask != CAIROSDL_GMASK ||
         sdl_surface->format->Bmask != CAIROSDL_BMASK)
-        goto unsupported_format;
+        return 0;
 
     switch (sdl_surface->format->Amask) {
     case CAIROSDL_AMASK:
-        format = CAIRO_FORMAT_ARGB32;
-        break;
+        *OUT_format = CAIRO_FORMAT_ARGB32;
+        return 1;
     case 0:
-        format = CAIRO_FORMAT_RGB24;
-        break;
+        *OUT_format = CAIRO_FORMAT_RGB24;
+        return 1;
     default:
-        goto unsupported_format;
+        return 0;
+    }
+}
+
+/* Create a shadow image with its pixels owned by its binding. */
+static cairo_surface_t *
+_cairosdl_shadow_create (
+    cairo_format_t format,
+    int            width,
+    int            height)
+{
+    int stride = cairo_format_stride_for_width (format, width);
+    cairo_surface_t *target;
+    _cairosdl_binding_t *binding;
+    unsigned char *data;
+
+    if (stride <= 0 || height <= 0)
+        return cairo_image_surface_create (format, width, height);
+
+    data = (unsigned char *)calloc (height, stride);
+    if (data == NULL)
+        return cairo_image_surface_create (format, -1, -1);
+    target = cairo_image_surface_create_for_data (data, format,
+                                                  width, height, stride);
+    if (cairo_surface_status (target) != CAIRO_STATUS_SUCCESS) {
+        free (data);
+        return target;
     }
 
+    binding = _cairosdl_surface_bind (target);
+    if (binding == NULL) {
+        cairo_surface_destroy (target);
+        free (data);
+        return cairo_image_surface_create (format, -1, -1);
+    }
+    binding->shadow = data;
+    return target;
+}
+
+cairo_surface_t *
+cairosdl_surface_create (
+    SDL_Surface *sdl_surface)
+{
+    cairo_surface_t *target;
+    cairo_format_t format;
+    int is_dirty;
+
+    if (!_cairosdl_format_for_sdl_surface (sdl_surface, &format))
+        goto unsupported_format;
+
     /* Make the target point to either the SDL_Surface's data itself
      * or a shadow image surface if we need to unpremultiply pixels. */
     if (format == CAIRO_FORMAT_RGB24) {
@@ -119,9 +496,9 @@ cairosdl_surface_create (
     }
     else {
         /* Need a shadow image surface. */
-        target = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                             sdl_surface->w,
-                                             sdl_surface->h);
+        target = _cairosdl_shadow_create (CAIRO_FORMAT_ARGB32,
+                                          sdl_surface->w,
+                                          sdl_surface->h);
         is_dirty = 1;
     }
 
@@ -145,6 +522,162 @@ cairosdl_surface_create (
         (cairo_format_t)-1, 0, 0);
 }
 
+cairo_surface_t *
+cairosdl_surface_create_scaled (
+    SDL_Surface            *sdl_surface,
+    double                  scale,
+    cairosdl_scale_filter_t filter)
+{
+    cairo_surface_t *target;
+    _cairosdl_binding_t *binding;
+    cairo_format_t format;
+    int width, height;
+
+    if (!(scale > 0.0))
+        return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, -1, -1);
+    if (scale >= 1.0)
+        return cairosdl_surface_create (sdl_surface);
+
+    if (!_cairosdl_format_for_sdl_surface (sdl_surface, &format))
+        return cairo_image_surface_create ((cairo_format_t)-1, 0, 0);
+
+    /* Always a shadow image, even for Amask=0 surfaces. */
+    width = (int)ceil (sdl_surface->w * scale);
+    height = (int)ceil (sdl_surface->h * scale);
+    target = _cairosdl_shadow_create (format,
+                                      width > 0 ? width : 1,
+                                      height > 0 ? height : 1);
+    if (cairo_surface_status (target) != CAIRO_STATUS_SUCCESS)
+        return target;
+
+    binding = _cairosdl_surface_bind (target);
+    if (binding == NULL) {
+        cairo_surface_destroy (target);
+        return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, -1, -1);
+    }
+    binding->scale = scale;
+    binding->filter = filter;
+    cairo_surface_set_device_scale (target, scale, scale);
+
+    sdl_surface->refcount++;
+    cairo_surface_set_user_data (target,
+                                 CAIROSDL_TARGET_KEY,
+                                 sdl_surface,
+                                 sdl_surface_destroy_func);
+
+    cairosdl_surface_mark_dirty (target);
+    return target;
+}
+
+/* CAIROSDL_IN_PLACE surfaces are an ARGB32 image over the
+ * SDL_Surface's own pixels, so the shadow buffer and the SDL buffer
+ * are one and the same and flushing and marking dirty convert it in
+ * place. */
+static cairo_surface_t *
+_cairosdl_surface_create_in_place (
+    SDL_Surface *sdl_surface,
+    unsigned     flags)
+{
+    cairo_surface_t *target;
+    _cairosdl_binding_t *binding;
+    cairo_format_t format;
+
+    /* The pixels are needed all the time, so no locking on flush. */
+    if ((flags & CAIROSDL_LOCK_ON_FLUSH) ||
+        !_cairosdl_format_for_sdl_surface (sdl_surface, &format))
+        return cairo_image_surface_create ((cairo_format_t)-1, 0, 0);
+
+    if (format == CAIRO_FORMAT_RGB24)
+        return cairosdl_surface_create (sdl_surface);
+
+    target = cairo_image_surface_create_for_data (
+        (unsigned char *)sdl_surface->pixels, CAIRO_FORMAT_ARGB32,
+        sdl_surface->w, sdl_surface->h, sdl_surface->pitch);
+    if (cairo_surface_status (target) != CAIRO_STATUS_SUCCESS)
+        return target;
+
+    binding = _cairosdl_surface_bind (target);
+    if (binding == NULL) {
+        cairo_surface_destroy (target);
+        return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, -1, -1);
+    }
+    binding->flags = flags;
+    binding->premultiplied = (unsigned char *)
+        calloc (sdl_surface->h, (sdl_surface->w + 7) / 8);
+    if (binding->premultiplied == NULL) {
+        cairo_surface_destroy (target);
+        return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, -1, -1);
+    }
+    binding->in_place = sdl_surface;
+    sdl_surface->refcount++;
+
+    sdl_surface->refcount++;
+    cairo_surface_set_user_data (target,
+                                 CAIROSDL_TARGET_KEY,
+                                 sdl_surface,
+                                 sdl_surface_destroy_func);
+
+    cairosdl_surface_mark_dirty (target);
+    return target;
+}
+
+cairo_surface_t *
+cairosdl_surface_create_with_flags (
+    SDL_Surface *sdl_surface,
+    unsigned     flags)
+{
+    cairo_surface_t *target;
+    _cairosdl_binding_t *binding;
+    cairo_format_t format;
+
+    if (flags & CAIROSDL_IN_PLACE)
+        return _cairosdl_surface_create_in_place (sdl_surface, flags);
+    if (!(flags & CAIROSDL_LOCK_ON_FLUSH))
+        return cairosdl_surface_create (sdl_surface);
+
+    if (!_cairosdl_format_for_sdl_surface (sdl_surface, &format))
+        return cairo_image_surface_create ((cairo_format_t)-1, 0, 0);
+
+    /* Always a shadow image, even for Amask=0 surfaces, so that the
+     * SDL_Surface's pixels are only needed while flushing and marking
+     * dirty. */
+    target = _cairosdl_shadow_create (format,
+                                      sdl_surface->w,
+                                      sdl_surface->h);
+    if (cairo_surface_status (target) != CAIRO_STATUS_SUCCESS)
+        return target;
+
+    binding = _cairosdl_surface_bind (target);
+    if (binding == NULL) {
+        cairo_surface_destroy (target);
+        return cairo_image_surface_create (CAIRO_FORMAT_ARGB32, -1, -1);
+    }
+    binding->flags = flags;
+
+    sdl_surface->refcount++;
+    cairo_surface_set_user_data (target,
+                                 CAIROSDL_TARGET_KEY,
+                                 sdl_surface,
+                                 sdl_surface_destroy_func);
+
+    cairosdl_surface_mark_dirty (target);
+    return target;
+}
+
+double
+cairosdl_surface_get_lock_time (cairo_surface_t *surface)
+{
+    _cairosdl_binding_t *binding = _cairosdl_surface_get_binding (surface);
+    return _cairosdl_binding_locks (binding) ? binding->lock_time : 0.0;
+}
+
+double
+cairosdl_surface_get_scale (cairo_surface_t *surface)
+{
+    _cairosdl_binding_t *binding = _cairosdl_surface_get_binding (surface);
+    return binding ? binding->scale : 1.0;
+}
+
 SDL_Surface *
 cairosdl_surface_get_target (
     cairo_surface_t *surface)
@@ -189,8 +722,11 @@ _cairosdl_surface_obtain_shadow_buffer(
     if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE)
         return CAIRO_STATUS_SURFACE_TYPE_MISMATCH;
 
+    /* Amask=0 surfaces only have a shadow with CAIROSDL_LOCK_ON_FLUSH. */
     format = cairo_image_surface_get_format (surface);
-    if (format != CAIRO_FORMAT_ARGB32)
+    if (format != CAIRO_FORMAT_ARGB32 &&
+        !(format == CAIRO_FORMAT_RGB24 &&
+          _cairosdl_binding_locks (_cairosdl_surface_get_binding (surface))))
         return CAIRO_STATUS_INVALID_FORMAT;
 
     if (OUT_buffer != NULL)
@@ -204,8 +740,31 @@ _cairosdl_surface_obtain_shadow_buffer(
     return CAIRO_STATUS_SUCCESS;
 }
 
-void
-cairosdl_surface_flush_rects (
+/* Copy rows of pixels as they are, for the RGB24 shadows of
+ * CAIROSDL_LOCK_ON_FLUSH surfaces. */
+static void
+_cairosdl_blit (
+    void       *target_buffer,
+    size_t      target_stride,
+    void const *source_buffer,
+    size_t      source_stride,
+    int         width,
+    int         height)
+{
+    unsigned char *target_bytes = (unsigned char *)target_buffer;
+    unsigned char const *source_bytes = (unsigned char const *)source_buffer;
+
+    while (height-- > 0) {
+        memcpy (target_bytes, source_bytes, 4*width);
+        target_bytes += target_stride;
+        source_bytes += source_stride;
+    }
+}
+
+/* Flush without flushing cairo first, so that it's safe to call
+ * from worker threads. */
+static void
+_cairosdl_surface_flush_rects_now (
     cairo_surface_t *surface,
     int              num_rects,
     SDL_Rect const  *rects)
@@ -221,12 +780,15 @@ cairosdl_surface_flush_rects (
     size_t target_height;
 
     int width, height;
+    int is_opaque;
     cairo_status_t status;
+    _cairosdl_binding_t *binding;
 
-    if (num_rects <= 0)
+    binding = _cairosdl_surface_get_binding (surface);
+    if (_cairosdl_binding_is_scaled (binding)) {
+        _cairosdl_flush_scaled_rects (surface, binding, num_rects, rects);
         return;
-
-    cairo_surface_flush (surface);
+    }
 
     status = _cairosdl_surface_obtain_SDL_buffer (surface,
                                                   &target_bytes,
@@ -247,6 +809,7 @@ cairosdl_surface_flush_rects (
     width = source_width < target_width ? source_width : target_width;
     height = source_height < target_height ? source_height : target_height;
     assert(width >= 0 && height >= 0);
+    is_opaque = cairo_image_surface_get_format (surface) == CAIRO_FORMAT_RGB24;
 
     while (num_rects-- > 0) {
         Sint32 x = rects->x;
@@ -257,18 +820,55 @@ cairosdl_surface_flush_rects (
 
         if (x <= 0) { w += x; x = 0; }
         if (y <= 0) { h += y; y = 0; }
+        if (x >= width || y >= height) continue;
         if (x + w >= width) w = width - x;
         if (y + h >= height) h = height - y;
+        if (w <= 0 || h <= 0) continue;
 
-        _cairosdl_blit_and_unpremultiply (
-            target_bytes + target_stride*y + x, target_stride,
-            source_bytes + source_stride*y + x, source_stride,
-            w, h);
+        if (binding != NULL && binding->in_place != NULL) {
+            SDL_Rect rect;
+            rect.x = x;
+            rect.y = y;
+            rect.w = w;
+            rect.h = h;
+            _cairosdl_binding_flip_in_place (binding, &rect, 0);
+        }
+        else if (is_opaque) {
+            _cairosdl_blit (
+                target_bytes + target_stride*y + 4*x, target_stride,
+                source_bytes + source_stride*y + 4*x, source_stride,
+                w, h);
+        }
+        else {
+            _cairosdl_blit_and_unpremultiply (
+                target_bytes + target_stride*y + 4*x, target_stride,
+                source_bytes + source_stride*y + 4*x, source_stride,
+                w, h);
+        }
     }
 }
 
 void
-cairosdl_surface_mark_dirty_rects (
+cairosdl_surface_flush_rects (
+    cairo_surface_t *surface,
+    int              num_rects,
+    SDL_Rect const  *rects)
+{
+    double lock_start;
+
+    if (num_rects <= 0)
+        return;
+
+    _cairosdl_surface_wait_async (surface);
+    cairo_surface_flush (surface);
+    if (_cairosdl_surface_lock (surface, &lock_start)) {
+        _cairosdl_surface_flush_rects_now (surface, num_rects, rects);
+        _cairosdl_surface_unlock (surface, lock_start);
+    }
+}
+
+static void
+_cairosdl_surface_mark_dirty_rects_now (
     cairo_surface_t *surface,
     int              num_rects,
     SDL_Rect const  *rects)
@@ -284,11 +884,16 @@ cairosdl_surface_mark_dirty_rects (
     size_t target_height = 32767;
 
     int width, height;
+    int is_opaque;
     cairo_status_t status;
     int have_buffers = 1;
+    _cairosdl_binding_t *binding;
 
-    if (num_rects <= 0)
+    binding = _cairosdl_surface_get_binding (surface);
+    if (_cairosdl_binding_is_scaled (binding)) {
+        _cairosdl_mark_dirty_scaled_rects (surface, binding, num_rects, rects);
         return;
+    }
 
     status = _cairosdl_surface_obtain_SDL_buffer (surface,
                                                   &source_bytes,
@@ -309,6 +914,8 @@ cairosdl_surface_mark_dirty_rects (
     width = source_width < target_width ? source_width : target_width;
     height = source_height < target_height ? source_height : target_height;
     assert(width >= 0 && height >= 0);
+    is_opaque = have_buffers &&
+        cairo_image_surface_get_format (surface) == CAIRO_FORMAT_RGB24;
 
     while (num_rects-- > 0) {
         Sint32 x = rects->x;
@@ -324,10 +931,24 @@ cairosdl_surface_mark_dirty_rects (
         if (y + h >= height) h = height - y;
         if (w <= 0 || h <= 0) continue;
 
-        if (have_buffers) {
+        if (have_buffers && binding != NULL && binding->in_place != NULL) {
+            SDL_Rect rect;
+            rect.x = x;
+            rect.y = y;
+            rect.w = w;
+            rect.h = h;
+            _cairosdl_binding_flip_in_place (binding, &rect, 1);
+        }
+        else if (is_opaque) {
+            _cairosdl_blit (
+                target_bytes + target_stride*y + 4*x, target_stride,
+                source_bytes + source_stride*y + 4*x, source_stride,
+                w, h);
+        }
+        else if (have_buffers) {
             _cairosdl_blit_and_premultiply (
-                target_bytes + target_stride*y + x, target_stride,
-                source_bytes + source_stride*y + x, source_stride,
+                target_bytes + target_stride*y + 4*x, target_stride,
+                source_bytes + source_stride*y + 4*x, source_stride,
                 w, h);
         }
 
@@ -335,6 +956,24 @@ cairosdl_surface_mark_dirty_rects (
     }
 }
 
+void
+cairosdl_surface_mark_dirty_rects (
+    cairo_surface_t *surface,
+    int              num_rects,
+    SDL_Rect const  *rects)
+{
+    double lock_start;
+
+    if (num_rects <= 0)
+        return;
+
+    _cairosdl_surface_wait_async (surface);
+    if (_cairosdl_surface_lock (surface, &lock_start)) {
+        _cairosdl_surface_mark_dirty_rects_now (surface, num_rects, rects);
+        _cairosdl_surface_unlock (surface, lock_start);
+    }
+}
+
 static SDL_Rect
 make_rect(int x, int y, int w, int h)
 {
@@ -418,23 +1057,854 @@ cairosdl_destroy (cairo_t *cr)
     cairo_destroy (cr);
 }
 
-/* unpremultiply-lutb.c
- *
- * A pixel premultiplier and an unpremultiplier using reciprocal
- * multiplication.  It specialises constant runs and solid runs of
- * pixels with low overhead loops and uses only a 1KB table of
- * reciprocals.
- *
- * The unpremultiplier was snarfed from
- * http://cgit.freedesktop.org/~joonas/unpremultiply
- *
- * See there for other faster or nonportable variations on
- * unpremultiply.  This one is a good all rounder that doesn't take
- * that much data space. */
+/*
+ * Worker threads
+ */
 
-/* Pixel format config for a 32 bit pixel with 8 bit components.  Only
- * the location of alpha matters.  Cairo uses ASHIFT 24. */
-#define ASHIFT CAIROSDL_ASHIFT
+/* A job set is an array of num_jobs jobs of job_size bytes each, all
+ * run by the same function.  Job sets are queued to the worker threads
+ * in FIFO order and whoever submits a set also helps run it while
+ * waiting for it. */
+typedef void (*_cairosdl_job_func_t) (void *job);
+
+typedef struct _cairosdl_job_set {
+    _cairosdl_job_func_t func;
+    char *jobs;
+    size_t job_size;
+    int num_jobs;
+    int next_job;               /* next job to hand out */
+    int num_done;
+    struct _cairosdl_job_set *next;
+} _cairosdl_job_set_t;
+
+static struct {
+    SDL_mutex *mutex;
+    SDL_cond *work_cond;        /* signalled when jobs are queued */
+    SDL_cond *done_cond;        /* signalled when a job set finishes */
+    SDL_Thread **threads;
+    int num_threads;            /* worker threads running */
+    int wanted_num_threads;     /* 0 for the number of CPUs */
+    int quit;
+    _cairosdl_job_set_t *head, *tail;
+} _cairosdl_pool;
+
+static int
+_cairosdl_num_cpus (void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf (_SC_NPROCESSORS_ONLN);
+    if (n > 0)
+        return n < 64 ? (int)n : 64;
+#endif
+    return 1;
+}
+
+/* Take the next job from the queue or return NULL if there is none.
+ * Called with the pool mutex held. */
+static void *
+_cairosdl_pool_take_job (
+    _cairosdl_job_set_t  *only_set,
+    _cairosdl_job_set_t **OUT_set)
+{
+    _cairosdl_job_set_t *set = only_set ? only_set : _cairosdl_pool.head;
+    while (set && set->next_job == set->num_jobs)
+        set = only_set ? NULL : set->next;
+    if (set == NULL)
+        return NULL;
+    *OUT_set = set;
+    return set->jobs + set->job_size * set->next_job++;
+}
+
+/* Mark a job of the set done.  Called with the pool mutex held. */
+static void
+_cairosdl_pool_finish_job (_cairosdl_job_set_t *set)
+{
+    if (++set->num_done < set->num_jobs)
+        return;
+
+    /* Unlink the finished set. */
+    if (_cairosdl_pool.head == set) {
+        _cairosdl_pool.head = set->next;
+    }
+    else {
+        _cairosdl_job_set_t *p = _cairosdl_pool.head;
+        while (p->next != set)
+            p = p->next;
+        p->next = set->next;
+        if (_cairosdl_pool.tail == set)
+            _cairosdl_pool.tail = p;
+    }
+    if (_cairosdl_pool.head == NULL)
+        _cairosdl_pool.tail = NULL;
+    SDL_CondBroadcast (_cairosdl_pool.done_cond);
+}
+
+static int
+_cairosdl_pool_worker (void *param)
+{
+    (void)param;
+    SDL_LockMutex (_cairosdl_pool.mutex);
+    while (!_cairosdl_pool.quit) {
+        _cairosdl_job_set_t *set;
+        void *job = _cairosdl_pool_take_job (NULL, &set);
+        if (job == NULL) {
+            SDL_CondWait (_cairosdl_pool.work_cond, _cairosdl_pool.mutex);
+            continue;
+        }
+        SDL_UnlockMutex (_cairosdl_pool.mutex);
+        set->func (job);
+        SDL_LockMutex (_cairosdl_pool.mutex);
+        _cairosdl_pool_finish_job (set);
+    }
+    SDL_UnlockMutex (_cairosdl_pool.mutex);
+    return 0;
+}
+
+static void
+_cairosdl_pool_stop (void)
+{
+    int i;
+    if (_cairosdl_pool.num_threads == 0)
+        return;
+
+    SDL_LockMutex (_cairosdl_pool.mutex);
+    _cairosdl_pool.quit = 1;
+    SDL_CondBroadcast (_cairosdl_pool.work_cond);
+    SDL_UnlockMutex (_cairosdl_pool.mutex);
+
+    for (i = 0; i < _cairosdl_pool.num_threads; i++)
+        SDL_WaitThread (_cairosdl_pool.threads[i], NULL);
+    free (_cairosdl_pool.threads);
+    _cairosdl_pool.threads = NULL;
+    _cairosdl_pool.num_threads = 0;
+    _cairosdl_pool.quit = 0;
+}
+
+/* Start the worker threads if they aren't running yet.  Returns the
+ * total number of threads available for jobs, counting the caller. */
+static int
+_cairosdl_pool_start (void)
+{
+    int n;
+
+    if (_cairosdl_pool.mutex == NULL) {
+        _cairosdl_pool.mutex = SDL_CreateMutex ();
+        _cairosdl_pool.work_cond = SDL_CreateCond ();
+        _cairosdl_pool.done_cond = SDL_CreateCond ();
+        if (!_cairosdl_pool.mutex ||
+            !_cairosdl_pool.work_cond ||
+            !_cairosdl_pool.done_cond)
+            return 1;
+    }
+    if (_cairosdl_pool.threads != NULL)
+        return _cairosdl_pool.num_threads + 1;
+
+    n = _cairosdl_pool.wanted_num_threads;
+    if (n <= 0)
+        n = _cairosdl_num_cpus ();
+    n--;                        /* the caller works too */
+
+    if (n > 0) {
+        _cairosdl_pool.threads =
+            (SDL_Thread **)calloc (n, sizeof (SDL_Thread *));
+        if (_cairosdl_pool.threads == NULL)
+            return 1;
+        while (_cairosdl_pool.num_threads < n) {
+            SDL_Thread *thread =
+                SDL_CreateThread (_cairosdl_pool_worker, NULL);
+            if (thread == NULL)
+                break;
+            _cairosdl_pool.threads[_cairosdl_pool.num_threads++] = thread;
+        }
+    }
+    return _cairosdl_pool.num_threads + 1;
+}
+
+static void
+_cairosdl_pool_submit (_cairosdl_job_set_t *set)
+{
+    set->next_job = 0;
+    set->num_done = 0;
+    set->next = NULL;
+    if (set->num_jobs <= 0)
+        return;
+
+    SDL_LockMutex (_cairosdl_pool.mutex);
+    if (_cairosdl_pool.tail)
+        _cairosdl_pool.tail->next = set;
+    else
+        _cairosdl_pool.head = set;
+    _cairosdl_pool.tail = set;
+    SDL_CondBroadcast (_cairosdl_pool.work_cond);
+    SDL_UnlockMutex (_cairosdl_pool.mutex);
+}
+
+/* Help run the jobs of a submitted set and wait until all are done. */
+static void
+_cairosdl_pool_wait (_cairosdl_job_set_t *set)
+{
+    if (set->num_jobs <= 0)
+        return;
+
+    SDL_LockMutex (_cairosdl_pool.mutex);
+    for (;;) {
+        _cairosdl_job_set_t *taken;
+        void *job = _cairosdl_pool_take_job (set, &taken);
+        if (job == NULL)
+            break;
+        SDL_UnlockMutex (_cairosdl_pool.mutex);
+        set->func (job);
+        SDL_LockMutex (_cairosdl_pool.mutex);
+        _cairosdl_pool_finish_job (set);
+    }
+    while (set->num_done < set->num_jobs)
+        SDL_CondWait (_cairosdl_pool.done_cond, _cairosdl_pool.mutex);
+    SDL_UnlockMutex (_cairosdl_pool.mutex);
+}
+
+/* Run all the jobs and return when they're done.  Without worker
+ * threads the jobs are simply run in order by the caller. */
+static void
+_cairosdl_pool_run (
+    _cairosdl_job_func_t func,
+    void                *jobs,
+    size_t               job_size,
+    int                  num_jobs)
+{
+    _cairosdl_job_set_t set;
+    int i;
+
+    if (num_jobs > 1 && _cairosdl_pool_start () > 1) {
+        set.func = func;
+        set.jobs = (char *)jobs;
+        set.job_size = job_size;
+        set.num_jobs = num_jobs;
+        _cairosdl_pool_submit (&set);
+        _cairosdl_pool_wait (&set);
+        return;
+    }
+
+    for (i = 0; i < num_jobs; i++)
+        func ((char *)jobs + i*job_size);
+}
+
+void
+cairosdl_set_num_threads (int num_threads)
+{
+    if (num_threads == _cairosdl_pool.wanted_num_threads)
+        return;
+    _cairosdl_pool_stop ();
+    _cairosdl_pool.wanted_num_threads = num_threads;
+}
+
+int
+cairosdl_get_num_threads (void)
+{
+    return _cairosdl_pool.wanted_num_threads > 0
+        ? _cairosdl_pool.wanted_num_threads
+        : _cairosdl_num_cpus ();
+}
+
+/*
+ * Tiled drawing
+ */
+
+typedef struct {
+    /* The tile's rectangle in the surface. */
+    int x, y, width, height;
+
+    /* Shared by all tiles. */
+    cairo_surface_t *surface;
+    double x_scale, y_scale;    /* the surface's device scale */
+    cairosdl_draw_func_t draw;
+    void *closure;
+    unsigned char *sdl_bytes;   /* NULL if there's nothing to flush */
+    size_t sdl_stride;
+    _cairosdl_binding_t *in_place;  /* if CAIROSDL_IN_PLACE */
+
+    cairo_status_t status;
+} _cairosdl_tile_job_t;
+
+static void
+_cairosdl_draw_tile (void *param)
+{
+    _cairosdl_tile_job_t *tile = (_cairosdl_tile_job_t *)param;
+    cairo_surface_t *surface = tile->surface;
+    unsigned char *bytes = cairo_image_surface_get_data (surface);
+    size_t stride = cairo_image_surface_get_stride (surface);
+    cairo_surface_t *view;
+    cairo_t *cr;
+
+    /* An image surface of its own over the tile's pixels, so the
+     * threads don't share any cairo objects but the caller's. */
+    view = cairo_image_surface_create_for_data (
+        bytes + stride*tile->y + 4*tile->x,
+        cairo_image_surface_get_format (surface),
+        tile->width, tile->height, stride);
+    cairo_surface_set_device_offset (view, -tile->x, -tile->y);
+    cairo_surface_set_device_scale (view, tile->x_scale, tile->y_scale);
+
+    cr = cairo_create (view);
+    tile->draw (cr, tile->closure);
+    tile->status = cairo_status (cr);
+    cairo_destroy (cr);
+
+    cairo_surface_finish (view);
+    cairo_surface_destroy (view);
+
+    if (tile->sdl_bytes != NULL && tile->in_place != NULL) {
+        SDL_Rect rect;
+        rect.x = tile->x;
+        rect.y = tile->y;
+        rect.w = tile->width;
+        rect.h = tile->height;
+        _cairosdl_binding_convert_in_place (tile->in_place, &rect, 0);
+    }
+    else if (tile->sdl_bytes != NULL) {
+        _cairosdl_blit_and_unpremultiply (
+            tile->sdl_bytes + tile->sdl_stride*tile->y + 4*tile->x,
+            tile->sdl_stride,
+            bytes + stride*tile->y + 4*tile->x,
+            stride,
+            tile->width, tile->height);
+    }
+}
+
+cairo_status_t
+cairosdl_surface_draw_tiled (
+    cairo_surface_t     *surface,
+    int                  tile_width,
+    int                  tile_height,
+    cairosdl_draw_func_t draw,
+    void                *closure)
+{
+    _cairosdl_tile_job_t *tiles;
+    unsigned char *sdl_bytes = NULL;
+    size_t sdl_stride = 0;
+    size_t sdl_width, sdl_height;
+    double x_scale, y_scale;
+    cairo_status_t status;
+    _cairosdl_binding_t *binding;
+    int width, height;
+    int num_tiles, x, y, i;
+
+    status = cairo_surface_status (surface);
+    if (status != CAIRO_STATUS_SUCCESS)
+        return status;
+    if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE)
+        return CAIRO_STATUS_SURFACE_TYPE_MISMATCH;
+    if (tile_width <= 0 || tile_height <= 0)
+        return CAIRO_STATUS_INVALID_SIZE;
+
+    width = cairo_image_surface_get_width (surface);
+    height = cairo_image_surface_get_height (surface);
+    if (width <= 0 || height <= 0)
+        return CAIRO_STATUS_SUCCESS;
+
+    /* Bound per-pixel alpha surfaces have their tiles flushed by the
+     * thread that drew them.  Scaled surfaces are flushed at the end
+     * since filtering reads across tile edges, and so are
+     * CAIROSDL_LOCK_ON_FLUSH surfaces so that they're locked once. */
+    _cairosdl_surface_wait_async (surface);
+
+    binding = _cairosdl_surface_get_binding (surface);
+    cairo_surface_get_device_scale (surface, &x_scale, &y_scale);
+    if (!_cairosdl_binding_is_scaled (binding) &&
+        !_cairosdl_binding_locks (binding) &&
+        _cairosdl_surface_obtain_shadow_buffer (surface, NULL, NULL,
+                                                NULL, NULL)
+        == CAIRO_STATUS_SUCCESS &&
+        _cairosdl_surface_obtain_SDL_buffer (surface, &sdl_bytes,
+                                             &sdl_stride,
+                                             &sdl_width, &sdl_height)
+        == CAIRO_STATUS_SUCCESS)
+    {
+        if ((size_t)width > sdl_width) width = sdl_width;
+        if ((size_t)height > sdl_height) height = sdl_height;
+    }
+
+    num_tiles = ((width + tile_width - 1) / tile_width) *
+        ((height + tile_height - 1) / tile_height);
+    tiles = (_cairosdl_tile_job_t *)malloc (num_tiles * sizeof (*tiles));
+    if (tiles == NULL)
+        return CAIRO_STATUS_NO_MEMORY;
+
+    i = 0;
+    for (y = 0; y < height; y += tile_height) {
+        for (x = 0; x < width; x += tile_width) {
+            _cairosdl_tile_job_t *tile = tiles + i++;
+            tile->x = x;
+            tile->y = y;
+            tile->width = x + tile_width < width ? tile_width : width - x;
+            tile->height = y + tile_height < height ? tile_height : height - y;
+            tile->surface = surface;
+            tile->x_scale = x_scale;
+            tile->y_scale = y_scale;
+            tile->draw = draw;
+            tile->closure = closure;
+            tile->sdl_bytes = sdl_bytes;
+            tile->sdl_stride = sdl_stride;
+            tile->in_place = binding != NULL && binding->in_place != NULL
+                ? binding : NULL;
+            tile->status = CAIRO_STATUS_SUCCESS;
+        }
+    }
+
+    cairo_surface_flush (surface);
+    _cairosdl_pool_run (_cairosdl_draw_tile, tiles, sizeof (*tiles), num_tiles);
+    cairo_surface_mark_dirty (surface);
+    if (sdl_bytes != NULL && binding != NULL && binding->in_place != NULL) {
+        /* The tiles only read the bits, as neighbours may share them. */
+        SDL_Rect all;
+        all.x = all.y = 0;
+        all.w = width;
+        all.h = height;
+        _cairosdl_binding_mark_premultiplied (binding, &all, 0);
+    }
+    if (_cairosdl_binding_is_scaled (binding) ||
+        _cairosdl_binding_locks (binding))
+        cairosdl_surface_flush (surface);
+
+    for (i = 0; i < num_tiles && status == CAIRO_STATUS_SUCCESS; i++)
+        status = tiles[i].status;
+
+    free (tiles);
+    return status;
+}
+
+/*
+ * Asynchronous flushing
+ */
+
+typedef struct {
+    cairo_surface_t *surface;
+    SDL_Rect rect;
+} _cairosdl_flush_job_t;
+
+#define CAIROSDL_MAX_FLUSH_JOBS 16
+
+struct _cairosdl_async {
+    cairo_surface_t *surfaces[2];   /* the caller's and its partner */
+    cairo_surface_t *flushing;      /* one of them while pending */
+    SDL_Surface *sdl_surface;       /* referenced while pending */
+    int pending;
+    double lock_start;              /* of a CAIROSDL_LOCK_ON_FLUSH flush */
+    _cairosdl_job_set_t set;
+    _cairosdl_flush_job_t jobs[CAIROSDL_MAX_FLUSH_JOBS];
+};
+
+static void
+_cairosdl_flush_job (void *param)
+{
+    _cairosdl_flush_job_t *job = (_cairosdl_flush_job_t *)param;
+    _cairosdl_surface_flush_rects_now (job->surface, 1, &job->rect);
+}
+
+/* The async doesn't reference the surface it's flushing, which may
+ * be the first surface that owns it.  Destroying that surface waits
+ * here from its binding, after cairo has finished the surface but
+ * before its shadow pixels and the SDL_Surface are let go. */
+static void
+_cairosdl_async_wait (_cairosdl_async_t *async)
+{
+    if (async->flushing == NULL)
+        return;
+    if (async->pending)
+        _cairosdl_pool_wait (&async->set);
+    async->pending = 0;
+    _cairosdl_surface_unlock (async->flushing, async->lock_start);
+    async->flushing = NULL;
+    SDL_FreeSurface (async->sdl_surface);
+    async->sdl_surface = NULL;
+}
+
+static void
+_cairosdl_async_destroy (_cairosdl_async_t *async)
+{
+    _cairosdl_async_wait (async);
+    if (async->surfaces[1] != NULL) {
+        /* The partner outlives us if the caller referenced it. */
+        _cairosdl_binding_t *partner_binding =
+            _cairosdl_surface_get_binding (async->surfaces[1]);
+        if (partner_binding != NULL)
+            partner_binding->async = NULL;
+        cairo_surface_destroy (async->surfaces[1]);
+    }
+    free (async);
+}
+
+/* Set up the surface for asynchronous flushing by making it a partner
+ * to draw into meanwhile.  Returns NULL if that's not possible. */
+static _cairosdl_async_t *
+_cairosdl_surface_get_async (cairo_surface_t *surface)
+{
+    _cairosdl_binding_t *binding = _cairosdl_surface_bind (surface);
+    _cairosdl_binding_t *partner_binding;
+    SDL_Surface *sdl_surface = cairosdl_surface_get_target (surface);
+    cairo_surface_t *partner;
+    _cairosdl_async_t *async;
+
+    if (binding == NULL)
+        return NULL;
+    if (binding->async != NULL)
+        return binding->async;
+
+    async = (_cairosdl_async_t *)calloc (1, sizeof (*async));
+    if (async == NULL)
+        return NULL;
+
+    if (_cairosdl_binding_is_scaled (binding))
+        partner = cairosdl_surface_create_scaled (sdl_surface,
+                                                  binding->scale,
+                                                  binding->filter);
+    else
+        partner = cairosdl_surface_create_with_flags (sdl_surface,
+                                                      binding->flags);
+
+    partner_binding = _cairosdl_surface_bind (partner);
+    if (cairo_surface_status (partner) != CAIRO_STATUS_SUCCESS ||
+        partner_binding == NULL)
+    {
+        cairo_surface_destroy (partner);
+        free (async);
+        return NULL;
+    }
+
+    async->surfaces[0] = surface;
+    async->surfaces[1] = partner;
+    binding->async = async;
+    binding->owns_async = 1;
+    partner_binding->async = async;
+    partner_binding->owns_async = 0;
+    return async;
+}
+
+cairo_surface_t *
+cairosdl_surface_flush_async (cairo_surface_t *surface)
+{
+    SDL_Surface *sdl_surface = cairosdl_surface_get_target (surface);
+    _cairosdl_binding_t *binding;
+    _cairosdl_async_t *async;
+    int num_jobs, i;
+
+    if (sdl_surface == NULL ||
+        cairo_surface_status (surface) != CAIRO_STATUS_SUCCESS)
+        return surface;
+
+    /* Amask=0 surfaces drawn into directly have nothing to flush. */
+    binding = _cairosdl_surface_get_binding (surface);
+    if (binding != NULL && (binding->flags & CAIROSDL_IN_PLACE)) {
+        /* Nothing else to draw into meanwhile. */
+        cairosdl_surface_flush (surface);
+        return surface;
+    }
+    if (!_cairosdl_binding_is_scaled (binding) &&
+        _cairosdl_surface_obtain_shadow_buffer (surface, NULL, NULL,
+                                                NULL, NULL)
+        != CAIRO_STATUS_SUCCESS)
+        return surface;
+
+    _cairosdl_surface_wait_async (surface);
+    async = _cairosdl_surface_get_async (surface);
+    if (async == NULL) {
+        cairosdl_surface_flush (surface);
+        return surface;
+    }
+
+    cairo_surface_flush (surface);
+    if (!_cairosdl_surface_lock (surface, &async->lock_start))
+        return surface;
+
+    /* Bands of rows for however many threads there are to help. */
+    num_jobs = _cairosdl_pool_start () - 1;
+    if (num_jobs > CAIROSDL_MAX_FLUSH_JOBS)
+        num_jobs = CAIROSDL_MAX_FLUSH_JOBS;
+    if (num_jobs > sdl_surface->h)
+        num_jobs = sdl_surface->h;
+
+    if (num_jobs <= 0) {
+        SDL_Rect rect;
+        rect.x = rect.y = 0;
+        rect.w = sdl_surface->w;
+        rect.h = sdl_surface->h;
+        _cairosdl_surface_flush_rects_now (surface, 1, &rect);
+        _cairosdl_surface_unlock (surface, async->lock_start);
+    }
+    else {
+        for (i = 0; i < num_jobs; i++) {
+            _cairosdl_flush_job_t *job = async->jobs + i;
+            int y0 = sdl_surface->h * i / num_jobs;
+            int y1 = sdl_surface->h * (i + 1) / num_jobs;
+            job->surface = surface;
+            job->rect.x = 0;
+            job->rect.y = y0;
+            job->rect.w = sdl_surface->w;
+            job->rect.h = y1 - y0;
+        }
+        async->set.func = _cairosdl_flush_job;
+        async->set.jobs = (char *)async->jobs;
+        async->set.job_size = sizeof (async->jobs[0]);
+        async->set.num_jobs = num_jobs;
+
+        async->flushing = surface;
+        async->sdl_surface = sdl_surface;
+        sdl_surface->refcount++;
+        async->pending = 1;
+        _cairosdl_pool_submit (&async->set);
+    }
+
+    return surface == async->surfaces[0]
+        ? async->surfaces[1]
+        : async->surfaces[0];
+}
+
+void
+cairosdl_surface_flush_wait (cairo_surface_t *surface)
+{
+    _cairosdl_surface_wait_async (surface);
+}
+
+/*
+ * Batch flushing
+ */
+
+/* Rectangles bigger than this many pixels are split into bands of
+ * rows, and smaller ones are batched into jobs of about this many, so
+ * that each job works on a cache sized piece. */
+#define CAIROSDL_FLUSH_JOB_PIXELS (64*1024)
+
+typedef struct {
+    _cairosdl_flush_job_t *pieces;
+    int num_pieces;
+} _cairosdl_flush_batch_t;
+
+static void
+_cairosdl_flush_batch (void *param)
+{
+    _cairosdl_flush_batch_t *batch = (_cairosdl_flush_batch_t *)param;
+    int i;
+    for (i = 0; i < batch->num_pieces; i++)
+        _cairosdl_flush_job (batch->pieces + i);
+}
+
+static int
+_cairosdl_compare_pieces (void const *a, void const *b)
+{
+    SDL_Rect const *ra = &((_cairosdl_flush_job_t const *)a)->rect;
+    SDL_Rect const *rb = &((_cairosdl_flush_job_t const *)b)->rect;
+    if (ra->y != rb->y)
+        return ra->y < rb->y ? -1 : 1;
+    if (ra->x != rb->x)
+        return ra->x < rb->x ? -1 : 1;
+    return 0;
+}
+
+/* Clips the rect to the SDL_Surface and returns the number of bands
+ * it's split into. */
+static int
+_cairosdl_clip_flush_rect (SDL_Surface *sdl_surface,
+                           SDL_Rect    *rect,
+                           int         *OUT_band_height)
+{
+    Sint32 x = rect->x, y = rect->y, w = rect->w, h = rect->h;
+
+    if (x < 0) { w += x; x = 0; }
+    if (y < 0) { h += y; y = 0; }
+    if (x + w > sdl_surface->w) w = sdl_surface->w - x;
+    if (y + h > sdl_surface->h) h = sdl_surface->h - y;
+    if (w <= 0 || h <= 0)
+        return 0;
+
+    rect->x = x;
+    rect->y = y;
+    rect->w = w;
+    rect->h = h;
+    *OUT_band_height = CAIROSDL_FLUSH_JOB_PIXELS / w;
+    if (*OUT_band_height < 1)
+        *OUT_band_height = 1;
+    return (h + *OUT_band_height - 1) / *OUT_band_height;
+}
+
+/* Returns non-zero if flushing the surface has anything to do. */
+static int
+_cairosdl_surface_needs_flush (cairo_surface_t *surface)
+{
+    return cairosdl_surface_get_target (surface) != NULL &&
+        cairo_surface_status (surface) == CAIRO_STATUS_SUCCESS &&
+        (_cairosdl_binding_is_scaled (_cairosdl_surface_get_binding (surface)) ||
+         _cairosdl_surface_obtain_shadow_buffer (surface, NULL, NULL,
+                                                 NULL, NULL)
+         == CAIRO_STATUS_SUCCESS);
+}
+
+void
+cairosdl_surface_flush_many (
+    int                     num_surfaces,
+    cairo_surface_t *const *surfaces,
+    int const              *num_rects,
+    SDL_Rect const *const  *rects)
+{
+    _cairosdl_flush_job_t *pieces = NULL;
+    _cairosdl_flush_batch_t *batches = NULL;
+    double *lock_starts = NULL;
+    char *locked = NULL;
+    int num_pieces = 0, num_batches = 0;
+    size_t batch_pixels;
+    int i, j;
+
+    if (num_surfaces <= 0)
+        return;
+
+    /* Count the pieces. */
+    for (i = 0; i < num_surfaces; i++) {
+        SDL_Surface *sdl_surface;
+        SDL_Rect all;
+        int n, band_height;
+
+        if (!_cairosdl_surface_needs_flush (surfaces[i]))
+            continue;
+        sdl_surface = cairosdl_surface_get_target (surfaces[i]);
+        n = rects && rects[i] ? num_rects[i] : 1;
+        for (j = 0; j < n; j++) {
+            if (rects && rects[i]) {
+                all = rects[i][j];
+            }
+            else {
+                all.x = all.y = 0;
+                all.w = sdl_surface->w;
+                all.h = sdl_surface->h;
+            }
+            num_pieces += _cairosdl_clip_flush_rect (sdl_surface, &all,
+                                                     &band_height);
+        }
+    }
+    if (num_pieces == 0)
+        return;
+
+    pieces = (_cairosdl_flush_job_t *)malloc (num_pieces * sizeof (*pieces));
+    batches = (_cairosdl_flush_batch_t *)
+        malloc (num_pieces * sizeof (*batches));
+    lock_starts = (double *)malloc (num_surfaces * sizeof (*lock_starts));
+    locked = (char *)calloc (num_surfaces, 1);
+    if (!pieces || !batches || !lock_starts || !locked) {
+        /* Do them one by one then. */
+        for (i = 0; i < num_surfaces; i++) {
+            if (rects && rects[i])
+                cairosdl_surface_flush_rects (surfaces[i], num_rects[i],
+                                              rects[i]);
+            else
+                cairosdl_surface_flush (surfaces[i]);
+        }
+        goto DONE;
+    }
+
+    /* Lock the surfaces and cut their rectangles into pieces, top to
+     * bottom within each surface. */
+    num_pieces = 0;
+    for (i = 0; i < num_surfaces; i++) {
+        SDL_Surface *sdl_surface;
+        _cairosdl_binding_t *binding;
+        int first = num_pieces;
+        int n;
+
+        if (!_cairosdl_surface_needs_flush (surfaces[i]))
+            continue;
+        _cairosdl_surface_wait_async (surfaces[i]);
+        cairo_surface_flush (surfaces[i]);
+        if (!_cairosdl_surface_lock (surfaces[i], &lock_starts[i]))
+            continue;
+        locked[i] = 1;
+
+        /* A CAIROSDL_IN_PLACE surface's rectangles may overlap, and
+         * their pixels mustn't be converted twice, so they're done here
+         * one after the other.  A whole one is bands that don't. */
+        binding = _cairosdl_surface_get_binding (surfaces[i]);
+        if (rects && rects[i] && binding != NULL && binding->in_place != NULL) {
+            _cairosdl_surface_flush_rects_now (surfaces[i], num_rects[i],
+                                               rects[i]);
+            continue;
+        }
+
+        sdl_surface = cairosdl_surface_get_target (surfaces[i]);
+        n = rects && rects[i] ? num_rects[i] : 1;
+        for (j = 0; j < n; j++) {
+            SDL_Rect rect;
+            int num_bands, band_height, k;
+
+            if (rects && rects[i]) {
+                rect = rects[i][j];
+            }
+            else {
+                rect.x = rect.y = 0;
+                rect.w = sdl_surface->w;
+                rect.h = sdl_surface->h;
+            }
+            num_bands = _cairosdl_clip_flush_rect (sdl_surface, &rect,
+                                                   &band_height);
+            for (k = 0; k < num_bands; k++) {
+                _cairosdl_flush_job_t *piece = pieces + num_pieces++;
+                int y0 = k*band_height;
+                int y1 = y0 + band_height < rect.h ? y0 + band_height : rect.h;
+                piece->surface = surfaces[i];
+                piece->rect.x = rect.x;
+                piece->rect.y = rect.y + y0;
+                piece->rect.w = rect.w;
+                piece->rect.h = y1 - y0;
+            }
+        }
+        qsort (pieces + first, num_pieces - first, sizeof (*pieces),
+               _cairosdl_compare_pieces);
+    }
+
+    /* Batch consecutive pieces into jobs of a similar size. */
+    batch_pixels = 0;
+    for (i = 0; i < num_pieces; i++) {
+        size_t pixels = (size_t)pieces[i].rect.w * pieces[i].rect.h;
+        if (num_batches == 0 ||
+            batch_pixels + pixels > CAIROSDL_FLUSH_JOB_PIXELS)
+        {
+            batches[num_batches].pieces = pieces + i;
+            batches[num_batches].num_pieces = 0;
+            num_batches++;
+            batch_pixels = 0;
+        }
+        batches[num_batches - 1].num_pieces++;
+        batch_pixels += pixels;
+    }
+
+    _cairosdl_pool_run (_cairosdl_flush_batch, batches, sizeof (*batches),
+                        num_batches);
+
+    for (i = 0; i < num_surfaces; i++) {
+        if (!locked[i])
+            continue;
+        _cairosdl_surface_unlock (surfaces[i], lock_starts[i]);
+    }
+
+ DONE:
+    free (pieces);
+    free (batches);
+    free (lock_starts);
+    free (locked);
+}
+
+/* unpremultiply-lutb.c
+ *
+ * A pixel premultiplier and an unpremultiplier using reciprocal
+ * multiplication.  It specialises constant runs and solid runs of
+ * pixels with low overhead loops and uses only a 1KB table of
+ * reciprocals.
+ *
+ * The unpremultiplier was snarfed from
+ * http://cgit.freedesktop.org/~joonas/unpremultiply
+ *
+ * See there for other faster or nonportable variations on
+ * unpremultiply.  This one is a good all rounder that doesn't take
+ * that much data space. */
+
+/* Pixel format config for a 32 bit pixel with 8 bit components.  Only
+ * the location of alpha matters.  Cairo uses ASHIFT 24. */
+#define ASHIFT CAIROSDL_ASHIFT
 #define RSHIFT ((24 + ASHIFT) % 32)
 #define GSHIFT ((16 + ASHIFT) % 32)
 #define BSHIFT (( 8 + ASHIFT) % 32)
@@ -461,6 +1931,11 @@ cairosdl_destroy (cairo_t *cr)
  * represented in fixed point format with RECIPROCAL_BITS of
  * precision and errors rounded up. */
 #define RECIPROCAL_BITS 16
+
+/* Added before shifting to round to nearest, so that premultiplying
+ * gives back exactly what was unpremultiplied.  That matters when the
+ * same pixels go back and forth, like CAIROSDL_IN_PLACE surfaces do. */
+#define RECIPROCAL_HALF (1U << (RECIPROCAL_BITS - 1))
 static unsigned const reciprocal_table[256] = {
 # define R(i)  ((i) ? ceil_div(255*(1<<RECIPROCAL_BITS), (i)) : 0)
 # define R1(i) R(i),  R(i+1),   R(i+2),   R(i+3)
@@ -507,9 +1982,9 @@ unpremultiply_row(
 	    g = g < a ? g : a;
 	    b = b < a ? b : a;
 #endif
-            r = SHIFT(r * recip, RSHIFT - RECIPROCAL_BITS);
-            g = SHIFT(g * recip, GSHIFT - RECIPROCAL_BITS);
-            b = SHIFT(b * recip, BSHIFT - RECIPROCAL_BITS);
+            r = SHIFT(r * recip + RECIPROCAL_HALF, RSHIFT - RECIPROCAL_BITS);
+            g = SHIFT(g * recip + RECIPROCAL_HALF, GSHIFT - RECIPROCAL_BITS);
+            b = SHIFT(b * recip + RECIPROCAL_HALF, BSHIFT - RECIPROCAL_BITS);
             dst[i] = const_out =
 		(r & RMASK) | (g & GMASK) | (b & BMASK) | (rgba & AMASK);
         }
@@ -532,9 +2007,9 @@ unpremultiply_row(
 	    b = b < a ? b : a;
 #endif
             diff = rgba ^ const_in;
-            r = SHIFT(r * recip, RSHIFT - RECIPROCAL_BITS);
-            g = SHIFT(g * recip, GSHIFT - RECIPROCAL_BITS);
-            b = SHIFT(b * recip, BSHIFT - RECIPROCAL_BITS);
+            r = SHIFT(r * recip + RECIPROCAL_HALF, RSHIFT - RECIPROCAL_BITS);
+            g = SHIFT(g * recip + RECIPROCAL_HALF, GSHIFT - RECIPROCAL_BITS);
+            b = SHIFT(b * recip + RECIPROCAL_HALF, BSHIFT - RECIPROCAL_BITS);
             dst[i+1] =
 		(r & RMASK) | (g & GMASK) | (b & BMASK) | (rgba & AMASK);
         }
@@ -695,6 +2170,2178 @@ _cairosdl_blit_and_premultiply (
     }
 }
 
+/*
+ * Scaled surfaces
+ */
+
+/* Where a pixel of a scaled up row or column samples the scaled down
+ * one: between i0 and i1 with i1 weighted by weight/256.  Nearest
+ * neighbour taps have i0 == i1. */
+typedef struct {
+    int i0, i1;
+    unsigned weight;
+} _cairosdl_tap_t;
+
+static void
+_cairosdl_compute_taps (
+    _cairosdl_tap_t        *taps,
+    int                     start,
+    int                     num_taps,
+    double                  scale,
+    int                     src_size,
+    cairosdl_scale_filter_t filter)
+{
+    int i;
+    for (i = 0; i < num_taps; i++) {
+        _cairosdl_tap_t *tap = taps + i;
+        double u = (start + i + 0.5) * scale;
+        int k;
+
+        tap->weight = 0;
+        if (filter == CAIROSDL_SCALE_NEAREST) {
+            k = (int)u;
+            tap->i0 = tap->i1 = k < src_size ? k : src_size - 1;
+            continue;
+        }
+
+        /* Bilinear between the two nearest pixel centres. */
+        u -= 0.5;
+        if (u <= 0.0) {
+            tap->i0 = tap->i1 = 0;
+            continue;
+        }
+        k = (int)u;
+        if (k >= src_size - 1) {
+            tap->i0 = tap->i1 = src_size - 1;
+            continue;
+        }
+        tap->i0 = k;
+        tap->i1 = k + 1;
+        tap->weight = (unsigned)((u - k) * 256 + 0.5);
+    }
+}
+
+/* Interpolate between the pixels a and b, weighting b by weight/256,
+ * with rounding.  The channels of premultiplied pixels stay
+ * premultiplied. */
+static unsigned
+lerp_un8x4 (unsigned a, unsigned b, unsigned weight)
+{
+    unsigned rb = ((a & 0x00ff00ff) * (256 - weight) +
+                   (b & 0x00ff00ff) * weight + 0x00800080) >> 8;
+    unsigned ag = (((a >> 8) & 0x00ff00ff) * (256 - weight) +
+                   ((b >> 8) & 0x00ff00ff) * weight + 0x00800080) >> 8;
+    return (rb & 0x00ff00ff) | ((ag & 0x00ff00ff) << 8);
+}
+
+static void
+lerp_row (
+    unsigned       *dst,
+    unsigned const *a,
+    unsigned const *b,
+    int             num_pixels,
+    unsigned        weight)
+{
+    int i = 0;
+
+    if (weight == 0) {
+        memcpy (dst, a, 4*num_pixels);
+        return;
+    }
+
+#if CAIROSDL_USE_SSE2
+    {
+        __m128i const zero = _mm_setzero_si128 ();
+        __m128i const wa = _mm_set1_epi16 ((short)(256 - weight));
+        __m128i const wb = _mm_set1_epi16 ((short)weight);
+        __m128i const half = _mm_set1_epi16 (128);
+        for (; i + 4 <= num_pixels; i += 4) {
+            __m128i va = _mm_loadu_si128 ((__m128i const *)(a + i));
+            __m128i vb = _mm_loadu_si128 ((__m128i const *)(b + i));
+            __m128i lo = _mm_add_epi16 (
+                _mm_mullo_epi16 (_mm_unpacklo_epi8 (va, zero), wa),
+                _mm_mullo_epi16 (_mm_unpacklo_epi8 (vb, zero), wb));
+            __m128i hi = _mm_add_epi16 (
+                _mm_mullo_epi16 (_mm_unpackhi_epi8 (va, zero), wa),
+                _mm_mullo_epi16 (_mm_unpackhi_epi8 (vb, zero), wb));
+            lo = _mm_srli_epi16 (_mm_add_epi16 (lo, half), 8);
+            hi = _mm_srli_epi16 (_mm_add_epi16 (hi, half), 8);
+            _mm_storeu_si128 ((__m128i *)(dst + i),
+                              _mm_packus_epi16 (lo, hi));
+        }
+    }
+#endif
+
+    for (; i < num_pixels; i++)
+        dst[i] = lerp_un8x4 (a[i], b[i], weight);
+}
+
+/* Nearest neighbour scale a row.  If is_2x then every source pixel
+ * is doubled, starting from the first. */
+static void
+upscale_row_nearest (
+    unsigned              *dst,
+    unsigned const        *src,
+    _cairosdl_tap_t const *taps,
+    int                    num_pixels,
+    int                    is_2x)
+{
+    int i = 0;
+
+#if CAIROSDL_USE_SSE2
+    if (is_2x) {
+        unsigned const *s = src + taps[0].i0;
+        for (; i + 4 <= num_pixels; i += 4) {
+            __m128i v = _mm_loadl_epi64 ((__m128i const *)(s + i/2));
+            _mm_storeu_si128 ((__m128i *)(dst + i),
+                              _mm_unpacklo_epi32 (v, v));
+        }
+    }
+#else
+    (void)is_2x;
+#endif
+
+    for (; i < num_pixels; i++)
+        dst[i] = src[taps[i].i0];
+}
+
+/* Upscale the pixels of the rectangle x, y, width, height of the
+ * target from the scaled down source and unpremultiply them if
+ * asked to, a row at a time while the row is in cache. */
+static void
+_cairosdl_upscale_rect (
+    unsigned char             *target_bytes,
+    size_t                     target_stride,
+    unsigned char const       *source_bytes,
+    size_t                     source_stride,
+    int                        source_width,
+    int                        source_height,
+    _cairosdl_binding_t const *binding,
+    int                        unpremultiply,
+    int                        x,
+    int                        y,
+    int                        width,
+    int                        height)
+{
+    cairosdl_scale_filter_t filter = binding->filter;
+    _cairosdl_tap_t *x_taps;
+    unsigned *lerped = NULL;
+    unsigned *prev_row = NULL;
+    int prev_i0 = -1;
+    int first, last, row;
+    int is_2x = binding->scale == 0.5 && (x & 1) == 0;
+
+    x_taps = (_cairosdl_tap_t *)malloc (width * sizeof (*x_taps));
+    if (x_taps == NULL)
+        return;
+    _cairosdl_compute_taps (x_taps, x, width,
+                            binding->scale, source_width, filter);
+
+    /* The source columns the rectangle samples. */
+    first = x_taps[0].i0;
+    last = x_taps[width - 1].i1;
+    if (filter == CAIROSDL_SCALE_BILINEAR) {
+        lerped = (unsigned *)malloc (4 * (last - first + 1));
+        if (lerped == NULL) {
+            free (x_taps);
+            return;
+        }
+    }
+
+    for (row = 0; row < height; row++) {
+        unsigned *dst = (unsigned *)(target_bytes +
+                                     target_stride*(y + row)) + x;
+        _cairosdl_tap_t y_tap;
+        int i;
+
+        _cairosdl_compute_taps (&y_tap, y + row, 1,
+                                binding->scale, source_height, filter);
+
+        if (filter == CAIROSDL_SCALE_NEAREST) {
+            /* Rows from the same source row come out the same. */
+            if (y_tap.i0 == prev_i0) {
+                memcpy (dst, prev_row, 4*width);
+                continue;
+            }
+            upscale_row_nearest (
+                dst,
+                (unsigned const *)(source_bytes + source_stride*y_tap.i0),
+                x_taps, width, is_2x);
+        }
+        else {
+            lerp_row (
+                lerped,
+                (unsigned const *)(source_bytes + source_stride*y_tap.i0) + first,
+                (unsigned const *)(source_bytes + source_stride*y_tap.i1) + first,
+                last - first + 1,
+                y_tap.weight);
+            for (i = 0; i < width; i++) {
+                dst[i] = lerp_un8x4 (lerped[x_taps[i].i0 - first],
+                                     lerped[x_taps[i].i1 - first],
+                                     x_taps[i].weight);
+            }
+        }
+
+        if (unpremultiply)
+            unpremultiply_row (dst, dst, width);
+
+        prev_i0 = y_tap.i0;
+        prev_row = dst;
+    }
+
+    free (lerped);
+    free (x_taps);
+}
+
+static void
+_cairosdl_flush_scaled_rects (
+    cairo_surface_t           *surface,
+    _cairosdl_binding_t const *binding,
+    int                        num_rects,
+    SDL_Rect const            *rects)
+{
+    unsigned char *target_bytes;
+    size_t target_stride;
+    size_t target_width;
+    size_t target_height;
+    cairo_status_t status;
+    int unpremultiply;
+
+    status = _cairosdl_surface_obtain_SDL_buffer (surface,
+                                                  &target_bytes,
+                                                  &target_stride,
+                                                  &target_width,
+                                                  &target_height);
+    if (status != CAIRO_STATUS_SUCCESS)
+        return;                 /* no buffer -> nothing to do */
+
+    unpremultiply =
+        cairo_image_surface_get_format (surface) == CAIRO_FORMAT_ARGB32;
+
+    while (num_rects-- > 0) {
+        Sint32 x = rects->x;
+        Sint32 y = rects->y;
+        Sint32 w = rects->w;
+        Sint32 h = rects->h;
+        rects++;
+
+        if (x <= 0) { w += x; x = 0; }
+        if (y <= 0) { h += y; y = 0; }
+        if (x >= (Sint32)target_width || y >= (Sint32)target_height) continue;
+        if (x + w >= (Sint32)target_width) w = target_width - x;
+        if (y + h >= (Sint32)target_height) h = target_height - y;
+        if (w <= 0 || h <= 0) continue;
+
+        _cairosdl_upscale_rect (
+            target_bytes, target_stride,
+            cairo_image_surface_get_data (surface),
+            cairo_image_surface_get_stride (surface),
+            cairo_image_surface_get_width (surface),
+            cairo_image_surface_get_height (surface),
+            binding, unpremultiply,
+            x, y, w, h);
+    }
+}
+
+/* Sample the SDL_Surface down into the image, nearest neighbour. */
+static void
+_cairosdl_mark_dirty_scaled_rects (
+    cairo_surface_t           *surface,
+    _cairosdl_binding_t const *binding,
+    int                        num_rects,
+    SDL_Rect const            *rects)
+{
+    unsigned char *source_bytes;
+    size_t source_stride;
+    size_t source_width;
+    size_t source_height;
+    unsigned char *target_bytes = cairo_image_surface_get_data (surface);
+    size_t target_stride = cairo_image_surface_get_stride (surface);
+    int target_width = cairo_image_surface_get_width (surface);
+    int target_height = cairo_image_surface_get_height (surface);
+    double scale = binding->scale;
+    cairo_status_t status;
+    int premultiply;
+
+    status = _cairosdl_surface_obtain_SDL_buffer (surface,
+                                                  &source_bytes,
+                                                  &source_stride,
+                                                  &source_width,
+                                                  &source_height);
+    if (status != CAIRO_STATUS_SUCCESS)
+        return;                 /* no buffer -> nothing to do */
+
+    premultiply =
+        cairo_image_surface_get_format (surface) == CAIRO_FORMAT_ARGB32;
+
+    while (num_rects-- > 0) {
+        Sint32 x = rects->x;
+        Sint32 y = rects->y;
+        Sint32 w = rects->w;
+        Sint32 h = rects->h;
+        int x0, y0, x1, y1, i, j;
+        rects++;
+
+        if (x <= 0) { w += x; x = 0; }
+        if (y <= 0) { h += y; y = 0; }
+        if (x >= (Sint32)source_width || y >= (Sint32)source_height) continue;
+        if (x + w >= (Sint32)source_width) w = source_width - x;
+        if (y + h >= (Sint32)source_height) h = source_height - y;
+        if (w <= 0 || h <= 0) continue;
+
+        /* The image pixels covering the rectangle. */
+        x0 = (int)floor (x * scale);
+        y0 = (int)floor (y * scale);
+        x1 = (int)ceil ((x + w) * scale);
+        y1 = (int)ceil ((y + h) * scale);
+        if (x1 > target_width) x1 = target_width;
+        if (y1 > target_height) y1 = target_height;
+        if (x0 >= x1 || y0 >= y1) continue;
+
+        for (j = y0; j < y1; j++) {
+            int sy = (int)((j + 0.5) / scale);
+            unsigned const *src;
+            unsigned *dst = (unsigned *)(target_bytes + target_stride*j);
+
+            if (sy >= (int)source_height) sy = source_height - 1;
+            src = (unsigned const *)(source_bytes + source_stride*sy);
+
+            for (i = x0; i < x1; i++) {
+                int sx = (int)((i + 0.5) / scale);
+                if (sx >= (int)source_width) sx = source_width - 1;
+                dst[i] = src[sx];
+            }
+            if (premultiply)
+                premultiply_row (dst + x0, dst + x0, x1 - x0);
+        }
+
+        cairo_surface_mark_dirty_rectangle (surface, x0, y0,
+                                            x1 - x0, y1 - y0);
+    }
+}
+
+/*
+ * Sprite compositing
+ */
+
+/* Multiply the two 8 bit channels in the bytes 0 and 2 of x by a/255
+ * with rounding. */
+static unsigned
+mul_un8x2 (unsigned x, unsigned a)
+{
+    unsigned t = (x & 0x00FF00FF) * a + 0x00800080;
+    t += (t >> 8) & 0x00FF00FF;
+    return (t >> 8) & 0x00FF00FF;
+}
+
+/* Multiply all four 8 bit channels of x by a/255. */
+static unsigned
+mul_un8x4 (unsigned x, unsigned a)
+{
+    return mul_un8x2 (x, a) | (mul_un8x2 (x >> 8, a) << 8);
+}
+
+#if CAIROSDL_USE_SSE2
+/* Multiply all four 8 bit channels of four pixels by a/255 with the
+ * same rounding as mul_un8x4().  Each pixel's a is in the low byte
+ * of its lane. */
+static __m128i
+mul_un8x4_sse2 (__m128i x, __m128i a)
+{
+    __m128i const zero = _mm_setzero_si128 ();
+    __m128i const bias = _mm_set1_epi16 (0x80);
+    __m128i a_lo, a_hi, x_lo, x_hi;
+
+    /* Spread each pixel's a into all its 16 bit lanes. */
+    a = _mm_or_si128 (a, _mm_slli_epi32 (a, 16));
+    a_lo = _mm_unpacklo_epi32 (a, a);
+    a_hi = _mm_unpackhi_epi32 (a, a);
+
+    x_lo = _mm_unpacklo_epi8 (x, zero);
+    x_hi = _mm_unpackhi_epi8 (x, zero);
+    x_lo = _mm_add_epi16 (_mm_mullo_epi16 (x_lo, a_lo), bias);
+    x_hi = _mm_add_epi16 (_mm_mullo_epi16 (x_hi, a_hi), bias);
+    x_lo = _mm_srli_epi16 (_mm_add_epi16 (x_lo, _mm_srli_epi16 (x_lo, 8)), 8);
+    x_hi = _mm_srli_epi16 (_mm_add_epi16 (x_hi, _mm_srli_epi16 (x_hi, 8)), 8);
+    return _mm_packus_epi16 (x_lo, x_hi);
+}
+
+/* Composite four premultiplied pixels s OVER d. */
+static __m128i
+over_sse2 (__m128i s, __m128i d)
+{
+    __m128i ia = _mm_srli_epi32 (_mm_xor_si128 (s, _mm_set1_epi32 (-1)),
+                                 ASHIFT);
+    return _mm_adds_epu8 (s, mul_un8x4_sse2 (d, ia));
+}
+
+/* Nonzero if all four pixels in s are clear. */
+static int
+all_clear_sse2 (__m128i s)
+{
+    return _mm_movemask_epi8 (
+        _mm_cmpeq_epi32 (s, _mm_setzero_si128 ())) == 0xFFFF;
+}
+
+/* Nonzero if all four pixels in s are solid. */
+static int
+all_solid_sse2 (__m128i s)
+{
+    __m128i const amask = _mm_set1_epi32 ((int)AMASK);
+    return _mm_movemask_epi8 (
+        _mm_cmpeq_epi32 (_mm_and_si128 (s, amask), amask)) == 0xFFFF;
+}
+
+/* Composite premultiplied pixels from src[] OVER dst[] four at a
+ * time.  Returns the number of pixels done; the caller finishes off
+ * the rest. */
+static size_t
+over_row_sse2 (
+    unsigned       * dst,
+    unsigned const * src,
+    size_t           num_pixels)
+{
+    size_t i;
+
+    for (i = 0; i + 4 <= num_pixels; i += 4) {
+        __m128i s = _mm_loadu_si128 ((__m128i const *)(src + i));
+        __m128i d;
+
+        if (all_clear_sse2 (s))
+            continue;
+        if (all_solid_sse2 (s)) {
+            _mm_storeu_si128 ((__m128i *)(dst + i), s);
+            continue;
+        }
+
+        d = _mm_loadu_si128 ((__m128i const *)(dst + i));
+        _mm_storeu_si128 ((__m128i *)(dst + i), over_sse2 (s, d));
+    }
+    return i;
+}
+#endif
+
+/* Composite num_pixels premultiplied pixels from src[] OVER dst[]
+ * after scaling them by opacity/255.  Solid source pixels are stored
+ * as is and clear ones skipped.  Set src_amask to AMASK to treat the
+ * source as opaque (RGB24). */
+static void
+over_row (
+    unsigned       * dst,
+    unsigned const * src,
+    size_t           num_pixels,
+    unsigned         opacity,
+    unsigned         src_amask)
+{
+    size_t i = 0;
+    if (opacity == 255) {
+#if CAIROSDL_USE_SSE2
+        if (src_amask == 0)
+            i = over_row_sse2 (dst, src, num_pixels);
+#endif
+        for (; i < num_pixels; i++) {
+            unsigned s = src[i] | src_amask;
+            unsigned a = (s >> ASHIFT) & 255;
+            if (a == 255)
+                dst[i] = s;
+            else if (s != 0)
+                dst[i] = s + mul_un8x4 (dst[i], 255 - a);
+        }
+    }
+    else {
+        for (i = 0; i < num_pixels; i++) {
+            unsigned s = mul_un8x4 (src[i] | src_amask, opacity);
+            unsigned a = (s >> ASHIFT) & 255;
+            if (s != 0)
+                dst[i] = s + mul_un8x4 (dst[i], 255 - a);
+        }
+    }
+}
+
+static int
+_cairosdl_is_pixel_image (cairo_surface_t *surface)
+{
+    cairo_format_t format;
+    if (cairo_surface_get_type (surface) != CAIRO_SURFACE_TYPE_IMAGE)
+        return 0;
+    format = cairo_image_surface_get_format (surface);
+    return format == CAIRO_FORMAT_ARGB32 || format == CAIRO_FORMAT_RGB24;
+}
+
+/* Whether user space units aren't device pixels, as with
+ * cairosdl_surface_create_scaled(). */
+static int
+_cairosdl_has_device_scale (cairo_surface_t *surface)
+{
+    double x_scale, y_scale;
+    cairo_surface_get_device_scale (surface, &x_scale, &y_scale);
+    return x_scale != 1.0 || y_scale != 1.0;
+}
+
+/* Intersect the sprite's source and destination rectangles with the
+ * source and target bounds.  Returns zero if nothing is left. */
+static int
+_cairosdl_clip_sprite (
+    cairosdl_sprite_t *sprite,
+    int                target_width,
+    int                target_height)
+{
+    int source_width = cairo_image_surface_get_width (sprite->source);
+    int source_height = cairo_image_surface_get_height (sprite->source);
+    int d;
+
+    if (sprite->src_x < 0) {
+        d = -sprite->src_x;
+        sprite->src_x += d; sprite->dst_x += d; sprite->width -= d;
+    }
+    if (sprite->src_y < 0) {
+        d = -sprite->src_y;
+        sprite->src_y += d; sprite->dst_y += d; sprite->height -= d;
+    }
+    if (sprite->dst_x < 0) {
+        d = -sprite->dst_x;
+        sprite->src_x += d; sprite->dst_x += d; sprite->width -= d;
+    }
+    if (sprite->dst_y < 0) {
+        d = -sprite->dst_y;
+        sprite->src_y += d; sprite->dst_y += d; sprite->height -= d;
+    }
+    if (sprite->src_x + sprite->width > source_width)
+        sprite->width = source_width - sprite->src_x;
+    if (sprite->src_y + sprite->height > source_height)
+        sprite->height = source_height - sprite->src_y;
+    if (sprite->dst_x + sprite->width > target_width)
+        sprite->width = target_width - sprite->dst_x;
+    if (sprite->dst_y + sprite->height > target_height)
+        sprite->height = target_height - sprite->dst_y;
+
+    return sprite->width > 0 && sprite->height > 0;
+}
+
+static void
+_cairosdl_composite_sprite_using_cairo (
+    cairo_t                 *cr,
+    cairosdl_sprite_t const *sprite)
+{
+    cairo_save (cr);
+    cairo_set_source_surface (cr, sprite->source,
+                              sprite->dst_x - sprite->src_x,
+                              sprite->dst_y - sprite->src_y);
+    cairo_rectangle (cr,
+                     sprite->dst_x, sprite->dst_y,
+                     sprite->width, sprite->height);
+    cairo_clip (cr);
+    cairo_paint_with_alpha (cr, sprite->opacity);
+    cairo_restore (cr);
+}
+
+/*
+ * Span encoded sprites
+ */
+
+/* A run of non-clear pixels in a row of a span encoding. */
+typedef struct {
+    Uint16 x;
+    Uint16 length;
+    Uint8  is_solid;
+} _cairosdl_span_t;
+
+struct _cairosdl_spans {
+    /* The image rectangle the spans were encoded from. */
+    cairo_surface_t *source;
+    int x, y;
+    int width, height;
+
+    /* The spans of row i are spans[row_start[i]] up to but not
+     * including spans[row_start[i+1]].  Clear runs aren't stored. */
+    int *row_start;
+    int row_start_size;
+    _cairosdl_span_t *spans;
+    int num_spans;
+    int spans_size;
+};
+
+cairosdl_spans_t *
+cairosdl_spans_create (void)
+{
+    return (cairosdl_spans_t *)calloc (1, sizeof (cairosdl_spans_t));
+}
+
+void
+cairosdl_spans_destroy (cairosdl_spans_t *spans)
+{
+    if (spans == NULL)
+        return;
+    free (spans->row_start);
+    free (spans->spans);
+    free (spans);
+}
+
+static int
+_cairosdl_spans_add (
+    cairosdl_spans_t *spans,
+    int               x,
+    int               length,
+    int               is_solid)
+{
+    _cairosdl_span_t *span;
+
+    if (spans->num_spans == spans->spans_size) {
+        int size = spans->spans_size ? 2*spans->spans_size : 64;
+        void *p = realloc (spans->spans, size * sizeof (_cairosdl_span_t));
+        if (p == NULL)
+            return -1;
+        spans->spans = (_cairosdl_span_t *)p;
+        spans->spans_size = size;
+    }
+
+    span = spans->spans + spans->num_spans++;
+    span->x = (Uint16)x;
+    span->length = (Uint16)length;
+    span->is_solid = (Uint8)is_solid;
+    return 0;
+}
+
+/* Classify a premultiplied pixel: 0 for clear, 1 for translucent, 2
+ * for solid. */
+#define PIXEL_CLASS(p) ((p) == 0 ? 0 : ((p) & AMASK) == AMASK ? 2 : 1)
+
+int
+cairosdl_spans_encode (
+    cairosdl_spans_t *spans,
+    cairo_surface_t  *image,
+    int               x,
+    int               y,
+    int               width,
+    int               height)
+{
+    unsigned char const *bytes;
+    size_t stride;
+    int row;
+
+    spans->source = NULL;
+    spans->num_spans = 0;
+
+    if (cairo_surface_get_type (image) != CAIRO_SURFACE_TYPE_IMAGE ||
+        cairo_image_surface_get_format (image) != CAIRO_FORMAT_ARGB32)
+        return -1;
+    if (x < 0 || y < 0 || width <= 0 || height <= 0 ||
+        width > 32767 ||
+        x + width > cairo_image_surface_get_width (image) ||
+        y + height > cairo_image_surface_get_height (image))
+        return -1;
+
+    if (spans->row_start_size < height + 1) {
+        void *p = realloc (spans->row_start, (height + 1) * sizeof (int));
+        if (p == NULL)
+            return -1;
+        spans->row_start = (int *)p;
+        spans->row_start_size = height + 1;
+    }
+
+    cairo_surface_flush (image);
+    stride = cairo_image_surface_get_stride (image);
+    bytes = cairo_image_surface_get_data (image) + stride*y + 4*x;
+
+    for (row = 0; row < height; row++) {
+        unsigned const *pixels = (unsigned const *)(bytes + stride*row);
+        int i = 0;
+
+        spans->row_start[row] = spans->num_spans;
+        while (i < width) {
+            int start = i;
+            int kind = PIXEL_CLASS (pixels[i]);
+            while (++i < width && PIXEL_CLASS (pixels[i]) == kind)
+                ;
+            if (kind != 0 &&
+                _cairosdl_spans_add (spans, start, i - start, kind == 2))
+                return -1;
+        }
+    }
+    spans->row_start[height] = spans->num_spans;
+
+    spans->source = image;
+    spans->x = x;
+    spans->y = y;
+    spans->width = width;
+    spans->height = height;
+    return 0;
+}
+
+/* True if the spans were encoded from exactly the source rectangle
+ * of the sprite as given by the caller before clipping. */
+static int
+_cairosdl_spans_match (
+    cairosdl_spans_t const  *spans,
+    cairosdl_sprite_t const *sprite)
+{
+    return spans != NULL &&
+        spans->source == sprite->source &&
+        spans->x == sprite->src_x &&
+        spans->y == sprite->src_y &&
+        spans->width == sprite->width &&
+        spans->height == sprite->height;
+}
+
+/* Composite the clipped sprite using its span encoding.  The target
+ * and source pointers are to the starts of the first rows. */
+static void
+_cairosdl_composite_spans (
+    unsigned char           *target_bytes,
+    size_t                   target_stride,
+    unsigned char const     *source_bytes,
+    size_t                   source_stride,
+    cairosdl_spans_t const  *spans,
+    cairosdl_sprite_t const *sprite,
+    unsigned                 opacity)
+{
+    int x0 = sprite->src_x - spans->x;
+    int x1 = x0 + sprite->width;
+    int row = sprite->src_y - spans->y;
+    int last_row = row + sprite->height;
+
+    for (; row < last_row; row++) {
+        unsigned *dst = (unsigned *)target_bytes + sprite->dst_x - x0;
+        unsigned const *src = (unsigned const *)source_bytes + spans->x;
+        _cairosdl_span_t const *span = spans->spans + spans->row_start[row];
+        _cairosdl_span_t const *end = spans->spans + spans->row_start[row+1];
+
+        for (; span < end; span++) {
+            int a = span->x > x0 ? span->x : x0;
+            int b = span->x + span->length < x1 ? span->x + span->length : x1;
+            if (a >= b)
+                continue;
+            if (span->is_solid && opacity == 255)
+                memcpy (dst + a, src + a, 4*(b - a));
+            else
+                over_row (dst + a, src + a, b - a, opacity, 0);
+        }
+
+        target_bytes += target_stride;
+        source_bytes += source_stride;
+    }
+}
+
+void
+cairosdl_composite_sprites (
+    cairo_surface_t         *target,
+    int                      num_sprites,
+    cairosdl_sprite_t const *sprites)
+{
+    unsigned char *target_bytes;
+    size_t target_stride;
+    int target_width, target_height;
+    double x_offset, y_offset;
+    cairo_t *cr = NULL;
+
+    if (num_sprites <= 0)
+        return;
+
+    if (!_cairosdl_is_pixel_image (target) ||
+        _cairosdl_has_device_scale (target))
+    {
+        cr = cairo_create (target);
+        while (num_sprites-- > 0)
+            _cairosdl_composite_sprite_using_cairo (cr, sprites++);
+        cairo_destroy (cr);
+        return;
+    }
+
+    cairo_surface_flush (target);
+    target_bytes = cairo_image_surface_get_data (target);
+    target_stride = cairo_image_surface_get_stride (target);
+    target_width = cairo_image_surface_get_width (target);
+    target_height = cairo_image_surface_get_height (target);
+    cairo_surface_get_device_offset (target, &x_offset, &y_offset);
+
+    for (; num_sprites > 0; num_sprites--, sprites++) {
+        cairosdl_sprite_t sprite = *sprites;
+        unsigned char const *source_bytes;
+        size_t source_stride;
+        unsigned opacity, src_amask;
+        int dx, dy;
+
+        if (sprite.opacity <= 0.0)
+            continue;
+
+        if (!_cairosdl_is_pixel_image (sprite.source)) {
+            if (cr == NULL)
+                cr = cairo_create (target);
+            _cairosdl_composite_sprite_using_cairo (cr, &sprite);
+            continue;
+        }
+
+        /* Work in the target's pixel coordinates. */
+        dx = (int)floor (x_offset + 0.5);
+        dy = (int)floor (y_offset + 0.5);
+        sprite.dst_x += dx;
+        sprite.dst_y += dy;
+        if (!_cairosdl_clip_sprite (&sprite, target_width, target_height))
+            continue;
+
+        cairo_surface_flush (sprite.source);
+        source_bytes = cairo_image_surface_get_data (sprite.source);
+        source_stride = cairo_image_surface_get_stride (sprite.source);
+        source_bytes += source_stride*sprite.src_y;
+
+        opacity = sprite.opacity >= 1.0 ? 255 : sprite.opacity*255 + 0.5;
+        src_amask =
+            cairo_image_surface_get_format (sprite.source) == CAIRO_FORMAT_RGB24
+            ? AMASK : 0;
+
+        if (_cairosdl_spans_match (sprite.spans, sprites)) {
+            _cairosdl_composite_spans (
+                target_bytes + target_stride*sprite.dst_y, target_stride,
+                source_bytes, source_stride,
+                sprite.spans, &sprite, opacity);
+        }
+        else {
+            unsigned char *dst_row =
+                target_bytes + target_stride*sprite.dst_y + 4*sprite.dst_x;
+            int h = sprite.height;
+            source_bytes += 4*sprite.src_x;
+            while (h-- > 0) {
+                over_row ((unsigned *)dst_row,
+                          (unsigned const *)source_bytes,
+                          sprite.width, opacity, src_amask);
+                dst_row += target_stride;
+                source_bytes += source_stride;
+            }
+        }
+
+        cairo_surface_mark_dirty_rectangle (target,
+                                            sprite.dst_x - dx,
+                                            sprite.dst_y - dy,
+                                            sprite.width,
+                                            sprite.height);
+    }
+
+    if (cr != NULL)
+        cairo_destroy (cr);
+}
+
+/* Unpremultiply a single premultiplied pixel.  Callers that have
+ * only one pixel at a time use this instead of unpremultiply_row(),
+ * whose run probing doesn't pay for itself on one pixel. */
+static unsigned
+unpremultiply_pixel (unsigned rgba)
+{
+    unsigned recip = reciprocal_table[(rgba >> ASHIFT) & 255];
+    unsigned r = (rgba >> RSHIFT) & 255;
+    unsigned g = (rgba >> GSHIFT) & 255;
+    unsigned b = (rgba >> BSHIFT) & 255;
+    r = SHIFT(r * recip + RECIPROCAL_HALF, RSHIFT - RECIPROCAL_BITS);
+    g = SHIFT(g * recip + RECIPROCAL_HALF, GSHIFT - RECIPROCAL_BITS);
+    b = SHIFT(b * recip + RECIPROCAL_HALF, BSHIFT - RECIPROCAL_BITS);
+    return (r & RMASK) | (g & GMASK) | (b & BMASK) | (rgba & AMASK);
+}
+
+#if CAIROSDL_USE_SSE2
+/* over_row_unpremultiplied() four pixels at a time.  The premultiply
+ * and OVER are done in SSE2; SSE2 has no gather or 32 bit multiply,
+ * so the reciprocal unpremultiply is done per pixel on the way out.
+ * Returns the number of pixels done. */
+static size_t
+over_row_unpremultiplied_sse2 (
+    unsigned       * dst,
+    unsigned const * src,
+    size_t           num_pixels,
+    unsigned         src_amask)
+{
+    __m128i const amask = _mm_set1_epi32 ((int)AMASK);
+    __m128i const src_or = _mm_set1_epi32 ((int)src_amask);
+    size_t i;
+
+    for (i = 0; i + 4 <= num_pixels; i += 4) {
+        __m128i s = _mm_or_si128 (
+            _mm_loadu_si128 ((__m128i const *)(src + i)), src_or);
+        __m128i d;
+        unsigned out[4];
+        int j;
+
+        if (all_clear_sse2 (s))
+            continue;
+        if (all_solid_sse2 (s)) {
+            _mm_storeu_si128 ((__m128i *)(dst + i), s);
+            continue;
+        }
+
+        d = _mm_loadu_si128 ((__m128i const *)(dst + i));
+        d = mul_un8x4_sse2 (_mm_or_si128 (d, amask),
+                            _mm_srli_epi32 (d, ASHIFT));
+        _mm_storeu_si128 ((__m128i *)out, over_sse2 (s, d));
+
+        /* Clear source pixels leave dst alone: a premultiply and
+         * unpremultiply round trip isn't exact at low alpha. */
+        for (j = 0; j < 4; j++) {
+            if ((src[i + j] | src_amask) != 0)
+                dst[i + j] = unpremultiply_pixel (out[j]);
+        }
+    }
+    return i;
+}
+#endif
+
+/* Composite premultiplied src[] OVER unpremultiplied ARGB dst[] and
+ * leave the result unpremultiplied. */
+static void
+over_row_unpremultiplied (
+    unsigned       * dst,
+    unsigned const * src,
+    size_t           num_pixels,
+    unsigned         src_amask)
+{
+    size_t i = 0;
+#if CAIROSDL_USE_SSE2
+    i = over_row_unpremultiplied_sse2 (dst, src, num_pixels, src_amask);
+#endif
+    for (; i < num_pixels; i++) {
+        unsigned s = src[i] | src_amask;
+        unsigned a = (s >> ASHIFT) & 255;
+        unsigned d, da;
+
+        if (a == 255) {
+            dst[i] = s;
+            continue;
+        }
+        if (s == 0)
+            continue;
+
+        d = dst[i];
+        da = (d >> ASHIFT) & 255;
+        d = mul_un8x4 (d | AMASK, da);
+        dst[i] = unpremultiply_pixel (s + mul_un8x4 (d, 255 - a));
+    }
+}
+
+#if CAIROSDL_USE_SSE2
+/* over_row_565() four pixels at a time, widening dst to xRGB and
+ * packing the result back to 5-6-5.  The widening replicates the top
+ * bits so a clear source pixel packs back to the same dst pixel.
+ * Returns the number of pixels done. */
+static size_t
+over_row_565_sse2 (
+    Uint16         * dst,
+    unsigned const * src,
+    size_t           num_pixels,
+    unsigned         src_amask)
+{
+    __m128i const zero = _mm_setzero_si128 ();
+    __m128i const src_or = _mm_set1_epi32 ((int)src_amask);
+    __m128i const mask5 = _mm_set1_epi32 (0x1F);
+    __m128i const mask6 = _mm_set1_epi32 (0x3F);
+    size_t i;
+
+    for (i = 0; i + 4 <= num_pixels; i += 4) {
+        __m128i s = _mm_or_si128 (
+            _mm_loadu_si128 ((__m128i const *)(src + i)), src_or);
+        __m128i d, r, g, b;
+
+        if (all_clear_sse2 (s))
+            continue;
+
+        if (!all_solid_sse2 (s)) {
+            d = _mm_loadl_epi64 ((__m128i const *)(dst + i));
+            d = _mm_unpacklo_epi16 (d, zero);
+            r = _mm_and_si128 (_mm_srli_epi32 (d, 11), mask5);
+            g = _mm_and_si128 (_mm_srli_epi32 (d, 5), mask6);
+            b = _mm_and_si128 (d, mask5);
+            r = _mm_or_si128 (_mm_slli_epi32 (r, 3), _mm_srli_epi32 (r, 2));
+            g = _mm_or_si128 (_mm_slli_epi32 (g, 2), _mm_srli_epi32 (g, 4));
+            b = _mm_or_si128 (_mm_slli_epi32 (b, 3), _mm_srli_epi32 (b, 2));
+            d = _mm_or_si128 (_mm_or_si128 (_mm_slli_epi32 (r, RSHIFT),
+                                            _mm_slli_epi32 (g, GSHIFT)),
+                              _mm_slli_epi32 (b, BSHIFT));
+            s = over_sse2 (s, d);
+        }
+
+        r = _mm_and_si128 (_mm_srli_epi32 (s, RSHIFT + 3 - 11),
+                           _mm_set1_epi32 (0xF800));
+        g = _mm_and_si128 (_mm_srli_epi32 (s, GSHIFT + 2 - 5),
+                           _mm_set1_epi32 (0x07E0));
+        b = _mm_and_si128 (_mm_srli_epi32 (s, BSHIFT + 3),
+                           _mm_set1_epi32 (0x001F));
+        d = _mm_or_si128 (_mm_or_si128 (r, g), b);
+        /* Sign extend so the saturating pack keeps all 16 bits. */
+        d = _mm_srai_epi32 (_mm_slli_epi32 (d, 16), 16);
+        _mm_storel_epi64 ((__m128i *)(dst + i), _mm_packs_epi32 (d, d));
+    }
+    return i;
+}
+#endif
+
+/* Composite premultiplied src[] OVER RGB 565 dst[]. */
+static void
+over_row_565 (
+    Uint16         * dst,
+    unsigned const * src,
+    size_t           num_pixels,
+    unsigned         src_amask)
+{
+    size_t i = 0;
+#if CAIROSDL_USE_SSE2
+    i = over_row_565_sse2 (dst, src, num_pixels, src_amask);
+#endif
+    for (; i < num_pixels; i++) {
+        unsigned s = src[i] | src_amask;
+        unsigned a = (s >> ASHIFT) & 255;
+        unsigned d, r, g, b;
+
+        if (s == 0)
+            continue;
+
+        if (a != 255) {
+            d = dst[i];
+            r = (d >> 11) & 31;
+            g = (d >>  5) & 63;
+            b = (d >>  0) & 31;
+            r = (r << 3) | (r >> 2);
+            g = (g << 2) | (g >> 4);
+            b = (b << 3) | (b >> 2);
+            d = (r << RSHIFT) | (g << GSHIFT) | (b << BSHIFT);
+            s += mul_un8x4 (d, 255 - a);
+        }
+
+        dst[i] = (Uint16)(((s >> (RSHIFT + 3 - 11)) & 0xF800) |
+                          ((s >> (GSHIFT + 2 -  5)) & 0x07E0) |
+                          ((s >> (BSHIFT + 3 -  0)) & 0x001F));
+    }
+}
+
+typedef enum {
+    CAIROSDL_DST_XRGB,          /* 32 bit, Amask = 0 */
+    CAIROSDL_DST_ARGB,          /* 32 bit, Amask = 0xFF000000 */
+    CAIROSDL_DST_RGB565         /* 16 bit 5-6-5 */
+} _cairosdl_dst_format_t;
+
+static int
+_cairosdl_classify_dst_format (
+    SDL_PixelFormat const  *format,
+    _cairosdl_dst_format_t *OUT_format)
+{
+    if (format->BytesPerPixel == 4 &&
+        format->Rmask == CAIROSDL_RMASK &&
+        format->Gmask == CAIROSDL_GMASK &&
+        format->Bmask == CAIROSDL_BMASK)
+    {
+        if (format->Amask == 0) {
+            *OUT_format = CAIROSDL_DST_XRGB;
+            return 1;
+        }
+        if (format->Amask == CAIROSDL_AMASK) {
+            *OUT_format = CAIROSDL_DST_ARGB;
+            return 1;
+        }
+        return 0;
+    }
+    if (format->BytesPerPixel == 2 &&
+        format->Rmask == 0xF800 &&
+        format->Gmask == 0x07E0 &&
+        format->Bmask == 0x001F)
+    {
+        *OUT_format = CAIROSDL_DST_RGB565;
+        return 1;
+    }
+    return 0;
+}
+
+int
+cairosdl_blit_image (
+    cairo_surface_t *image,
+    SDL_Rect const  *src_rect,
+    SDL_Surface     *dst,
+    SDL_Rect        *dst_rect)
+{
+    _cairosdl_dst_format_t dst_format;
+    cairosdl_sprite_t sprite;
+    SDL_Rect const *clip = &dst->clip_rect;
+    unsigned char const *source_bytes;
+    unsigned char *target_bytes;
+    size_t source_stride, target_stride;
+    unsigned src_amask;
+    int bpp, row;
+
+    if (!_cairosdl_is_pixel_image (image)) {
+        SDL_SetError ("cairosdl_blit_image: source is not an "
+                      "ARGB32 or RGB24 image surface");
+        return -1;
+    }
+    if (!_cairosdl_classify_dst_format (dst->format, &dst_format)) {
+        SDL_SetError ("cairosdl_blit_image: unsupported destination "
+                      "pixel format");
+        return -1;
+    }
+
+    sprite.source = image;
+    if (src_rect) {
+        sprite.src_x = src_rect->x;
+        sprite.src_y = src_rect->y;
+        sprite.width = src_rect->w;
+        sprite.height = src_rect->h;
+    }
+    else {
+        sprite.src_x = sprite.src_y = 0;
+        sprite.width = cairo_image_surface_get_width (image);
+        sprite.height = cairo_image_surface_get_height (image);
+    }
+    sprite.dst_x = dst_rect ? dst_rect->x : 0;
+    sprite.dst_y = dst_rect ? dst_rect->y : 0;
+    sprite.opacity = 1.0;
+    sprite.spans = NULL;
+
+    /* Clip to the destination's clip rectangle by working relative
+     * to it. */
+    sprite.dst_x -= clip->x;
+    sprite.dst_y -= clip->y;
+    if (!_cairosdl_clip_sprite (&sprite, clip->w, clip->h)) {
+        if (dst_rect)
+            dst_rect->w = dst_rect->h = 0;
+        return 0;
+    }
+    sprite.dst_x += clip->x;
+    sprite.dst_y += clip->y;
+
+    cairo_surface_flush (image);
+    source_stride = cairo_image_surface_get_stride (image);
+    source_bytes = cairo_image_surface_get_data (image) +
+        source_stride*sprite.src_y + 4*sprite.src_x;
+    src_amask =
+        cairo_image_surface_get_format (image) == CAIRO_FORMAT_RGB24
+        ? AMASK : 0;
+
+    bpp = dst->format->BytesPerPixel;
+    target_stride = dst->pitch;
+    target_bytes = (unsigned char *)dst->pixels +
+        target_stride*sprite.dst_y + bpp*sprite.dst_x;
+
+    for (row = 0; row < sprite.height; row++) {
+        switch (dst_format) {
+        case CAIROSDL_DST_XRGB:
+            over_row ((unsigned *)target_bytes,
+                      (unsigned const *)source_bytes,
+                      sprite.width, 255, src_amask);
+            break;
+        case CAIROSDL_DST_ARGB:
+            over_row_unpremultiplied ((unsigned *)target_bytes,
+                                      (unsigned const *)source_bytes,
+                                      sprite.width, src_amask);
+            break;
+        case CAIROSDL_DST_RGB565:
+            over_row_565 ((Uint16 *)target_bytes,
+                          (unsigned const *)source_bytes,
+                          sprite.width, src_amask);
+            break;
+        }
+        target_bytes += target_stride;
+        source_bytes += source_stride;
+    }
+
+    if (dst_rect) {
+        dst_rect->x = sprite.dst_x;
+        dst_rect->y = sprite.dst_y;
+        dst_rect->w = sprite.width;
+        dst_rect->h = sprite.height;
+    }
+    return 0;
+}
+
+/*
+ * Layers
+ */
+
+struct _cairosdl_layer {
+    cairosdl_layers_t   *layers;
+    cairosdl_layer_t    *next;          /* the layer above */
+    cairo_surface_t     *image;
+    cairosdl_draw_func_t draw;
+    void                *closure;
+    double               opacity;
+    cairo_region_t      *invalid;       /* to be redrawn */
+};
+
+struct _cairosdl_layers {
+    int width, height;
+    cairosdl_layer_t *bottom;
+    cairosdl_layer_t *top;
+
+    /* To be composited into the target at the next update, on top of
+     * the invalid regions of the layers. */
+    cairo_region_t *damage;
+};
+
+cairosdl_layers_t *
+cairosdl_layers_create (int width, int height)
+{
+    cairosdl_layers_t *layers =
+        (cairosdl_layers_t *)calloc (1, sizeof (cairosdl_layers_t));
+    cairo_rectangle_int_t all;
+
+    if (layers == NULL)
+        return NULL;
+
+    all.x = all.y = 0;
+    all.width = width;
+    all.height = height;
+    layers->width = width;
+    layers->height = height;
+    layers->damage = cairo_region_create_rectangle (&all);
+    if (cairo_region_status (layers->damage) != CAIRO_STATUS_SUCCESS) {
+        cairo_region_destroy (layers->damage);
+        free (layers);
+        return NULL;
+    }
+    return layers;
+}
+
+void
+cairosdl_layers_destroy (cairosdl_layers_t *layers)
+{
+    cairosdl_layer_t *layer;
+
+    if (layers == NULL)
+        return;
+
+    layer = layers->bottom;
+    while (layer) {
+        cairosdl_layer_t *next = layer->next;
+        cairo_surface_destroy (layer->image);
+        cairo_region_destroy (layer->invalid);
+        free (layer);
+        layer = next;
+    }
+    cairo_region_destroy (layers->damage);
+    free (layers);
+}
+
+cairosdl_layer_t *
+cairosdl_layers_add (
+    cairosdl_layers_t   *layers,
+    cairosdl_draw_func_t draw,
+    void                *closure)
+{
+    cairosdl_layer_t *layer =
+        (cairosdl_layer_t *)calloc (1, sizeof (cairosdl_layer_t));
+    cairo_rectangle_int_t all;
+
+    if (layer == NULL)
+        return NULL;
+
+    all.x = all.y = 0;
+    all.width = layers->width;
+    all.height = layers->height;
+    layer->layers = layers;
+    layer->image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                               layers->width,
+                                               layers->height);
+    layer->draw = draw;
+    layer->closure = closure;
+    layer->opacity = 1.0;
+    layer->invalid = cairo_region_create_rectangle (&all);
+
+    if (cairo_surface_status (layer->image) != CAIRO_STATUS_SUCCESS ||
+        cairo_region_status (layer->invalid) != CAIRO_STATUS_SUCCESS)
+    {
+        cairo_surface_destroy (layer->image);
+        cairo_region_destroy (layer->invalid);
+        free (layer);
+        return NULL;
+    }
+
+    if (layers->top)
+        layers->top->next = layer;
+    else
+        layers->bottom = layer;
+    layers->top = layer;
+    return layer;
+}
+
+void
+cairosdl_layers_mark_dirty (cairosdl_layers_t *layers)
+{
+    cairo_rectangle_int_t all;
+    all.x = all.y = 0;
+    all.width = layers->width;
+    all.height = layers->height;
+    cairo_region_union_rectangle (layers->damage, &all);
+}
+
+void
+cairosdl_layer_invalidate (cairosdl_layer_t *layer)
+{
+    cairosdl_layer_invalidate_rect (layer, 0, 0,
+                                    layer->layers->width,
+                                    layer->layers->height);
+}
+
+void
+cairosdl_layer_invalidate_rect (
+    cairosdl_layer_t *layer,
+    int               x,
+    int               y,
+    int               width,
+    int               height)
+{
+    cairo_rectangle_int_t rect;
+    rect.x = x;
+    rect.y = y;
+    rect.width = width;
+    rect.height = height;
+    cairo_region_union_rectangle (layer->invalid, &rect);
+}
+
+void
+cairosdl_layer_set_opacity (cairosdl_layer_t *layer, double opacity)
+{
+    if (opacity < 0.0)
+        opacity = 0.0;
+    if (opacity > 1.0)
+        opacity = 1.0;
+    if (opacity == layer->opacity)
+        return;
+    layer->opacity = opacity;
+    cairosdl_layers_mark_dirty (layer->layers);
+}
+
+/* Clear the invalid region of the layer and call its draw function
+ * clipped to it. */
+static cairo_status_t
+_cairosdl_layer_redraw (cairosdl_layer_t *layer)
+{
+    cairo_t *cr = cairo_create (layer->image);
+    cairo_status_t status;
+    int i, n = cairo_region_num_rectangles (layer->invalid);
+
+    for (i = 0; i < n; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle (layer->invalid, i, &rect);
+        cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
+    }
+    cairo_clip (cr);
+
+    cairo_save (cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+    cairo_paint (cr);
+    cairo_restore (cr);
+
+    if (layer->draw)
+        layer->draw (cr, layer->closure);
+
+    status = cairo_status (cr);
+    cairo_destroy (cr);
+    return status;
+}
+
+/* Clear the region of the target and composite the layers over it
+ * bottom to top. */
+static int
+_cairosdl_layers_composite (
+    cairosdl_layers_t *layers,
+    cairo_surface_t   *target,
+    cairo_region_t    *region)
+{
+    int num_rects = cairo_region_num_rectangles (region);
+    int num_layers = 0;
+    cairosdl_sprite_t *sprites;
+    cairosdl_layer_t *layer;
+    cairo_t *cr;
+    int i, n = 0;
+
+    for (layer = layers->bottom; layer; layer = layer->next)
+        num_layers++;
+
+    if (num_layers > 0) {
+        sprites = (cairosdl_sprite_t *)malloc (
+            (size_t)num_rects * num_layers * sizeof (cairosdl_sprite_t));
+        if (sprites == NULL)
+            return -1;
+    }
+    else {
+        sprites = NULL;
+    }
+
+    cr = cairo_create (target);
+    cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
+    for (i = 0; i < num_rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle (region, i, &rect);
+        cairo_rectangle (cr, rect.x, rect.y, rect.width, rect.height);
+
+        /* The rectangles of a region don't overlap, so the sprites
+         * can go rectangle by rectangle. */
+        for (layer = layers->bottom; layer; layer = layer->next) {
+            cairosdl_sprite_t *sprite = sprites + n++;
+            sprite->source = layer->image;
+            sprite->src_x = sprite->dst_x = rect.x;
+            sprite->src_y = sprite->dst_y = rect.y;
+            sprite->width = rect.width;
+            sprite->height = rect.height;
+            sprite->opacity = layer->opacity;
+            sprite->spans = NULL;
+        }
+    }
+    cairo_fill (cr);
+    cairo_destroy (cr);
+
+    cairosdl_composite_sprites (target, n, sprites);
+    free (sprites);
+    return 0;
+}
+
+int
+cairosdl_layers_update (
+    cairosdl_layers_t *layers,
+    cairo_surface_t   *target,
+    int                max_rects,
+    SDL_Rect          *rects)
+{
+    cairo_rectangle_int_t all;
+    cairosdl_layer_t *layer;
+    int i, num_rects;
+
+    for (layer = layers->bottom; layer; layer = layer->next) {
+        if (cairo_region_is_empty (layer->invalid))
+            continue;
+        if (_cairosdl_layer_redraw (layer) != CAIRO_STATUS_SUCCESS)
+            return -1;
+        cairo_region_union (layers->damage, layer->invalid);
+        cairo_region_destroy (layer->invalid);
+        layer->invalid = cairo_region_create ();
+    }
+
+    all.x = all.y = 0;
+    all.width = layers->width;
+    all.height = layers->height;
+    cairo_region_intersect_rectangle (layers->damage, &all);
+    if (cairo_region_status (layers->damage) != CAIRO_STATUS_SUCCESS)
+        return -1;
+    if (cairo_region_is_empty (layers->damage))
+        return 0;
+
+    if (_cairosdl_layers_composite (layers, target, layers->damage) < 0)
+        return -1;
+
+    num_rects = cairo_region_num_rectangles (layers->damage);
+    for (i = 0; i < num_rects; i++) {
+        cairo_rectangle_int_t rect;
+        cairo_region_get_rectangle (layers->damage, i, &rect);
+        if (cairosdl_surface_get_target (target) != NULL) {
+            cairosdl_surface_flush_rect (target, rect.x, rect.y,
+                                         rect.width, rect.height);
+        }
+        if (num_rects <= max_rects) {
+            rects[i].x = rect.x;
+            rects[i].y = rect.y;
+            rects[i].w = rect.width;
+            rects[i].h = rect.height;
+        }
+    }
+    if (num_rects > max_rects) {
+        num_rects = 0;
+        if (max_rects > 0) {
+            cairo_region_get_extents (layers->damage, &all);
+            rects[0].x = all.x;
+            rects[0].y = all.y;
+            rects[0].w = all.width;
+            rects[0].h = all.height;
+            num_rects = 1;
+        }
+    }
+
+    cairo_region_destroy (layers->damage);
+    layers->damage = cairo_region_create ();
+    return num_rects;
+}
+
+/*
+ * Cached source patterns
+ */
+
+/* A premultiplied copy of an ARGB SDL_Surface.  Snapshots are kept in
+ * a hash table keyed by the SDL_Surface and on a list from most to
+ * least recently used, and the least recently used are dropped when
+ * they take more than the cache's maximum size. */
+typedef struct _cairosdl_snapshot _cairosdl_snapshot_t;
+
+struct _cairosdl_snapshot {
+    SDL_Surface *sdl_surface;   /* referenced */
+    unsigned generation;
+    void *pixels;               /* of the SDL_Surface when copied */
+    int pitch;
+    cairo_surface_t *image;
+    size_t size;
+    _cairosdl_snapshot_t *hash_next;
+    _cairosdl_snapshot_t *newer, *older;
+};
+
+#define CAIROSDL_SNAPSHOT_BUCKETS 256
+
+static struct {
+    size_t size;
+    _cairosdl_snapshot_t *newest, *oldest;
+    _cairosdl_snapshot_t *buckets[CAIROSDL_SNAPSHOT_BUCKETS];
+} _cairosdl_snapshots;
+
+static size_t _cairosdl_snapshots_max_size =
+    CAIROSDL_DEFAULT_PATTERN_CACHE_SIZE;
+
+static _cairosdl_snapshot_t **
+_cairosdl_snapshot_bucket (SDL_Surface *sdl_surface)
+{
+    size_t hash = (size_t)sdl_surface;
+    hash ^= hash >> 12;
+    return &_cairosdl_snapshots.buckets[
+        (hash >> 4) & (CAIROSDL_SNAPSHOT_BUCKETS - 1)];
+}
+
+static void
+_cairosdl_snapshot_unlink (_cairosdl_snapshot_t *snapshot)
+{
+    if (snapshot->newer)
+        snapshot->newer->older = snapshot->older;
+    else
+        _cairosdl_snapshots.newest = snapshot->older;
+    if (snapshot->older)
+        snapshot->older->newer = snapshot->newer;
+    else
+        _cairosdl_snapshots.oldest = snapshot->newer;
+    snapshot->newer = snapshot->older = NULL;
+}
+
+static void
+_cairosdl_snapshot_link_newest (_cairosdl_snapshot_t *snapshot)
+{
+    snapshot->older = _cairosdl_snapshots.newest;
+    snapshot->newer = NULL;
+    if (_cairosdl_snapshots.newest)
+        _cairosdl_snapshots.newest->newer = snapshot;
+    else
+        _cairosdl_snapshots.oldest = snapshot;
+    _cairosdl_snapshots.newest = snapshot;
+}
+
+static void
+_cairosdl_snapshot_destroy (_cairosdl_snapshot_t *snapshot)
+{
+    _cairosdl_snapshot_t **link =
+        _cairosdl_snapshot_bucket (snapshot->sdl_surface);
+
+    while (*link != snapshot)
+        link = &(*link)->hash_next;
+    *link = snapshot->hash_next;
+    _cairosdl_snapshot_unlink (snapshot);
+
+    _cairosdl_snapshots.size -= snapshot->size;
+    cairo_surface_destroy (snapshot->image);
+    SDL_FreeSurface (snapshot->sdl_surface);
+    free (snapshot);
+}
+
+/* Drop the least recently used snapshots until the cache fits, but
+ * keep the given one. */
+static void
+_cairosdl_snapshots_trim (_cairosdl_snapshot_t const *keep)
+{
+    while (_cairosdl_snapshots.size > _cairosdl_snapshots_max_size &&
+           _cairosdl_snapshots.oldest != NULL &&
+           _cairosdl_snapshots.oldest != keep)
+    {
+        _cairosdl_snapshot_destroy (_cairosdl_snapshots.oldest);
+    }
+}
+
+/* Copies the SDL_Surface premultiplied into the image, reusing the
+ * image if nobody else holds it and it's the right size.  Returns a
+ * new reference to the image. */
+static cairo_surface_t *
+_cairosdl_snapshot_copy (SDL_Surface     *sdl_surface,
+                         cairo_surface_t *image)
+{
+    if (image == NULL ||
+        cairo_surface_get_reference_count (image) != 1 ||
+        cairo_image_surface_get_width (image) != sdl_surface->w ||
+        cairo_image_surface_get_height (image) != sdl_surface->h)
+    {
+        image = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                            sdl_surface->w,
+                                            sdl_surface->h);
+        if (cairo_surface_status (image) != CAIRO_STATUS_SUCCESS)
+            return image;
+    }
+    else {
+        cairo_surface_reference (image);
+    }
+
+    cairo_surface_flush (image);
+    _cairosdl_blit_and_premultiply (cairo_image_surface_get_data (image),
+                                    cairo_image_surface_get_stride (image),
+                                    sdl_surface->pixels,
+                                    sdl_surface->pitch,
+                                    sdl_surface->w,
+                                    sdl_surface->h);
+    cairo_surface_mark_dirty (image);
+    return image;
+}
+
+cairo_pattern_t *
+cairosdl_pattern_create_for_sdl_surface (
+    SDL_Surface *sdl_surface,
+    unsigned     generation)
+{
+    _cairosdl_snapshot_t **bucket;
+    _cairosdl_snapshot_t *snapshot;
+    cairo_surface_t *image;
+    cairo_pattern_t *pattern;
+    cairo_format_t format;
+
+    if (!_cairosdl_format_for_sdl_surface (sdl_surface, &format) ||
+        format == CAIRO_FORMAT_RGB24)
+    {
+        /* RGB24 surfaces are used in place and need no snapshot, and
+         * unsupported ones give an error surface. */
+        image = cairosdl_surface_create (sdl_surface);
+        pattern = cairo_pattern_create_for_surface (image);
+        cairo_surface_destroy (image);
+        return pattern;
+    }
+
+    bucket = _cairosdl_snapshot_bucket (sdl_surface);
+    for (snapshot = *bucket; snapshot; snapshot = snapshot->hash_next) {
+        if (snapshot->sdl_surface == sdl_surface)
+            break;
+    }
+
+    if (snapshot != NULL) {
+        if (snapshot->generation != generation ||
+            snapshot->pixels != sdl_surface->pixels ||
+            snapshot->pitch != sdl_surface->pitch ||
+            cairo_image_surface_get_width (snapshot->image) !=
+            sdl_surface->w ||
+            cairo_image_surface_get_height (snapshot->image) !=
+            sdl_surface->h)
+        {
+            image = _cairosdl_snapshot_copy (sdl_surface, snapshot->image);
+            if (cairo_surface_status (image) != CAIRO_STATUS_SUCCESS) {
+                _cairosdl_snapshot_destroy (snapshot);
+                pattern = cairo_pattern_create_for_surface (image);
+                cairo_surface_destroy (image);
+                return pattern;
+            }
+            cairo_surface_destroy (snapshot->image);
+            snapshot->image = image;
+            snapshot->generation = generation;
+            snapshot->pixels = sdl_surface->pixels;
+            snapshot->pitch = sdl_surface->pitch;
+            _cairosdl_snapshots.size -= snapshot->size;
+            snapshot->size = (size_t)cairo_image_surface_get_stride (image) *
+                sdl_surface->h;
+            _cairosdl_snapshots.size += snapshot->size;
+        }
+        _cairosdl_snapshot_unlink (snapshot);
+        _cairosdl_snapshot_link_newest (snapshot);
+        _cairosdl_snapshots_trim (snapshot);
+        return cairo_pattern_create_for_surface (snapshot->image);
+    }
+
+    image = _cairosdl_snapshot_copy (sdl_surface, NULL);
+    pattern = cairo_pattern_create_for_surface (image);
+    if (cairo_surface_status (image) != CAIRO_STATUS_SUCCESS ||
+        (size_t)cairo_image_surface_get_stride (image) * sdl_surface->h >
+        _cairosdl_snapshots_max_size)
+    {
+        /* Too big to cache. */
+        cairo_surface_destroy (image);
+        return pattern;
+    }
+
+    snapshot = (_cairosdl_snapshot_t *)calloc (1, sizeof (*snapshot));
+    if (snapshot == NULL) {
+        cairo_surface_destroy (image);
+        return pattern;
+    }
+    sdl_surface->refcount++;
+    snapshot->sdl_surface = sdl_surface;
+    snapshot->generation = generation;
+    snapshot->pixels = sdl_surface->pixels;
+    snapshot->pitch = sdl_surface->pitch;
+    snapshot->image = image;
+    snapshot->size = (size_t)cairo_image_surface_get_stride (image) *
+        sdl_surface->h;
+    snapshot->hash_next = *bucket;
+    *bucket = snapshot;
+    _cairosdl_snapshot_link_newest (snapshot);
+    _cairosdl_snapshots.size += snapshot->size;
+    _cairosdl_snapshots_trim (snapshot);
+    return pattern;
+}
+
+void
+cairosdl_pattern_cache_set_max_size (size_t max_size)
+{
+    _cairosdl_snapshots_max_size = max_size;
+    _cairosdl_snapshots_trim (NULL);
+}
+
+size_t
+cairosdl_pattern_cache_get_size (void)
+{
+    return _cairosdl_snapshots.size;
+}
+
+void
+cairosdl_pattern_cache_remove (SDL_Surface *sdl_surface)
+{
+    _cairosdl_snapshot_t *snapshot;
+
+    for (snapshot = *_cairosdl_snapshot_bucket (sdl_surface);
+         snapshot;
+         snapshot = snapshot->hash_next)
+    {
+        if (snapshot->sdl_surface == sdl_surface) {
+            _cairosdl_snapshot_destroy (snapshot);
+            return;
+        }
+    }
+}
+
+/*
+ * Tiled canvases
+ */
+
+typedef struct _cairosdl_canvas_tile _cairosdl_canvas_tile_t;
+
+struct _cairosdl_canvas_tile {
+    int column, row;
+    cairo_surface_t *image;     /* device offset to its place */
+    int dirty;                  /* drawn into since stored */
+    _cairosdl_canvas_tile_t *hash_next;
+    _cairosdl_canvas_tile_t *newer, *older;
+};
+
+struct _cairosdl_canvas {
+    int width, height;
+    int tile_size;
+    int max_resident;           /* INT_MAX without a store function */
+    int num_resident;
+    cairosdl_canvas_tile_func_t store;
+    cairosdl_canvas_tile_func_t load;
+    void *closure;
+
+    unsigned char *scratch;     /* a tile of SDL pixels for store/load */
+
+    _cairosdl_canvas_tile_t **buckets;
+    unsigned bucket_mask;
+    _cairosdl_canvas_tile_t *newest, *oldest;
+};
+
+typedef struct {
+    cairo_surface_t *image;
+    int x, y, width, height;    /* clip in canvas pixels */
+    cairosdl_draw_func_t draw;
+    void *closure;
+    cairo_status_t status;
+} _cairosdl_canvas_job_t;
+
+static _cairosdl_canvas_tile_t **
+_cairosdl_canvas_bucket (cairosdl_canvas_t *canvas, int column, int row)
+{
+    unsigned hash = (unsigned)column * 73856093U ^ (unsigned)row * 19349663U;
+    return &canvas->buckets[hash & canvas->bucket_mask];
+}
+
+static void
+_cairosdl_canvas_unlink (cairosdl_canvas_t       *canvas,
+                         _cairosdl_canvas_tile_t *tile)
+{
+    if (tile->newer)
+        tile->newer->older = tile->older;
+    else
+        canvas->newest = tile->older;
+    if (tile->older)
+        tile->older->newer = tile->newer;
+    else
+        canvas->oldest = tile->newer;
+    tile->newer = tile->older = NULL;
+}
+
+static void
+_cairosdl_canvas_link_newest (cairosdl_canvas_t       *canvas,
+                              _cairosdl_canvas_tile_t *tile)
+{
+    tile->older = canvas->newest;
+    tile->newer = NULL;
+    if (canvas->newest)
+        canvas->newest->newer = tile;
+    else
+        canvas->oldest = tile;
+    canvas->newest = tile;
+}
+
+/* Wraps the scratch buffer in an SDL_Surface the size of the tile. */
+static SDL_Surface *
+_cairosdl_canvas_scratch_surface (cairosdl_canvas_t       *canvas,
+                                  _cairosdl_canvas_tile_t *tile)
+{
+    return SDL_CreateRGBSurfaceFrom (
+        canvas->scratch,
+        cairo_image_surface_get_width (tile->image),
+        cairo_image_surface_get_height (tile->image),
+        32, 4*canvas->tile_size,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, CAIROSDL_AMASK);
+}
+
+static int
+_cairosdl_canvas_store_tile (cairosdl_canvas_t       *canvas,
+                             _cairosdl_canvas_tile_t *tile)
+{
+    SDL_Surface *sdl_surface;
+    int status;
+
+    if (!tile->dirty || canvas->store == NULL)
+        return 0;
+
+    sdl_surface = _cairosdl_canvas_scratch_surface (canvas, tile);
+    if (sdl_surface == NULL)
+        return -1;
+    cairo_surface_flush (tile->image);
+    _cairosdl_blit_and_unpremultiply (
+        sdl_surface->pixels, sdl_surface->pitch,
+        cairo_image_surface_get_data (tile->image),
+        cairo_image_surface_get_stride (tile->image),
+        sdl_surface->w, sdl_surface->h);
+    status = canvas->store (sdl_surface, tile->column, tile->row,
+                            canvas->closure);
+    SDL_FreeSurface (sdl_surface);
+    if (status != 0)
+        return -1;
+    tile->dirty = 0;
+    return 0;
+}
+
+static int
+_cairosdl_canvas_load_tile (cairosdl_canvas_t       *canvas,
+                            _cairosdl_canvas_tile_t *tile)
+{
+    SDL_Surface *sdl_surface;
+    int status;
+
+    if (canvas->load == NULL)
+        return 0;
+
+    sdl_surface = _cairosdl_canvas_scratch_surface (canvas, tile);
+    if (sdl_surface == NULL)
+        return -1;
+    status = canvas->load (sdl_surface, tile->column, tile->row,
+                           canvas->closure);
+    if (status > 0) {
+        _cairosdl_blit_and_premultiply (
+            cairo_image_surface_get_data (tile->image),
+            cairo_image_surface_get_stride (tile->image),
+            sdl_surface->pixels, sdl_surface->pitch,
+            sdl_surface->w, sdl_surface->h);
+        cairo_surface_mark_dirty (tile->image);
+    }
+    SDL_FreeSurface (sdl_surface);
+    return status < 0 ? -1 : 0;
+}
+
+/* Drops a tile after storing it.  Returns -1 and keeps it if it
+ * couldn't be stored. */
+static int
+_cairosdl_canvas_evict (cairosdl_canvas_t       *canvas,
+                        _cairosdl_canvas_tile_t *tile)
+{
+    _cairosdl_canvas_tile_t **link;
+
+    if (_cairosdl_canvas_store_tile (canvas, tile) != 0)
+        return -1;
+
+    link = _cairosdl_canvas_bucket (canvas, tile->column, tile->row);
+    while (*link != tile)
+        link = &(*link)->hash_next;
+    *link = tile->hash_next;
+    _cairosdl_canvas_unlink (canvas, tile);
+    canvas->num_resident--;
+
+    cairo_surface_destroy (tile->image);
+    free (tile);
+    return 0;
+}
+
+/* Finds or makes the tile resident and makes it the most recently
+ * used, evicting the least recently used tile if there are too many.
+ * Returns NULL with the reason in OUT_status on failure. */
+static _cairosdl_canvas_tile_t *
+_cairosdl_canvas_get (cairosdl_canvas_t *canvas,
+                      int                column,
+                      int                row,
+                      cairo_status_t    *OUT_status)
+{
+    _cairosdl_canvas_tile_t **bucket =
+        _cairosdl_canvas_bucket (canvas, column, row);
+    _cairosdl_canvas_tile_t *tile;
+    int x = column * canvas->tile_size;
+    int y = row * canvas->tile_size;
+
+    for (tile = *bucket; tile; tile = tile->hash_next) {
+        if (tile->column == column && tile->row == row) {
+            _cairosdl_canvas_unlink (canvas, tile);
+            _cairosdl_canvas_link_newest (canvas, tile);
+            return tile;
+        }
+    }
+
+    if (canvas->num_resident >= canvas->max_resident &&
+        _cairosdl_canvas_evict (canvas, canvas->oldest) != 0)
+    {
+        *OUT_status = CAIRO_STATUS_WRITE_ERROR;
+        return NULL;
+    }
+
+    tile = (_cairosdl_canvas_tile_t *)calloc (1, sizeof (*tile));
+    if (tile == NULL) {
+        *OUT_status = CAIRO_STATUS_NO_MEMORY;
+        return NULL;
+    }
+    tile->column = column;
+    tile->row = row;
+    tile->image = cairo_image_surface_create (
+        CAIRO_FORMAT_ARGB32,
+        canvas->width - x < canvas->tile_size ? canvas->width - x
+                                              : canvas->tile_size,
+        canvas->height - y < canvas->tile_size ? canvas->height - y
+                                               : canvas->tile_size);
+    *OUT_status = cairo_surface_status (tile->image);
+    if (*OUT_status == CAIRO_STATUS_SUCCESS &&
+        _cairosdl_canvas_load_tile (canvas, tile) != 0)
+    {
+        *OUT_status = CAIRO_STATUS_READ_ERROR;
+    }
+    if (*OUT_status != CAIRO_STATUS_SUCCESS) {
+        cairo_surface_destroy (tile->image);
+        free (tile);
+        return NULL;
+    }
+    cairo_surface_set_device_offset (tile->image, -x, -y);
+
+    tile->hash_next = *bucket;
+    *bucket = tile;
+    _cairosdl_canvas_link_newest (canvas, tile);
+    canvas->num_resident++;
+    return tile;
+}
+
+cairosdl_canvas_t *
+cairosdl_canvas_create (
+    int                         width,
+    int                         height,
+    int                         tile_size,
+    int                         max_resident_tiles,
+    cairosdl_canvas_tile_func_t store,
+    cairosdl_canvas_tile_func_t load,
+    void                       *closure)
+{
+    cairosdl_canvas_t *canvas;
+    unsigned num_buckets = 64;
+
+    if (width <= 0 || height <= 0 ||
+        tile_size <= 0 || tile_size > 32767 ||
+        max_resident_tiles <= 0)
+    {
+        SDL_SetError ("cairosdl_canvas_create: invalid size");
+        return NULL;
+    }
+
+    canvas = (cairosdl_canvas_t *)calloc (1, sizeof (*canvas));
+    if (canvas == NULL) {
+        SDL_OutOfMemory ();
+        return NULL;
+    }
+    canvas->width = width;
+    canvas->height = height;
+    canvas->tile_size = tile_size;
+    canvas->max_resident = store ? max_resident_tiles : INT_MAX;
+    canvas->store = store;
+    canvas->load = load;
+    canvas->closure = closure;
+
+    while (num_buckets < 65536 && (int)num_buckets < max_resident_tiles)
+        num_buckets *= 2;
+    canvas->bucket_mask = num_buckets - 1;
+    canvas->buckets = (_cairosdl_canvas_tile_t **)
+        calloc (num_buckets, sizeof (*canvas->buckets));
+    if (store || load) {
+        canvas->scratch = (unsigned char *)
+            malloc ((size_t)4 * tile_size * tile_size);
+    }
+    if (canvas->buckets == NULL ||
+        ((store || load) && canvas->scratch == NULL))
+    {
+        SDL_OutOfMemory ();
+        cairosdl_canvas_destroy (canvas);
+        return NULL;
+    }
+    return canvas;
+}
+
+void
+cairosdl_canvas_destroy (cairosdl_canvas_t *canvas)
+{
+    if (canvas == NULL)
+        return;
+
+    while (canvas->oldest) {
+        _cairosdl_canvas_tile_t *tile = canvas->oldest;
+        _cairosdl_canvas_unlink (canvas, tile);
+        cairo_surface_destroy (tile->image);
+        free (tile);
+    }
+    free (canvas->buckets);
+    free (canvas->scratch);
+    free (canvas);
+}
+
+static void
+_cairosdl_canvas_draw_tile (void *param)
+{
+    _cairosdl_canvas_job_t *job = (_cairosdl_canvas_job_t *)param;
+    cairo_t *cr = cairo_create (job->image);
+
+    cairo_rectangle (cr, job->x, job->y, job->width, job->height);
+    cairo_clip (cr);
+    job->draw (cr, job->closure);
+    job->status = cairo_status (cr);
+    cairo_destroy (cr);
+}
+
+cairo_status_t
+cairosdl_canvas_draw (
+    cairosdl_canvas_t   *canvas,
+    int                  x,
+    int                  y,
+    int                  width,
+    int                  height,
+    cairosdl_draw_func_t draw,
+    void                *closure)
+{
+    _cairosdl_canvas_job_t *jobs;
+    cairo_status_t status = CAIRO_STATUS_SUCCESS;
+    int column0, column1, row0, row1;
+    int ts = canvas->tile_size;
+    int max_jobs, num_jobs;
+    int column, row, i;
+
+    /* Clip to the canvas without overflowing. */
+    if (x < 0) { width = width + x < 0 ? 0 : width + x; x = 0; }
+    if (y < 0) { height = height + y < 0 ? 0 : height + y; y = 0; }
+    if (x >= canvas->width || y >= canvas->height ||
+        width <= 0 || height <= 0)
+        return CAIRO_STATUS_SUCCESS;
+    if (width > canvas->width - x) width = canvas->width - x;
+    if (height > canvas->height - y) height = canvas->height - y;
+
+    column0 = x / canvas->tile_size;
+    column1 = (x + width - 1) / canvas->tile_size;
+    row0 = y / canvas->tile_size;
+    row1 = (y + height - 1) / canvas->tile_size;
+
+    /* Draw as many tiles at a time as can be resident together. */
+    max_jobs = 64 * cairosdl_get_num_threads ();
+    if (max_jobs > canvas->max_resident)
+        max_jobs = canvas->max_resident;
+    jobs = (_cairosdl_canvas_job_t *)malloc (max_jobs * sizeof (*jobs));
+    if (jobs == NULL)
+        return CAIRO_STATUS_NO_MEMORY;
+
+    num_jobs = 0;
+    for (row = row0; row <= row1 && status == CAIRO_STATUS_SUCCESS; row++) {
+        for (column = column0;
+             column <= column1 && status == CAIRO_STATUS_SUCCESS;
+             column++)
+        {
+            _cairosdl_canvas_tile_t *tile =
+                _cairosdl_canvas_get (canvas, column, row, &status);
+            _cairosdl_canvas_job_t *job = jobs + num_jobs++;
+
+            if (tile == NULL) {
+                num_jobs--;
+                break;
+            }
+            /* Clip to the tile too, so that device space stays small
+             * enough for cairo's fixed point coordinates. */
+            tile->dirty = 1;
+            job->image = tile->image;
+            job->x = x > column * ts ? x : column * ts;
+            job->y = y > row * ts ? y : row * ts;
+            job->width = (x - job->x) + width;
+            if (job->width > ts - (job->x - column * ts))
+                job->width = ts - (job->x - column * ts);
+            job->height = (y - job->y) + height;
+            if (job->height > ts - (job->y - row * ts))
+                job->height = ts - (job->y - row * ts);
+            job->draw = draw;
+            job->closure = closure;
+            job->status = CAIRO_STATUS_SUCCESS;
+
+            if (num_jobs == max_jobs ||
+                (row == row1 && column == column1))
+            {
+                _cairosdl_pool_run (_cairosdl_canvas_draw_tile, jobs,
+                                    sizeof (*jobs), num_jobs);
+                for (i = 0; i < num_jobs; i++) {
+                    if (status == CAIRO_STATUS_SUCCESS)
+                        status = jobs[i].status;
+                }
+                num_jobs = 0;
+            }
+        }
+    }
+
+    /* Tiles made resident before a failure are still drawn into. */
+    if (num_jobs > 0) {
+        _cairosdl_pool_run (_cairosdl_canvas_draw_tile, jobs,
+                            sizeof (*jobs), num_jobs);
+    }
+    free (jobs);
+    return status;
+}
+
+int
+cairosdl_canvas_flush (cairosdl_canvas_t *canvas)
+{
+    _cairosdl_canvas_tile_t *tile;
+    int status = 0;
+
+    for (tile = canvas->oldest; tile; tile = tile->newer) {
+        if (_cairosdl_canvas_store_tile (canvas, tile) != 0)
+            status = -1;
+    }
+    return status;
+}
+
+cairo_surface_t *
+cairosdl_canvas_get_tile (
+    cairosdl_canvas_t *canvas,
+    int                column,
+    int                row)
+{
+    _cairosdl_canvas_tile_t *tile;
+    cairo_status_t status;
+
+    if (column < 0 || row < 0 ||
+        column > (canvas->width - 1) / canvas->tile_size ||
+        row > (canvas->height - 1) / canvas->tile_size)
+        return NULL;
+
+    tile = _cairosdl_canvas_get (canvas, column, row, &status);
+    return tile ? tile->image : NULL;
+}
+
+int
+cairosdl_canvas_get_num_resident_tiles (cairosdl_canvas_t *canvas)
+{
+    return canvas->num_resident;
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -36,7 +36,8 @@ extern "C" {
  * the ->pixels member of the SDL_Surface should be valid and not
  * change during the lifetime of the cairo_surface_t representing it,
  * and that malloc and whatever other OS facilities are allowed to be
- * called. */
+ * called.  Surfaces created with CAIROSDL_LOCK_ON_FLUSH below are the
+ * exception. */
 
 /* Create a cairo image surface and bind the SDL_Surface to it.  If
  * the pixel format of the SDL_Surface isn't supported by cairo,
@@ -44,14 +45,74 @@ extern "C" {
 cairo_surface_t *
 cairosdl_surface_create (SDL_Surface *sdl_surface);
 
+/* Flags for cairosdl_surface_create_with_flags(). */
+typedef enum {
+    /* Draw into a shadow image even for Amask=0 surfaces and lock the
+     * SDL_Surface only while flushing to it or marking dirty from it,
+     * rather than for the whole life of the cairo surface.  The
+     * SDL_Surface must then be unlocked when cairosdl is called. */
+    CAIROSDL_LOCK_ON_FLUSH = 1 << 0,
+
+    /* Draw straight into the pixels of per-pixel alpha SDL_Surfaces
+     * instead of a shadow image, for half the memory.  The pixels are
+     * premultiplied while bound.  Flushing unpremultiplies them in
+     * place for SDL, so after a flush call cairosdl_surface_mark_dirty()
+     * on the flushed area before drawing there with cairo again,
+     * unless the drawing covers it completely.  A bit per pixel keeps
+     * track of which are premultiplied, so flushing or marking dirty
+     * twice, or overlapping rectangles, never convert a pixel twice,
+     * and destroying the surface unpremultiplies whatever was marked
+     * dirty and not flushed since.  This can't be combined with
+     * CAIROSDL_LOCK_ON_FLUSH.  Amask=0 surfaces are drawn into
+     * directly anyway. */
+    CAIROSDL_IN_PLACE = 1 << 1
+} cairosdl_surface_flags_t;
+
+/* Like cairosdl_surface_create() with a combination of the flags
+ * above.  No flags is the same as cairosdl_surface_create(). */
+cairo_surface_t *
+cairosdl_surface_create_with_flags (SDL_Surface *sdl_surface,
+                                    unsigned     flags);
+
+/* Returns the total time in seconds that cairosdl has kept the
+ * SDL_Surface locked for a CAIROSDL_LOCK_ON_FLUSH surface, or 0 for
+ * other surfaces. */
+double
+cairosdl_surface_get_lock_time (cairo_surface_t *surface);
+
 /* Returns the SDL_Surface bound to the image surface. */
 SDL_Surface *
 cairosdl_surface_get_target (cairo_surface_t *surface);
 
+typedef enum {
+    CAIROSDL_SCALE_NEAREST,
+    CAIROSDL_SCALE_BILINEAR
+} cairosdl_scale_filter_t;
+
+/* Like cairosdl_surface_create() but the image surface has only scale
+ * times the width and height of the SDL_Surface, for drawing at
+ * reduced resolution.  The image's device scale is set so that user
+ * space is still in SDL_Surface pixels.  Flushing upscales the image
+ * into the SDL_Surface with the given filter and marking dirty
+ * samples the SDL_Surface down into the image.  This applies to
+ * Amask=0 surfaces too.  A scale of 1 or more gives an ordinary
+ * cairosdl surface and a scale of zero or less a surface in an error
+ * state. */
+cairo_surface_t *
+cairosdl_surface_create_scaled (SDL_Surface            *sdl_surface,
+                                double                  scale,
+                                cairosdl_scale_filter_t filter);
+
+/* Returns the scale of a surface from cairosdl_surface_create_scaled()
+ * or 1 for other surfaces. */
+double
+cairosdl_surface_get_scale (cairo_surface_t *surface);
+
 
 /* These functions are noops for Amask=0 surfaces.  For
  * Amask=0xFF000000 surfaces they write the indicated area(s) of the
- * SDL_Surface bound to the surface from a backing buffer. */
+ * SDL_Surface bound to the surface from a backing buffer.  The
+ * rectangles are in SDL_Surface pixels. */
 void
 cairosdl_surface_flush_rects (cairo_surface_t *surface,
                               int              num_rects,
@@ -68,6 +129,45 @@ void
 cairosdl_surface_flush (cairo_surface_t *surface);
 
 
+/* Starts flushing the whole surface on cairosdl's worker threads
+ * and returns a second surface bound to the same SDL_Surface to draw
+ * the next frame into meanwhile.  Flushing that one returns the first
+ * again, and so on.  The second surface is owned by the first and
+ * destroyed with it, so it must not be destroyed by the caller, and
+ * it's only valid while the first is.  Keep a reference to the first
+ * surface, draw into whichever one was returned last and destroy the
+ * first when done; to keep using the second after that, reference it
+ * yourself first.  Destroying the first while a flush is pending
+ * waits for it.  Each surface keeps whatever was last drawn into it.
+ * The SDL_Surface must stay locked and unused until
+ * cairosdl_surface_flush_wait() is called with either surface or the
+ * first is destroyed; any other flush, mark dirty or tiled drawing on
+ * them waits too.  Without worker threads the flush is done
+ * before returning.  Amask=0 surfaces that aren't scaled have
+ * nothing to flush and are returned as they are, and so are
+ * CAIROSDL_IN_PLACE surfaces after flushing. */
+cairo_surface_t *
+cairosdl_surface_flush_async (cairo_surface_t *surface);
+
+/* Waits for a cairosdl_surface_flush_async() of the surface or its
+ * partner to finish. */
+void
+cairosdl_surface_flush_wait (cairo_surface_t *surface);
+
+/* Flushes many surfaces at once on cairosdl's worker threads and
+ * returns when all are done.  Surface i gets num_rects[i] rectangles
+ * rects[i] flushed, or all of it if rects or rects[i] is NULL, when
+ * num_rects may be NULL too.  The work is split into cache sized jobs
+ * going through each surface from top to bottom, with small
+ * rectangles sharing jobs, so that lots of small surfaces cost about
+ * as little as one big one.  No surface may be listed twice. */
+void
+cairosdl_surface_flush_many (int                     num_surfaces,
+                             cairo_surface_t *const *surfaces,
+                             int const              *num_rects,
+                             SDL_Rect const *const  *rects);
+
+
 /* These functions are noops for Amask=0 surfaces.  For
  * Amask=0xFF000000 surfaces they read the indicated area(s) from the
  * SDL_Surface bound to the surface into a backing buffer. */
@@ -103,6 +203,284 @@ void
 cairosdl_destroy (cairo_t *cr);
 
 
+/* Parallel rendering. */
+
+/* Sets the number of threads cairosdl uses for its parallel
+ * functions, counting the calling thread.  Zero, the default, means
+ * one per CPU and one means everything runs on the calling thread.
+ * The worker threads are started on first use. */
+void
+cairosdl_set_num_threads (int num_threads);
+
+int
+cairosdl_get_num_threads (void);
+
+typedef void (*cairosdl_draw_func_t) (cairo_t *cr, void *closure);
+
+/* Splits the surface into tiles and calls draw() once per tile, in
+ * parallel on cairosdl's worker threads, with a fresh context whose
+ * target is a zero-copy view of just that tile.  The context's user
+ * space is that of the whole surface and drawing is clipped to the
+ * tile.  For bound Amask=0xFF000000 surfaces each tile is also
+ * flushed to the SDL_Surface by the thread that drew it.  The draw
+ * function must be safe to call from several threads at once, so it
+ * should only read shared state.  Returns the first error status of
+ * any tile's context. */
+cairo_status_t
+cairosdl_surface_draw_tiled (cairo_surface_t     *surface,
+                             int                  tile_width,
+                             int                  tile_height,
+                             cairosdl_draw_func_t draw,
+                             void                *closure);
+
+
+/* Sprite compositing. */
+
+/* A span encoding of a rectangle of an image.  See
+ * cairosdl_spans_encode(). */
+typedef struct _cairosdl_spans cairosdl_spans_t;
+
+/* A sprite is a rectangle of a source image surface placed at an
+ * integer offset in the target. */
+typedef struct _cairosdl_sprite {
+    cairo_surface_t *source;    /* ARGB32 or RGB24 image surface */
+    int              src_x;
+    int              src_y;
+    int              width;
+    int              height;
+    int              dst_x;
+    int              dst_y;
+    double           opacity;   /* 0.0 to 1.0 */
+
+    /* Optional span encoding of exactly the source rectangle above,
+     * or NULL.  It lets the compositor skip clear pixels and copy
+     * solid ones. */
+    cairosdl_spans_t const *spans;
+} cairosdl_sprite_t;
+
+/* Composites the sprites in order onto the target surface using
+ * CAIRO_OPERATOR_OVER, as if by a cairo_set_source_surface() +
+ * cairo_rectangle() + cairo_clip() + cairo_paint_with_alpha() per
+ * sprite.  When the sources and the target are ARGB32 or RGB24 image
+ * surfaces (such as ones from cairosdl_surface_create()) this skips
+ * cairo's pattern and path machinery and uses a specialised integer
+ * translation loop.  Any clip set on a context drawing to the target
+ * is ignored.  Other surfaces fall back to plain cairo calls. */
+void
+cairosdl_composite_sprites (cairo_surface_t         *target,
+                            int                      num_sprites,
+                            cairosdl_sprite_t const *sprites);
+
+
+/* Create and destroy a span encoding.  The encoding's storage is
+ * reused by subsequent calls to cairosdl_spans_encode(). */
+cairosdl_spans_t *
+cairosdl_spans_create (void);
+
+void
+cairosdl_spans_destroy (cairosdl_spans_t *spans);
+
+/* Scans a rectangle of a finished ARGB32 image surface into per-row
+ * runs of clear, translucent and solid pixels.  The encoding is a
+ * snapshot: it must be redone whenever the image changes.  Returns 0
+ * on success and -1 if the surface isn't an ARGB32 image, the
+ * rectangle is out of bounds, or memory ran out. */
+int
+cairosdl_spans_encode (cairosdl_spans_t *spans,
+                       cairo_surface_t  *image,
+                       int               x,
+                       int               y,
+                       int               width,
+                       int               height);
+
+/* Composites a rectangle of a premultiplied ARGB32 or RGB24 image
+ * surface OVER an SDL_Surface, like SDL_BlitSurface() does for SDL
+ * surfaces.  The destination may be a 32 bit surface with the cairosdl
+ * RGB masks (with or without CAIROSDL_AMASK) or a 16 bit RGB 565
+ * surface; it must be locked or not need locking.  A NULL src_rect
+ * means the entire image.  Only the x and y of dst_rect are used, and
+ * if dst_rect isn't NULL it is set to the final blit rectangle after
+ * clipping to the destination's clip_rect.  Returns 0 on success and
+ * -1 with SDL_GetError() set for unsupported formats. */
+int
+cairosdl_blit_image (cairo_surface_t *image,
+                     SDL_Rect const  *src_rect,
+                     SDL_Surface     *dst,
+                     SDL_Rect        *dst_rect);
+
+
+
+/* Layers. */
+
+/* A stack of layers, each an ARGB32 image the size of the stack that
+ * caches what a draw function drew into it.  Updating the stack
+ * redraws only the parts of layers that have been invalidated and
+ * composites the stack into a target only where something changed,
+ * so layers that don't change cost nothing per frame. */
+typedef struct _cairosdl_layers cairosdl_layers_t;
+typedef struct _cairosdl_layer cairosdl_layer_t;
+
+/* Create and destroy a stack of layers of the given size.  Destroying
+ * the stack destroys its layers.  Returns NULL if memory ran out. */
+cairosdl_layers_t *
+cairosdl_layers_create (int width,
+                        int height);
+
+void
+cairosdl_layers_destroy (cairosdl_layers_t *layers);
+
+/* Adds a layer on top of the stack, fully opaque and invalid.  The
+ * draw function is called with a context on the layer's image
+ * clipped to the invalid region, which has been cleared.  User space
+ * is in pixels.  Returns NULL if memory ran out. */
+cairosdl_layer_t *
+cairosdl_layers_add (cairosdl_layers_t   *layers,
+                     cairosdl_draw_func_t draw,
+                     void                *closure);
+
+/* Tell the stack that the target has lost what was composited into
+ * it, so that the next update composites everything again. */
+void
+cairosdl_layers_mark_dirty (cairosdl_layers_t *layers);
+
+/* Invalidate all or part of a layer so that it's redrawn there by
+ * the next update. */
+void
+cairosdl_layer_invalidate (cairosdl_layer_t *layer);
+
+void
+cairosdl_layer_invalidate_rect (cairosdl_layer_t *layer,
+                                int               x,
+                                int               y,
+                                int               width,
+                                int               height);
+
+/* Sets the opacity the layer is composited with, 0.0 to 1.0.  A layer
+ * of opacity 0 is skipped.  Changing the opacity doesn't redraw the
+ * layer. */
+void
+cairosdl_layer_set_opacity (cairosdl_layer_t *layer,
+                            double            opacity);
+
+/* Redraws the invalid parts of the layers and composites the stack
+ * into the target, which is placed at the stack's origin, wherever
+ * anything changed since the last update.  The composited areas are
+ * flushed if the target is a cairosdl surface.  Stores at most
+ * max_rects rectangles covering them in rects, for
+ * SDL_UpdateRects(), or their bounding box if there are more, and
+ * returns how many were stored.  Returns -1 if drawing a layer
+ * failed or memory ran out. */
+int
+cairosdl_layers_update (cairosdl_layers_t *layers,
+                        cairo_surface_t   *target,
+                        int                max_rects,
+                        SDL_Rect          *rects);
+
+/* Cached source patterns. */
+
+/* Returns a surface pattern for using the SDL_Surface as a source.
+ * ARGB surfaces are premultiplied into a snapshot which is cached, so
+ * drawing the same surface again costs no conversion.  The snapshot
+ * is made again only when the generation differs from the one it was
+ * made with, so bump it whenever the SDL_Surface's pixels change.
+ * The cache holds a reference to the SDL_Surface while it has a
+ * snapshot of it.  Amask=0 surfaces are used in place without a
+ * snapshot.  Unsupported formats give a pattern in an error state.
+ * The cache isn't thread safe, so don't call this from the draw
+ * functions of cairosdl_surface_draw_tiled(). */
+cairo_pattern_t *
+cairosdl_pattern_create_for_sdl_surface (SDL_Surface *sdl_surface,
+                                         unsigned     generation);
+
+/* The cache drops the least recently used snapshots when they take
+ * more than its maximum size in bytes, which is
+ * CAIROSDL_DEFAULT_PATTERN_CACHE_SIZE to start with.  Snapshots
+ * bigger than that aren't cached at all.  Patterns still using a
+ * dropped snapshot keep it. */
+#define CAIROSDL_DEFAULT_PATTERN_CACHE_SIZE (16 << 20)
+
+void
+cairosdl_pattern_cache_set_max_size (size_t max_size);
+
+/* Returns the bytes taken by the cached snapshots. */
+size_t
+cairosdl_pattern_cache_get_size (void);
+
+/* Drops the snapshot of the SDL_Surface, if any, and with it the
+ * cache's reference to the SDL_Surface. */
+void
+cairosdl_pattern_cache_remove (SDL_Surface *sdl_surface);
+
+/* Tiled canvases. */
+
+/* A canvas too big for one image or SDL_Surface, up to INT_MAX pixels
+ * either way, cut into square tiles of ARGB32 images that are made
+ * when first drawn into.  With a store function at most
+ * max_resident_tiles tiles are kept in memory: the least recently
+ * used one beyond that is stored and dropped, and loaded again if
+ * it's drawn into later.  Without one every tile drawn into stays. */
+typedef struct _cairosdl_canvas cairosdl_canvas_t;
+
+/* Called with a tile's pixels as a 32 bit SDL_Surface with the
+ * cairosdl masks and unpremultiplied alpha, which is only valid
+ * during the call.  Column and row count tiles from the top left.
+ * Store functions return 0 on success.  Load functions fill in the
+ * SDL_Surface and return 1, or return 0 if the tile was never stored
+ * and should start clear.  Both return -1 on failure. */
+typedef int (*cairosdl_canvas_tile_func_t) (SDL_Surface *tile,
+                                            int          column,
+                                            int          row,
+                                            void        *closure);
+
+/* Create a canvas.  The store and load functions may be NULL.
+ * Returns NULL with SDL_GetError() set on failure. */
+cairosdl_canvas_t *
+cairosdl_canvas_create (int                         width,
+                        int                         height,
+                        int                         tile_size,
+                        int                         max_resident_tiles,
+                        cairosdl_canvas_tile_func_t store,
+                        cairosdl_canvas_tile_func_t load,
+                        void                       *closure);
+
+/* Frees the canvas and its tiles without storing them. */
+void
+cairosdl_canvas_destroy (cairosdl_canvas_t *canvas);
+
+/* Calls draw() once for each tile the rectangle touches, with a
+ * context on the tile clipped to the rectangle and user space in
+ * canvas pixels, so the drawing must lie within the rectangle.  Like
+ * cairosdl_surface_draw_tiled() the calls may run at the same time on
+ * cairosdl's worker threads.  Returns the first error of the draw
+ * calls, CAIRO_STATUS_NO_MEMORY, or CAIRO_STATUS_READ_ERROR or
+ * CAIRO_STATUS_WRITE_ERROR if loading or storing a tile failed. */
+cairo_status_t
+cairosdl_canvas_draw (cairosdl_canvas_t   *canvas,
+                      int                  x,
+                      int                  y,
+                      int                  width,
+                      int                  height,
+                      cairosdl_draw_func_t draw,
+                      void                *closure);
+
+/* Stores every tile in memory that was drawn into since it was last
+ * stored.  Returns 0 on success or -1 if a store failed. */
+int
+cairosdl_canvas_flush (cairosdl_canvas_t *canvas);
+
+/* Returns the tile as a premultiplied ARGB32 image, loading it if
+ * needed.  Its device offset places it in canvas pixels.  The image
+ * belongs to the canvas and is only valid until the next call on the
+ * canvas.  Returns NULL if the tile is outside the canvas or couldn't
+ * be loaded. */
+cairo_surface_t *
+cairosdl_canvas_get_tile (cairosdl_canvas_t *canvas,
+                          int                column,
+                          int                row);
+
+int
+cairosdl_canvas_get_num_resident_tiles (cairosdl_canvas_t *canvas);
+
 /* Cairo pixel configuration.  This isn't tweakable, it just is. */
 #define CAIROSDL_ASHIFT 24
 #define CAIROSDL_RSHIFT 16
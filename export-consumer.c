@@ -0,0 +1,160 @@
+/*
+ * Shows the frames another process exports through cairosdl-export,
+ * like gears -export /gears, and counts how many it got and missed.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-export.h"
+
+struct consumer_stats {
+    unsigned long frames;       /* shown */
+    unsigned long skipped;      /* published but never seen */
+    unsigned long torn;         /* overwritten while being shown */
+    Uint32 last_report;
+};
+
+static void
+print_stats (struct consumer_stats *stats)
+{
+    Uint32 now = SDL_GetTicks ();
+    Uint32 elapsed = now - stats->last_report;
+
+    if (elapsed < 1000)
+        return;
+    printf ("%.1f fps, %lu skipped, %lu torn\n",
+            stats->frames * 1000.0 / elapsed, stats->skipped, stats->torn);
+    stats->frames = stats->skipped = stats->torn = 0;
+    stats->last_report = now;
+}
+
+/* Copies frame n into the private copy and from there to the screen
+ * if it wasn't overwritten before or during the copy.  Returns zero
+ * and leaves the screen alone if it was. */
+static int
+show_frame (SDL_Surface       *screen,
+            SDL_Surface       *copy,
+            cairosdl_export_t *export_,
+            Uint32             n)
+{
+    cairosdl_export_header_t const *header =
+        cairosdl_export_get_header (export_);
+    unsigned char const *pixels = cairosdl_export_get_pixels (export_, n);
+    SDL_Surface *frame;
+
+    if (pixels == NULL)
+        return 0;
+
+    frame = SDL_CreateRGBSurfaceFrom (
+        (void *)pixels, header->width, header->height, 32, header->stride,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK,
+        header->format == CAIROSDL_EXPORT_ARGB32 ? CAIROSDL_AMASK : 0);
+    if (frame == NULL)
+        return 0;
+    SDL_SetAlpha (frame, 0, 255);
+    SDL_BlitSurface (frame, NULL, copy, NULL);
+    SDL_FreeSurface (frame);
+
+    if (!cairosdl_export_frame_is_intact (export_, n))
+        return 0;
+    SDL_BlitSurface (copy, NULL, screen, NULL);
+    return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+    char const *name = "/gears";
+    cairosdl_export_t *export_;
+    cairosdl_export_header_t const *header;
+    struct consumer_stats stats;
+    SDL_Surface *screen;
+    SDL_Surface *copy;
+    Uint32 last_seen;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp (argv[i], "-name") && i+1 < argc) {
+            name = argv[++i];
+        }
+        else {
+            fprintf (stderr, "usage: [-name /shared-memory-name]\n");
+            return 1;
+        }
+    }
+
+    export_ = cairosdl_export_open (name);
+    if (export_ == NULL) {
+        fprintf (stderr, "Unable to open the export: %s\n", SDL_GetError ());
+        return 1;
+    }
+    header = cairosdl_export_get_header (export_);
+
+    if (SDL_Init (SDL_INIT_VIDEO) < 0) {
+        fprintf (stderr, "Unable to initialize SDL: %s\n", SDL_GetError ());
+        cairosdl_export_destroy (export_);
+        return 1;
+    }
+    screen = SDL_SetVideoMode (header->width, header->height, 32,
+                               SDL_SWSURFACE);
+    if (screen == NULL) {
+        fprintf (stderr, "Unable to set %ix%i video: %s\n",
+                 (int)header->width, (int)header->height, SDL_GetError ());
+        SDL_Quit ();
+        cairosdl_export_destroy (export_);
+        return 1;
+    }
+    SDL_WM_SetCaption (name, name);
+
+    /* Frames are read into this first so that torn ones are never
+     * shown. */
+    copy = SDL_CreateRGBSurface (
+        SDL_SWSURFACE, header->width, header->height, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK,
+        header->format == CAIROSDL_EXPORT_ARGB32 ? CAIROSDL_AMASK : 0);
+    if (copy == NULL) {
+        fprintf (stderr, "Unable to create a frame: %s\n", SDL_GetError ());
+        SDL_Quit ();
+        cairosdl_export_destroy (export_);
+        return 1;
+    }
+    SDL_SetAlpha (copy, 0, 255);
+
+    memset (&stats, 0, sizeof (stats));
+    stats.last_report = SDL_GetTicks ();
+    last_seen = header->published;
+    for (;;) {
+        SDL_Event event;
+        Uint32 n;
+
+        while (SDL_PollEvent (&event)) {
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_KEYDOWN &&
+                 event.key.keysym.sym == SDLK_ESCAPE))
+            {
+                goto DONE;
+            }
+        }
+
+        /* Don't sleep for long so that events aren't kept waiting. */
+        n = cairosdl_export_wait (export_, last_seen, 20);
+        if (n != last_seen) {
+            stats.skipped += n - last_seen - 1;
+            last_seen = n;
+            if (show_frame (screen, copy, export_, n)) {
+                stats.frames++;
+                SDL_UpdateRect (screen, 0, 0, 0, 0);
+            }
+            else {
+                stats.torn++;
+            }
+        }
+        print_stats (&stats);
+    }
+
+ DONE:
+    SDL_FreeSurface (copy);
+    SDL_Quit ();
+    cairosdl_export_destroy (export_);
+    return 0;
+}
@@ -0,0 +1,179 @@
+/* A frame scheduler for the demos' event loops.  See frame-scheduler.h. */
+#include <time.h>
+#if defined(__unix__) || defined(__APPLE__)
+# include <unistd.h>
+# if defined(_POSIX_TIMERS) && _POSIX_TIMERS > 0
+#  define HAVE_CLOCK_GETTIME 1
+# endif
+#endif
+#include "frame-scheduler.h"
+
+/* How close to a deadline the wait stops sleeping and spins.  A
+ * nanosleep() overshoots by tens of microseconds but SDL_Delay() is
+ * only good to its 10 ms scheduler tick on some systems. */
+#ifdef HAVE_CLOCK_GETTIME
+# define SPIN_TIME 0.001
+#else
+# define SPIN_TIME 0.010
+#endif
+
+/* Longest single sleep while events are being watched, so that an
+ * event arriving during a long frame period isn't left waiting.  This
+ * is how often SDL_WaitEvent() polls too. */
+#define MAX_SLEEP_TIME 0.010
+
+double
+frame_scheduler_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return SDL_GetTicks () / 1000.0;
+#endif
+}
+
+double
+frame_scheduler_cpu_time (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    clock_gettime (CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double)clock () / CLOCKS_PER_SEC;
+#endif
+}
+
+static void
+sleep_for (double seconds)
+{
+#ifdef HAVE_CLOCK_GETTIME
+    struct timespec ts;
+    ts.tv_sec = (time_t)seconds;
+    ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+    nanosleep (&ts, NULL);
+#else
+    SDL_Delay ((Uint32)(seconds * 1000));
+#endif
+}
+
+void
+frame_scheduler_init (struct frame_scheduler *scheduler,
+                      enum frame_schedule schedule,
+                      double target_fps)
+{
+    if (target_fps <= 0 && schedule == FRAME_SCHEDULE_TARGET)
+        schedule = FRAME_SCHEDULE_UNLIMITED;
+    scheduler->schedule = schedule;
+    scheduler->frame_period = target_fps > 0 ? 1.0 / target_fps : 0;
+    scheduler->next_frame_time = frame_scheduler_now ();
+    scheduler->redraw_requested = 1;
+    scheduler->num_frames = 0;
+}
+
+void
+frame_scheduler_request_redraw (struct frame_scheduler *scheduler)
+{
+    scheduler->redraw_requested = 1;
+}
+
+/* Looks at an event just taken off the queue.  Returns 1 if it's
+ * for the caller and 0 if the scheduler swallowed it. */
+static int
+take_event (struct frame_scheduler *scheduler, SDL_Event *event)
+{
+    switch (event->type) {
+    case SDL_VIDEOEXPOSE:
+        scheduler->redraw_requested = 1;
+        return 0;
+
+    case SDL_VIDEORESIZE:
+        /* Skip to the last resize waiting. */
+        while (SDL_PeepEvents (event, 1, SDL_GETEVENT,
+                               SDL_VIDEORESIZEMASK) > 0)
+        {
+        }
+        scheduler->redraw_requested = 1;
+        return 1;
+
+    default:
+        return 1;
+    }
+}
+
+/* Seconds until the next frame is due, which may be negative, or a
+ * huge number if no frame is due at all. */
+static double
+time_to_frame (struct frame_scheduler const *scheduler, double now)
+{
+    if (scheduler->schedule == FRAME_SCHEDULE_ON_DEMAND &&
+        !scheduler->redraw_requested)
+    {
+        return 1e30;
+    }
+    return scheduler->next_frame_time - now;
+}
+
+int
+frame_scheduler_next_event (struct frame_scheduler *scheduler,
+                            SDL_Event *event)
+{
+    for (;;) {
+        double remaining;
+
+        while (SDL_PollEvent (event)) {
+            if (take_event (scheduler, event))
+                return 1;
+        }
+
+        remaining = time_to_frame (scheduler, frame_scheduler_now ());
+        if (remaining <= 0)
+            return 0;
+
+        if (remaining >= 1e30) {
+            /* Nothing to do until an event arrives. */
+            if (!SDL_WaitEvent (event))
+                return -1;
+            if (take_event (scheduler, event))
+                return 1;
+        }
+        else if (remaining > SPIN_TIME) {
+            remaining -= SPIN_TIME;
+            sleep_for (remaining < MAX_SLEEP_TIME ? remaining : MAX_SLEEP_TIME);
+        }
+    }
+}
+
+void
+frame_scheduler_wait_frame (struct frame_scheduler *scheduler)
+{
+    double remaining;
+
+    if (scheduler->frame_period <= 0)
+        return;
+
+    while ((remaining = scheduler->next_frame_time -
+            frame_scheduler_now ()) > 0)
+    {
+        if (remaining > SPIN_TIME)
+            sleep_for (remaining - SPIN_TIME);
+    }
+}
+
+void
+frame_scheduler_frame_done (struct frame_scheduler *scheduler)
+{
+    double now = frame_scheduler_now ();
+
+    scheduler->num_frames++;
+    scheduler->redraw_requested = 0;
+
+    /* Keep to the cadence of the target, but a frame that came in
+     * late moves the cadence rather than making the next ones hurry
+     * to catch up. */
+    scheduler->next_frame_time += scheduler->frame_period;
+    if (scheduler->next_frame_time < now)
+        scheduler->next_frame_time = now;
+}
@@ -0,0 +1,79 @@
+/* A frame scheduler for the demos' event loops.
+ *
+ * The scheduler decides when the next frame is drawn and hands out
+ * events in between, so that an event loop doesn't have to push
+ * itself expose events to keep drawing.  It has three modes:
+ *
+ *   FRAME_SCHEDULE_TARGET draws frames at a target frame rate and
+ *   sleeps in between.
+ *
+ *   FRAME_SCHEDULE_UNLIMITED draws a frame whenever there are no
+ *   events waiting.
+ *
+ *   FRAME_SCHEDULE_ON_DEMAND draws a frame only when one has been
+ *   asked for and sleeps in SDL_WaitEvent() otherwise.  With a target
+ *   frame rate the frames are also no closer together than that.
+ *
+ * The wait for a frame sleeps for most of the time and spins with
+ * the event queue polled for the last millisecond or so, since a
+ * sleep can overshoot by more than that.  Expose events are taken in
+ * by the scheduler as a request for a frame and of several resize
+ * events waiting only the last one is handed out.
+ */
+#ifndef FRAME_SCHEDULER_H
+#define FRAME_SCHEDULER_H
+
+#include <SDL.h>
+
+enum frame_schedule {
+    FRAME_SCHEDULE_TARGET,
+    FRAME_SCHEDULE_UNLIMITED,
+    FRAME_SCHEDULE_ON_DEMAND
+};
+
+struct frame_scheduler {
+    enum frame_schedule schedule;
+    double frame_period;        /* seconds per frame, 0 for no limit */
+    double next_frame_time;     /* when the next frame is due */
+    int redraw_requested;
+    unsigned long num_frames;
+};
+
+/* Initialise the scheduler.  A target frame rate of zero or less
+ * turns FRAME_SCHEDULE_TARGET into FRAME_SCHEDULE_UNLIMITED.  The
+ * first frame is due straight away. */
+void
+frame_scheduler_init (struct frame_scheduler *scheduler,
+                      enum frame_schedule schedule,
+                      double target_fps);
+
+/* Ask for a frame.  Only needed with FRAME_SCHEDULE_ON_DEMAND. */
+void
+frame_scheduler_request_redraw (struct frame_scheduler *scheduler);
+
+/* Waits for the next event or for the next frame to be due.  Returns
+ * 1 with the event stored, 0 when it's time to draw a frame and -1 if
+ * waiting for events failed. */
+int
+frame_scheduler_next_event (struct frame_scheduler *scheduler,
+                            SDL_Event *event);
+
+/* Waits for the next frame without looking at events, for threads
+ * that draw but don't handle events. */
+void
+frame_scheduler_wait_frame (struct frame_scheduler *scheduler);
+
+/* Tell the scheduler a frame has been drawn. */
+void
+frame_scheduler_frame_done (struct frame_scheduler *scheduler);
+
+/* A monotonic clock in seconds. */
+double
+frame_scheduler_now (void);
+
+/* The CPU time used by the whole process so far, all threads
+ * included, in seconds. */
+double
+frame_scheduler_cpu_time (void);
+
+#endif /* FRAME_SCHEDULER_H */
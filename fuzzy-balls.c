@@ -2,12 +2,25 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "cairosdl.h"
+#include "cairosdl-record.h"
+#include "cairosdl-remote.h"
+#include "governor.h"
+#include "frame-scheduler.h"
 
 #define dprintf(args)
 
 #define BLIT_BOBS_USING_CAIRO 1
 
+/* When blitting using cairo, composite all bobs with one call to
+ * cairosdl_composite_sprites() rather than a fill per bob. */
+#define COMPOSITE_BOBS_IN_BATCH 1
+
+/* Span encode each bob after rendering it so that batched compositing
+ * skips the clear corners and rim of the bob and copies solid runs. */
+#define ENCODE_BOB_SPANS 1
+
 struct vector {
     double x, y;
 };
@@ -16,14 +29,33 @@ struct vector {
 
 struct bob {
     struct vector pos;
+    struct vector prev_pos;     /* pos before the last simulation step */
+    struct vector draw_pos;     /* interpolated between the two */
     struct vector vel;
     struct vector accel;
     double mass;
     double radius;
     double focus;
+
+    /* The bob's sprite lives in a sub-rectangle of the shared bob
+     * atlas.  The surface is a view of that rectangle. */
+    int atlas_x, atlas_y;
+    int width, height;
     cairo_surface_t *surface;
+    cairosdl_spans_t *spans;
 };
 
+/* All bob sprites are packed into one big ARGB32 image surface. */
+static cairo_surface_t *bob_atlas = NULL;
+
+/* With -target-fps F the bobs are drawn with less care when frames
+ * are over budget. */
+static struct governor governor;
+
+/* Frames are paced to the same target, or drawn as fast as events
+ * allow without one. */
+static struct frame_scheduler scheduler;
+
 static void
 init_bobs (struct bob *bobs, size_t num_bobs)
 {
@@ -38,6 +70,7 @@ init_bobs (struct bob *bobs, size_t num_bobs)
         r = r < 0.2 ? r : 0.2;
         bob->pos.x = rand () * 1.0 / RAND_MAX;
         bob->pos.y = rand () * 1.0 / RAND_MAX;
+        bob->prev_pos = bob->draw_pos = bob->pos;
         bob->vel.x = bob->vel.y = 0;
         bob->accel.x = bob->accel.y = 0;
         bob->mass = (1+theta)*(1+theta);
@@ -46,7 +79,62 @@ init_bobs (struct bob *bobs, size_t num_bobs)
         bob->radius = r;
         bob->focus = 1.0;
         bob->surface = NULL;
+        bob->spans = ENCODE_BOB_SPANS ? cairosdl_spans_create () : NULL;
+    }
+}
+
+static int
+compare_bob_heights (void const *a, void const *b)
+{
+    struct bob const *p = *(struct bob const * const *)a;
+    struct bob const *q = *(struct bob const * const *)b;
+    if (p->height != q->height)
+        return q->height - p->height;
+    return q->width - p->width;
+}
+
+/* Shelf pack the bob sprites into an atlas of the returned width and
+ * height.  Bobs are placed tallest first left to right onto shelves
+ * whose height is set by their first bob. */
+static void
+pack_bobs (struct bob *bobs, size_t num_bobs,
+           int *OUT_width, int *OUT_height)
+{
+    struct bob *sorted[MAX_BOBS];
+    double area = 0;
+    int atlas_width = 1;
+    int x = 0, shelf_y = 0, shelf_height = 0;
+    size_t i;
+
+    assert (num_bobs <= MAX_BOBS);
+
+    for (i=0; i<num_bobs; i++) {
+        sorted[i] = bobs + i;
+        area += bobs[i].width * (double)bobs[i].height;
+        if (bobs[i].width > atlas_width)
+            atlas_width = bobs[i].width;
+    }
+    if (atlas_width < (int)ceil (sqrt (area)))
+        atlas_width = (int)ceil (sqrt (area));
+
+    qsort (sorted, num_bobs, sizeof sorted[0], compare_bob_heights);
+
+    for (i=0; i<num_bobs; i++) {
+        struct bob *bob = sorted[i];
+        if (x + bob->width > atlas_width) {
+            shelf_y += shelf_height;
+            shelf_height = 0;
+            x = 0;
+        }
+        if (shelf_height == 0)
+            shelf_height = bob->height;
+        bob->atlas_x = x;
+        bob->atlas_y = shelf_y;
+        x += bob->width;
     }
+
+    *OUT_width = atlas_width;
+    *OUT_height = shelf_y + shelf_height;
 }
 
 static void
@@ -54,38 +142,43 @@ alloc_bobs (struct bob *bobs, size_t num_bobs)
 {
     size_t i;
     SDL_Surface *screen = SDL_GetVideoSurface ();
+    int atlas_width, atlas_height;
 
     for (i=0; i<num_bobs; i++) {
         struct bob *bob = bobs + i;
-        int width = screen->w * 2*bob->radius + 1;
-        int height = screen->h * 2*bob->radius + 1;
+        bob->width = screen->w * 2*bob->radius + 1;
+        bob->height = screen->h * 2*bob->radius + 1;
 
         if (bob->surface) {
             cairo_surface_destroy (bob->surface);
             bob->surface = NULL;
         }
+    }
 
-        if (BLIT_BOBS_USING_CAIRO) {
-            bob->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
-                                                       width, height);
-        }
-        else {
-            SDL_Surface *sdl_surface = SDL_CreateRGBSurface (
-                SDL_SWSURFACE | SDL_SRCALPHA,
-                width, height, 32,
-                CAIROSDL_RMASK,
-                CAIROSDL_GMASK,
-                CAIROSDL_BMASK,
-                CAIROSDL_AMASK);
-            if (sdl_surface == NULL) {
-                fprintf (stderr, "Failed allocating bob sdl surfaces: %s\n",
-                         SDL_GetError ());
-                exit (1);
-            }
-            assert (!SDL_MUSTLOCK (sdl_surface));
-            bob->surface = cairosdl_surface_create (sdl_surface);
-            SDL_FreeSurface (sdl_surface);
-        }
+    if (bob_atlas) {
+        cairo_surface_destroy (bob_atlas);
+        bob_atlas = NULL;
+    }
+
+    pack_bobs (bobs, num_bobs, &atlas_width, &atlas_height);
+
+    bob_atlas = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                            atlas_width, atlas_height);
+
+    if (cairo_surface_status (bob_atlas) != CAIRO_STATUS_SUCCESS) {
+        cairo_status_t status = cairo_surface_status (bob_atlas);
+        fprintf (stderr, "Failed making a cairo surface for the bob atlas: %s\n",
+                 cairo_status_to_string (status));
+        exit (1);
+    }
+
+    for (i=0; i<num_bobs; i++) {
+        struct bob *bob = bobs + i;
+
+        bob->surface = cairo_surface_create_for_rectangle (
+            bob_atlas,
+            bob->atlas_x, bob->atlas_y,
+            bob->width, bob->height);
 
         if (cairo_surface_status (bob->surface) != CAIRO_STATUS_SUCCESS) {
             cairo_status_t status = cairo_surface_status (bob->surface);
@@ -93,24 +186,23 @@ alloc_bobs (struct bob *bobs, size_t num_bobs)
                      cairo_status_to_string (status));
             exit (1);
         }
-
     }
 }
 
 static void
 render_bob (struct bob *bob, int i)
 {
-    int width = cairo_image_surface_get_width (bob->surface);
-    int height = cairo_image_surface_get_height (bob->surface);
+    int width = bob->width;
+    int height = bob->height;
     cairo_t *cr = cairo_create (bob->surface);
     double theta = (i+0.5) / MAX_BOBS;
-    double dx = bob->pos.x - 0.5;
-    double dy = bob->pos.y - 0.5;
+    double dx = bob->draw_pos.x - 0.5;
+    double dy = bob->draw_pos.y - 0.5;
 
     cairo_scale (cr, 0.5*width, 0.5*height);
     cairo_translate (cr, 1.0, 1.0);
 
-    cairo_set_tolerance (cr, 0.5);
+    governor_apply (&governor, cr, 0.5);
 
     cairo_set_operator (cr, CAIRO_OPERATOR_CLEAR);
     cairo_paint (cr);
@@ -122,7 +214,7 @@ render_bob (struct bob *bob, int i)
                            1-fabs(dy),
                            theta,
                            (1-2*fabs(dx))*(1-2*fabs(dy)));
-    if (1) {
+    if (governor_use_gradients (&governor)) {
         cairo_pattern_t *pat;
         pat = cairo_pattern_create_radial (
             -dx, -dy, 0.0,
@@ -153,7 +245,7 @@ render_bob (struct bob *bob, int i)
     cairo_close_path (cr);
     cairo_fill (cr);
 
-    cairosdl_destroy (cr);
+    cairo_destroy (cr);
 }
 
 static void
@@ -161,34 +253,51 @@ render_bobs (struct bob *bobs, size_t num_bobs)
 {
     size_t i;
     for (i=0; i<num_bobs; i++) {
-        render_bob (bobs+i, i);
+        struct bob *bob = bobs + i;
+        render_bob (bob, i);
+        if (bob->spans &&
+            cairosdl_spans_encode (bob->spans, bob_atlas,
+                                   bob->atlas_x, bob->atlas_y,
+                                   bob->width, bob->height) != 0)
+        {
+            fprintf (stderr, "Failed to span encode a bob\n");
+            exit (1);
+        }
     }
 }
 
+/* Composite the premultiplied bobs straight onto the screen without
+ * going through a cairo context. */
 static void
-blit_bobs_using_sdl (struct bob *bobs, size_t num_bobs)
+blit_bobs_using_blit_image (struct bob *bobs, size_t num_bobs)
 {
     size_t i;
     SDL_Surface *screen = SDL_GetVideoSurface ();
 
+    while (SDL_LockSurface (screen) != 0) {
+        SDL_Delay (1);
+    }
+
     for (i=0; i<num_bobs; i++) {
         struct bob *bob = bobs + i;
-        SDL_Surface *sdl_surface = cairosdl_surface_get_target (bob->surface);
         SDL_Rect src_rect[1];
         SDL_Rect dst_rect[1];
 
-        src_rect->x = 0;
-        src_rect->y = 0;
-        src_rect->w = sdl_surface->w;
-        src_rect->h = sdl_surface->h;
+        src_rect->x = bob->atlas_x;
+        src_rect->y = bob->atlas_y;
+        src_rect->w = bob->width;
+        src_rect->h = bob->height;
 
-        dst_rect->x = (bob->pos.x - bob->radius) * screen->w;
-        dst_rect->y = (bob->pos.y - bob->radius) * screen->h;
-        dst_rect->w = sdl_surface->w;
-        dst_rect->h = sdl_surface->h;
+        dst_rect->x = (bob->draw_pos.x - bob->radius) * screen->w;
+        dst_rect->y = (bob->draw_pos.y - bob->radius) * screen->h;
 
-        SDL_BlitSurface (sdl_surface, src_rect, screen, dst_rect);
+        if (cairosdl_blit_image (bob_atlas, src_rect, screen, dst_rect) != 0) {
+            fprintf (stderr, "Failed to blit a bob: %s\n", SDL_GetError ());
+            exit (1);
+        }
     }
+
+    SDL_UnlockSurface (screen);
 }
 
 static void
@@ -204,18 +313,38 @@ blit_bobs_using_cairo (struct bob *bobs, size_t num_bobs)
 
     cr = cairosdl_create (screen);
 
-    for (i=0; i<num_bobs; i++) {
-        struct bob *bob = bobs + i;
-        int x = (int)((bob->pos.x - bob->radius) * screen->w);
-        int y = (int)((bob->pos.y - bob->radius) * screen->h);
-        int width = cairo_image_surface_get_width (bob->surface);
-        int height = cairo_image_surface_get_height (bob->surface);
+    if (COMPOSITE_BOBS_IN_BATCH) {
+        cairosdl_sprite_t sprites[MAX_BOBS];
+
+        for (i=0; i<num_bobs; i++) {
+            struct bob *bob = bobs + i;
+            sprites[i].source = bob_atlas;
+            sprites[i].src_x = bob->atlas_x;
+            sprites[i].src_y = bob->atlas_y;
+            sprites[i].width = bob->width;
+            sprites[i].height = bob->height;
+            sprites[i].dst_x = (int)((bob->draw_pos.x - bob->radius) * screen->w);
+            sprites[i].dst_y = (int)((bob->draw_pos.y - bob->radius) * screen->h);
+            sprites[i].opacity = 1.0;
+            sprites[i].spans = bob->spans;
+        }
 
-        cairo_set_source_surface (cr, bob->surface, x,y);
-        cairo_rectangle (cr,
-                         x, y,
-                         width, height);
-        cairo_fill (cr);
+        cairosdl_composite_sprites (cairo_get_target (cr), num_bobs, sprites);
+    }
+    else {
+        for (i=0; i<num_bobs; i++) {
+            struct bob *bob = bobs + i;
+            int x = (int)((bob->draw_pos.x - bob->radius) * screen->w);
+            int y = (int)((bob->draw_pos.y - bob->radius) * screen->h);
+
+            cairo_set_source_surface (cr, bob_atlas,
+                                      x - bob->atlas_x,
+                                      y - bob->atlas_y);
+            cairo_rectangle (cr,
+                             x, y,
+                             bob->width, bob->height);
+            cairo_fill (cr);
+        }
     }
 
     cairo_destroy (cr);
@@ -225,142 +354,275 @@ blit_bobs_using_cairo (struct bob *bobs, size_t num_bobs)
 
 #define SQR(x) ((x)*(x))
 
-static double
-sim_bobs (struct bob *bobs, size_t num_bobs,
-          double t0, double t1)
+/* Advance the simulation by one step of length dt from time t. */
+static void
+sim_step (struct bob *bobs, size_t num_bobs,
+          double t, double dt)
 {
-    double dt = 0.002;
     double G = 0.5;
-    double t = t0;
+    size_t i, j;
 
-    if (dt*10 < (t1 - t0) && 0)
-        dt = (t1 - t0) / 10.0;
+    for (i=0; i<num_bobs; i++) {
+        double theta = (i+0.5) / MAX_BOBS;
+        double f = 0.3;
+        bobs[i].focus = f + (0.96-f)*0.5*(1 + cos(3.141*t*(1-theta)));
+        bobs[i].accel.x = (0.5-bobs[i].pos.x)*0.0;
+        bobs[i].accel.y = (0.5-bobs[i].pos.y)*0.0;
+    }
 
-    while (t < t1) {
-        size_t i, j;
+    /* Basic mass attraction forces. */
+    for (i=0; i<num_bobs; i++) {
+        struct bob *p = bobs + i;
+        for (j=i+1; j<num_bobs; j++) {
+            struct bob *q = bobs + j;
+            double dx = q->pos.x - p->pos.x;
+            double dy = q->pos.y - p->pos.y;
+            double dist2 = SQR(dx) + SQR(dy);
+            double f = G / dist2;
+
+            if ((i^j) & 1) {
+                f *= -1;
+            }
 
-        for (i=0; i<num_bobs; i++) {
-            double theta = (i+0.5) / MAX_BOBS;
-            double f = 0.3;
-            bobs[i].focus = f + (0.96-f)*0.5*(1 + cos(3.141*t*(1-theta)));
-            bobs[i].accel.x = (0.5-bobs[i].pos.x)*0.0;
-            bobs[i].accel.y = (0.5-bobs[i].pos.y)*0.0;
+            p->accel.x += dx*f*q->mass;
+            p->accel.y += dy*f*q->mass;
+            q->accel.x -= dx*f*p->mass;
+            q->accel.y -= dy*f*p->mass;
         }
+    }
 
-        /* Basic mass attraction forces. */
-        for (i=0; i<num_bobs; i++) {
-            struct bob *p = bobs + i;
-            for (j=i+1; j<num_bobs; j++) {
-                struct bob *q = bobs + j;
-                double dx = q->pos.x - p->pos.x;
-                double dy = q->pos.y - p->pos.y;
-                double dist2 = SQR(dx) + SQR(dy);
-                double f = G / dist2;
-
-                if ((i^j) & 1) {
-                    f *= -1;
-                }
-
-                p->accel.x += dx*f*q->mass;
-                p->accel.y += dy*f*q->mass;
-                q->accel.x -= dx*f*p->mass;
-                q->accel.y -= dy*f*p->mass;
-            }
-        }
 
+    /* Integrate one step forwards. */
+    for (i=0; i<num_bobs; i++) {
+        struct bob *p = bobs + i;
+
+        p->accel.x = p->accel.x;
+        p->accel.y = p->accel.y;
 
-        /* Integrate one step forwards. */
-        for (i=0; i<num_bobs; i++) {
-            struct bob *p = bobs + i;
+        p->vel.x += dt*p->accel.x;
+        p->vel.y += dt*p->accel.y;
 
-            p->accel.x = p->accel.x;
-            p->accel.y = p->accel.y;
+        p->vel.x = p->vel.x;
+        p->vel.y = p->vel.y;
 
-            p->vel.x += dt*p->accel.x;
-            p->vel.y += dt*p->accel.y;
+        p->pos.x = p->pos.x + dt*p->vel.x;
+        p->pos.y = p->pos.y + dt*p->vel.y;
 
-            p->vel.x = p->vel.x;
-            p->vel.y = p->vel.y;
+    }
 
-            p->pos.x = p->pos.x + dt*p->vel.x;
-            p->pos.y = p->pos.y + dt*p->vel.y;
+    /* Apply position constraints. */
+    for (i=0; i<num_bobs; i++) {
+        double eps = 0.0;
+        struct bob *p = bobs + i;
+
+        /* Bounce off each other after allowed overlap. */
+        for (j=i+1; j<num_bobs; j++) {
+            struct bob *q = bobs + j;
+            double dx = q->pos.x - p->pos.x;
+            double dy = q->pos.y - p->pos.y;
+            double dist = sqrt(SQR(dx) + SQR(dy));
+            double overlap = p->radius*p->focus + q->radius*q->focus - dist - 0.02;
+
+            if (overlap < 0.0)
+                continue;
+            p->pos.x -= dx*overlap/dist;
+            p->pos.y -= dy*overlap/dist;
+            q->pos.x += dx*overlap/dist;
+            q->pos.y += dy*overlap/dist;
+
+            /* Swap velocity vectors, preserve momentum. */
+            {
+                double scale;
+                struct vector tmp = p->vel;
+                p->vel = q->vel;
+                q->vel = tmp;
+
+                scale = q->mass/p->mass;
+                p->vel.x *= scale;
+                p->vel.y *= scale;
+                scale = p->mass/q->mass;
+                q->vel.x *= scale;
+                q->vel.y *= scale;
+            }
+        }
 
+        /* Bounce off walls */
+        if (p->pos.x > 1+eps - p->radius*p->focus) {
+            p->pos.x = 1+eps - p->radius*p->focus;
+            p->vel.x *= -1;
+        }
+        if (p->pos.x < 0-eps + p->radius*p->focus) {
+            p->pos.x = 0-eps + p->radius*p->focus;
+            p->vel.x *= -1;
+        }
+        if (p->pos.y > 1+eps - p->radius*p->focus) {
+            p->pos.y = 1+eps - p->radius*p->focus;
+            p->vel.y *= -1;
+        }
+        if (p->pos.y < 0-eps + p->radius*p->focus) {
+            p->pos.y = 0-eps + p->radius*p->focus;
+            p->vel.y *= -1;
         }
 
-        /* Apply position constraints. */
-        for (i=0; i<num_bobs; i++) {
-            double eps = 0.0;
-            struct bob *p = bobs + i;
-
-            /* Bounce off each other after allowed overlap. */
-            for (j=i+1; j<num_bobs; j++) {
-                struct bob *q = bobs + j;
-                double dx = q->pos.x - p->pos.x;
-                double dy = q->pos.y - p->pos.y;
-                double dist = sqrt(SQR(dx) + SQR(dy));
-                double overlap = p->radius*p->focus + q->radius*q->focus - dist - 0.02;
-
-                if (overlap < 0.0)
-                    continue;
-                p->pos.x -= dx*overlap/dist;
-                p->pos.y -= dy*overlap/dist;
-                q->pos.x += dx*overlap/dist;
-                q->pos.y += dy*overlap/dist;
-
-                /* Swap velocity vectors, preserve momentum. */
-                {
-                    double scale;
-                    struct vector tmp = p->vel;
-                    p->vel = q->vel;
-                    q->vel = tmp;
-
-                    scale = q->mass/p->mass;
-                    p->vel.x *= scale;
-                    p->vel.y *= scale;
-                    scale = p->mass/q->mass;
-                    q->vel.x *= scale;
-                    q->vel.y *= scale;
-                }
-            }
+    }
+}
 
-            /* Bounce off walls */
-            if (p->pos.x > 1+eps - p->radius*p->focus) {
-                p->pos.x = 1+eps - p->radius*p->focus;
-                p->vel.x *= -1;
-            }
-            if (p->pos.x < 0-eps + p->radius*p->focus) {
-                p->pos.x = 0-eps + p->radius*p->focus;
-                p->vel.x *= -1;
-            }
-            if (p->pos.y > 1+eps - p->radius*p->focus) {
-                p->pos.y = 1+eps - p->radius*p->focus;
-                p->vel.y *= -1;
-            }
-            if (p->pos.y < 0-eps + p->radius*p->focus) {
-                p->pos.y = 0-eps + p->radius*p->focus;
-                p->vel.y *= -1;
-            }
+/* The simulation runs in fixed steps of dt seconds.  Each frame adds
+ * the elapsed wall clock time to an accumulator and runs as many steps
+ * as fit, but at most max_steps_per_frame of them.  Anything beyond
+ * the budget is dropped so a stall can't snowball into ever longer
+ * frames.  The leftover fraction of a step is used to interpolate the
+ * drawn positions between the last two states. */
+struct sim_clock {
+    double t;                   /* simulation time of the current state */
+    double dt;
+    double accumulator;         /* wall clock time not yet simulated */
+    int max_steps_per_frame;
+    unsigned long num_steps;
+    unsigned long num_dropped_steps;
+};
+
+static void
+init_sim_clock (struct sim_clock *clock)
+{
+    clock->t = 0.0;
+    clock->dt = 0.002;
+    clock->accumulator = 0.0;
+    clock->max_steps_per_frame = 25;
+    clock->num_steps = 0;
+    clock->num_dropped_steps = 0;
+}
+
+static void
+sim_bobs (struct sim_clock *clock,
+          struct bob *bobs, size_t num_bobs,
+          double elapsed)
+{
+    int steps = 0;
+    double alpha;
+    size_t i;
+
+    clock->accumulator += elapsed;
 
+    while (clock->accumulator >= clock->dt) {
+        if (steps == clock->max_steps_per_frame) {
+            unsigned long dropped = clock->accumulator / clock->dt;
+            clock->num_dropped_steps += dropped;
+            clock->accumulator -= dropped * clock->dt;
+            break;
         }
 
+        for (i=0; i<num_bobs; i++)
+            bobs[i].prev_pos = bobs[i].pos;
 
-        t += dt;
-        if (t + dt >= t1)
-            dt = t1 - t + 1e-6;
+        sim_step (bobs, num_bobs, clock->t, clock->dt);
+        clock->t += clock->dt;
+        clock->accumulator -= clock->dt;
+        clock->num_steps++;
+        steps++;
     }
 
-    return t1;
+    alpha = clock->accumulator / clock->dt;
+    for (i=0; i<num_bobs; i++) {
+        struct bob *bob = bobs + i;
+        bob->draw_pos.x = bob->prev_pos.x + alpha*(bob->pos.x - bob->prev_pos.x);
+        bob->draw_pos.y = bob->prev_pos.y + alpha*(bob->pos.y - bob->prev_pos.y);
+    }
 }
 
+/* With -record FILE every frame is also written into a Y4M file, or
+ * raw BGRA for other file names, with - for Y4M on the standard
+ * output.  The recording keeps the size of the first frame.  The
+ * simulation then steps by 1/record_fps per frame instead of following
+ * the clock, so frames are drawn as fast as they can be and still play
+ * back at the right speed.  With -remote ADDRESS the tiles of every
+ * frame that changed are sent to a remote-viewer listening at the
+ * address. */
+static char const *record_filename = NULL;
+static int record_fps = 60;
+static cairosdl_record_t *frame_record = NULL;
+static char const *remote_address = NULL;
+static cairosdl_remote_t *frame_remote = NULL;
+
+/* Where the reports go, which is stderr when -record - sends the
+ * recording to the standard output. */
+static FILE *report_file = NULL;
+
+/* What the frames sent to the remote viewer cost. */
+static struct {
+    unsigned long num_frames;
+    double bytes;
+    double encode_time;
+} remote_stats;
+
 static void
-push_expose ()
+destroy_frame_copies (void)
 {
-    SDL_Event event[1];
-    event->type = SDL_VIDEOEXPOSE;
-    if (SDL_PushEvent (event) != 0) {
-        fprintf (stderr, "Failed to push an expose event: %s\n",
-                 SDL_GetError ());
+    if (cairosdl_record_destroy (frame_record) != 0)
+        fprintf (stderr, "Failed to record: %s\n", SDL_GetError ());
+    frame_record = NULL;
+    cairosdl_remote_destroy (frame_remote);
+    frame_remote = NULL;
+}
+
+static void
+record_frame (SDL_Surface *frame)
+{
+    if (frame_record == NULL) {
+        frame_record = cairosdl_record_open (record_filename,
+                                             frame->w, frame->h,
+                                             record_fps);
+        if (frame_record == NULL) {
+            fprintf (stderr, "Failed to record: %s\n", SDL_GetError ());
+            record_filename = NULL;
+            return;
+        }
+    }
+    if (cairosdl_record_frame (frame_record, frame) != 0) {
+        fprintf (stderr, "Failed to record a frame: %s\n", SDL_GetError ());
+        record_filename = NULL;
+    }
+}
+
+static void
+send_frame (SDL_Surface *frame)
+{
+    cairosdl_remote_stats_t stats;
+
+    if (frame_remote == NULL) {
+        frame_remote = cairosdl_remote_connect (remote_address);
+        if (frame_remote == NULL) {
+            fprintf (stderr, "Failed to connect to a remote viewer: %s\n",
+                     SDL_GetError ());
+            remote_address = NULL;
+            return;
+        }
+    }
+    if (cairosdl_remote_send_frame (frame_remote, frame, &stats) != 0) {
+        fprintf (stderr, "Failed to send a frame: %s\n", SDL_GetError ());
+        remote_address = NULL;
+        return;
     }
+    remote_stats.num_frames++;
+    remote_stats.bytes += stats.bytes;
+    remote_stats.encode_time += stats.encode_time;
+}
+
+/* Hand a finished frame to the recording and the remote viewer. */
+static void
+copy_out_frame (SDL_Surface *frame)
+{
+    if (record_filename == NULL && remote_address == NULL)
+        return;
+
+    if (SDL_MUSTLOCK (frame) && SDL_LockSurface (frame) != 0)
+        return;
+    if (record_filename != NULL)
+        record_frame (frame);
+    if (remote_address != NULL)
+        send_frame (frame);
+    if (SDL_MUSTLOCK (frame))
+        SDL_UnlockSurface (frame);
 }
 
 static void
@@ -375,11 +637,54 @@ on_expose (struct bob *bobs, size_t num_bobs)
     if (BLIT_BOBS_USING_CAIRO)
         blit_bobs_using_cairo (bobs, num_bobs);
     else
-        blit_bobs_using_sdl (bobs, num_bobs);
+        blit_bobs_using_blit_image (bobs, num_bobs);
 
+    copy_out_frame (screen);
     SDL_Flip (screen);
+}
+
+/* The stats are printed from the main loop, which owns the counters;
+ * the timer only asks for it. */
+#define PRINT_STATS_EVENT SDL_USEREVENT
+#define STATS_INTERVAL 5000
+
+static Uint32
+print_stats_timer (Uint32 interval, void *param)
+{
+    SDL_Event event[1];
+
+    (void)param;
+    event->type = PRINT_STATS_EVENT;
+    SDL_PushEvent (event);
+    return interval;
+}
 
-    push_expose ();             /* Schedule another expose soon, */
+static void
+print_stats (struct sim_clock *clock)
+{
+    static unsigned long last_num_frames = 0;
+    static double last_cpu_time = 0;
+    unsigned long num_frames = scheduler.num_frames - last_num_frames;
+    double cpu_time = frame_scheduler_cpu_time ();
+
+    fprintf(report_file, "%lu simulation steps in %u ms, %lu dropped",
+            clock->num_steps, STATS_INTERVAL, clock->num_dropped_steps);
+    if (num_frames > 0) {
+        fprintf(report_file, ", %lu frames, %.2f ms CPU per frame",
+                num_frames, 1000.0*(cpu_time - last_cpu_time) / num_frames);
+    }
+    if (remote_stats.num_frames > 0) {
+        fprintf(report_file,
+                ", remote %.1f KB and %.2f ms to encode per frame",
+                remote_stats.bytes / 1024 / remote_stats.num_frames,
+                remote_stats.encode_time * 1000 / remote_stats.num_frames);
+        memset (&remote_stats, 0, sizeof (remote_stats));
+    }
+    fprintf(report_file, "\n");
+    clock->num_steps = 0;
+    clock->num_dropped_steps = 0;
+    last_num_frames += num_frames;
+    last_cpu_time = cpu_time;
 }
 
 static void
@@ -388,18 +693,42 @@ event_loop (unsigned flags, int width, int height)
     struct bob bobs[MAX_BOBS];
     size_t num_bobs = MAX_BOBS;
 
-    double t0 = SDL_GetTicks () / 1000.0; /* Current simulation time.. */
-    double t1;                  /* Next simulation time. */
+    struct sim_clock clock[1];
+    Uint32 last_ticks = SDL_GetTicks ();
     SDL_Event event[1];
+    int status;
 
     init_bobs (bobs, num_bobs);
+    init_sim_clock (clock);
+    if (record_filename != NULL &&
+        clock->max_steps_per_frame * clock->dt * record_fps < 1.0)
+    {
+        /* Recorded frames never drop steps. */
+        clock->max_steps_per_frame = (int)(1.0 / (clock->dt * record_fps)) + 1;
+    }
 
     event->resize.type = SDL_VIDEORESIZE;
     event->resize.w = width;
     event->resize.h = height;
     SDL_PushEvent (event);
 
-    while (SDL_WaitEvent (event)) {
+    SDL_AddTimer (STATS_INTERVAL, print_stats_timer, NULL);
+
+    while ((status = frame_scheduler_next_event (&scheduler, event)) >= 0) {
+        if (status == 0) {
+            Uint32 ticks = SDL_GetTicks ();
+            double elapsed = (ticks - last_ticks) / 1000.0;
+            if (record_filename != NULL)
+                elapsed = 1.0 / record_fps;
+            sim_bobs (clock, bobs, num_bobs, elapsed);
+            last_ticks = ticks;
+            render_bobs (bobs, num_bobs);
+            on_expose (bobs, num_bobs);
+            governor_frame (&governor, (SDL_GetTicks () - ticks) / 1000.0);
+            frame_scheduler_frame_done (&scheduler);
+            continue;
+        }
+
         switch (event->type) {
         case SDL_VIDEORESIZE:
             if (SDL_SetVideoMode (event->resize.w,
@@ -411,30 +740,54 @@ event_loop (unsigned flags, int width, int height)
                 exit (1);
             }
             alloc_bobs (bobs, num_bobs);
-            render_bobs (bobs, num_bobs);
-            /* fallthrough  */
-
-        case SDL_VIDEOEXPOSE:
-            t1 = SDL_GetTicks () / 1000.0;
-            render_bobs (bobs, num_bobs);
-            t0 = sim_bobs (bobs, num_bobs, t0, t1);
-            on_expose (bobs, num_bobs);
             break;
 
         case SDL_KEYDOWN:
             if (event->key.keysym.sym == SDLK_q)
                 return;
+            break;
+
+        case PRINT_STATS_EVENT:
+            print_stats (clock);
+            break;
         }
     }
     fprintf (stderr, "WaitEvent failed: %s\n", SDL_GetError ());
 }
 
 int
-main()
+main (int argc, char **argv)
 {
     int width = 600;
     int height = 600;
     int flags = SDL_INIT_TIMER | SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE;
+    double target_fps = 0;
+    int i;
+
+    for (i=1; i<argc; i++) {
+        if (0 == strcmp(argv[i], "-target-fps") && i+1 < argc) {
+            target_fps = atof(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-record") && i+1 < argc) {
+            record_filename = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-remote") && i+1 < argc) {
+            remote_address = argv[++i];
+        }
+        else {
+            fprintf(stderr, "usage: [-target-fps F] [-record FILE.y4m|-] "
+                    "[-remote ADDRESS]\n");
+        }
+    }
+    if (target_fps >= 1)
+        record_fps = (int)(target_fps + 0.5);
+    report_file = stdout;
+    if (record_filename != NULL && 0 == strcmp (record_filename, "-"))
+        report_file = stderr;
+
+    governor_init (&governor, target_fps);
+    governor.log = report_file;
+    frame_scheduler_init (&scheduler, FRAME_SCHEDULE_TARGET, target_fps);
 
     if (SDL_Init (flags) < 0) {
         fprintf (stderr, "Failed to initialise SDL: %s\n",
@@ -442,6 +795,8 @@ main()
         exit (1);
     }
     atexit (SDL_Quit);
+    if (record_filename != NULL || remote_address != NULL)
+        atexit (destroy_frame_copies);
 
     if (1) {
         event_loop (
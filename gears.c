@@ -27,6 +27,12 @@
 #include <stdlib.h>
 #include <cairo.h>
 #include <math.h>
+#include "cairosdl.h"
+#include "cairosdl-export.h"
+#include "cairosdl-record.h"
+#include "cairosdl-remote.h"
+#include "governor.h"
+#include "frame-scheduler.h"
 
 #define LINEWIDTH 3.0
 
@@ -45,11 +51,119 @@
 #define CHEAT_SHADOWS 1         /* 1: use opaque gear shadows,
                                  * 0: semitransparent shadows like qgears2 */
 
-static double animpts[NUMPTS * 2];
-static double deltas[NUMPTS * 2];
+struct blob {
+    double pts[NUMPTS * 2];
+    double deltas[NUMPTS * 2];
+};
+
+/* With -gears N and -blobs M the window is divided into a grid of N
+ * gear trains and a separate grid of M blobs, each blob bouncing
+ * around in its own cell.  The blobs are placed by a fixed seed so
+ * that runs are comparable. */
+static int num_gear_trains = 1;
+static int num_blobs = 1;
+static struct blob default_blob;
+static struct blob *blobs = &default_blob;
+static int blobs_placed = 1;
+
+#define BLOB_SEED 20040101
+
+struct grid_cell {
+    int x, y;
+    int width, height;
+};
+
+/* The index'th of count equally sized cells laid out in a grid as
+ * square as possible over a w by h window. */
+static void
+grid_cell (int index, int count, int w, int h, struct grid_cell *cell)
+{
+    int cols = (int)ceil (sqrt ((double)count));
+    int rows = (count + cols - 1) / cols;
+
+    cell->width = w >= cols ? w / cols : 1;
+    cell->height = h >= rows ? h / rows : 1;
+    cell->x = (index % cols) * w / cols;
+    cell->y = (index / cols) * h / rows;
+}
 
 static int fill_gradient = 0;
 
+/* Where the reports go, which is stderr when -record - sends the
+ * recording to the standard output. */
+static FILE *report_file = NULL;
+
+/* With -target-fps F the governor trades quality for speed to keep
+ * frames within budget. */
+static struct governor governor;
+
+/* With -dynres the frames are drawn at a reduced resolution picked
+ * from the frame times and upscaled when flushed to the screen. */
+static int use_dynres = 0;
+static struct resolution_governor resolution;
+
+/* Frames are paced to -target-fps, or drawn as fast as events allow
+ * without it.  With -pipeline the render thread does the pacing. */
+static struct frame_scheduler scheduler;
+
+/* The -dynres surfaces are kept from frame to frame, one for the
+ * screen or each -pipeline buffer, and only made again when the scale
+ * or the size of their target changes. */
+#define NUM_SCALED_SURFACES 4
+static cairo_surface_t *scaled_surfaces[NUM_SCALED_SURFACES];
+static int next_scaled_surface = 0;
+
+static cairo_surface_t *
+get_scaled_surface (SDL_Surface *target, double scale)
+{
+    cairo_surface_t **slot = NULL;
+    int width = (int)ceil (target->w * scale);
+    int height = (int)ceil (target->h * scale);
+    int i;
+
+    for (i = 0; i < NUM_SCALED_SURFACES; i++) {
+        if (scaled_surfaces[i] != NULL &&
+            cairosdl_surface_get_target (scaled_surfaces[i]) == target)
+            slot = scaled_surfaces + i;
+    }
+    if (slot == NULL) {
+        /* Surfaces of targets that are gone make way in turn. */
+        slot = scaled_surfaces + next_scaled_surface;
+        next_scaled_surface = (next_scaled_surface + 1) % NUM_SCALED_SURFACES;
+    }
+
+    if (*slot == NULL ||
+        cairosdl_surface_get_target (*slot) != target ||
+        cairosdl_surface_get_scale (*slot) != scale ||
+        cairo_image_surface_get_width (*slot) != width ||
+        cairo_image_surface_get_height (*slot) != height)
+    {
+        if (*slot)
+            cairo_surface_destroy (*slot);
+        *slot = cairosdl_surface_create_scaled (target, scale,
+                                                CAIROSDL_SCALE_BILINEAR);
+    }
+    return cairo_surface_reference (*slot);
+}
+
+static cairo_surface_t *
+get_screen_surface (SDL_Surface *screen)
+{
+    int i;
+
+    if (use_dynres && resolution.scale < 1.0)
+        return get_scaled_surface (screen, resolution.scale);
+
+    /* Back at full resolution the shadows aren't needed. */
+    for (i = 0; i < NUM_SCALED_SURFACES; i++) {
+        if (scaled_surfaces[i] != NULL) {
+            cairo_surface_destroy (scaled_surfaces[i]);
+            scaled_surfaces[i] = NULL;
+        }
+    }
+    return cairosdl_surface_create (screen);
+}
+
 static void
 gear (cairo_t *cr,
 	double inner_radius,
@@ -97,24 +211,90 @@ gear (cairo_t *cr,
     cairo_close_path (cr);
 }
 
+/* The gears never change shape, only rotate, so by default their
+ * paths are built once and replayed under the current transform.
+ * Replaying still puts every point through the transform, so what's
+ * saved is gear()'s cos() and sin() calls, whatever the window size.
+ * That only shows with lots of gear trains; compare -gears 100 with
+ * and without -nocache to see what it's worth. */
+static int cache_gear_paths = 1;
+
+struct gear_shape {
+    double inner_radius;
+    double outer_radius;
+    int teeth;
+    double tooth_depth;
+    cairo_path_t *path;         /* lazily built by gear_shape_path() */
+};
+
+static struct gear_shape gear_shapes[3] = {
+    { 30.0, 120.0, 20, 20.0, NULL },
+    { 15.0,  75.0, 12, 20.0, NULL },
+    { 20.0,  90.0, 14, 20.0, NULL },
+};
+
+/* Build the gear's path in untransformed user space. */
+static cairo_path_t *
+build_gear_path (struct gear_shape const *shape)
+{
+    cairo_surface_t *scratch = cairo_image_surface_create (CAIRO_FORMAT_A8, 1, 1);
+    cairo_t *cr = cairo_create (scratch);
+    cairo_path_t *path;
+
+    gear (cr,
+          shape->inner_radius, shape->outer_radius,
+          shape->teeth, shape->tooth_depth);
+    path = cairo_copy_path (cr);
+
+    cairo_destroy (cr);
+    cairo_surface_destroy (scratch);
+    return path;
+}
+
+/* Set the current path of cr to the gear's outline. */
+static void
+gear_shape_path (cairo_t *cr, struct gear_shape *shape)
+{
+    if (!cache_gear_paths) {
+        gear (cr,
+              shape->inner_radius, shape->outer_radius,
+              shape->teeth, shape->tooth_depth);
+        return;
+    }
+
+    if (shape->path == NULL)
+        shape->path = build_gear_path (shape);
+
+    cairo_new_path (cr);
+    cairo_append_path (cr, shape->path);
+}
+
 void
 trap_setup (cairo_surface_t *target, int w, int h)
 {
-    int i;
+    int b, i;
 
     (void)target;
     //cairo_scale (cr, 3.0, 1.0);
 
-    for (i = 0; i < (NUMPTS * 2); i += 2) {
-	animpts[i + 0] = (float) (drand48 () * w);
-	animpts[i + 1] = (float) (drand48 () * h);
-	deltas[i + 0] = (float) (drand48 () * 6.0 + 4.0);
-	deltas[i + 1] = (float) (drand48 () * 6.0 + 4.0);
-	if (animpts[i + 0] > w / 2.0) {
-	    deltas[i + 0] = -deltas[i + 0];
-	}
-	if (animpts[i + 1] > h / 2.0) {
-	    deltas[i + 1] = -deltas[i + 1];
+    for (b = 0; b < num_blobs; b++) {
+	double *animpts = blobs[b].pts;
+	double *deltas = blobs[b].deltas;
+	struct grid_cell cell;
+
+	grid_cell (b, num_blobs, w, h, &cell);
+
+	for (i = 0; i < (NUMPTS * 2); i += 2) {
+	    animpts[i + 0] = (float) (drand48 () * cell.width);
+	    animpts[i + 1] = (float) (drand48 () * cell.height);
+	    deltas[i + 0] = (float) (drand48 () * 6.0 + 4.0);
+	    deltas[i + 1] = (float) (drand48 () * 6.0 + 4.0);
+	    if (animpts[i + 0] > cell.width / 2.0) {
+		deltas[i + 0] = -deltas[i + 0];
+	    }
+	    if (animpts[i + 1] > cell.height / 2.0) {
+		deltas[i + 1] = -deltas[i + 1];
+	    }
 	}
     }
 }
@@ -140,113 +320,284 @@ stroke_and_fill_animate (double *pts,
 static void
 stroke_and_fill_step (int w, int h)
 {
-    int i;
+    int b, i;
+
+    for (b = 0; b < num_blobs; b++) {
+	struct grid_cell cell;
 
-    for (i = 0; i < (NUMPTS * 2); i += 2) {
-	stroke_and_fill_animate (animpts, deltas, i + 0, w);
-	stroke_and_fill_animate (animpts, deltas, i + 1, h);
+	grid_cell (b, num_blobs, w, h, &cell);
+	for (i = 0; i < (NUMPTS * 2); i += 2) {
+	    stroke_and_fill_animate (blobs[b].pts, blobs[b].deltas,
+				     i + 0, cell.width);
+	    stroke_and_fill_animate (blobs[b].pts, blobs[b].deltas,
+				     i + 1, cell.height);
+	}
     }
 }
 
-static double gear1_rotation = 0.35;
-static double gear2_rotation = 0.33;
-static double gear3_rotation = 0.50;
+static double gear_rotation[3] = { 0.35, 0.33, 0.50 };
+static double const gear_position[3][2] = {
+    { 170.0, 330.0 },
+    { 369.0, 330.0 },
+    { 170.0, 116.0 },
+};
 
-void
-trap_render (cairo_t *cr, int w, int h)
+static void
+draw_gear_shadow (cairo_t *cr,
+                  double const position[2],
+                  double rotation,
+                  struct gear_shape *shape)
 {
-    double *ctrlpts = animpts;
-    int len = (NUMPTS * 2);
-    double prevx = ctrlpts[len - 2];
-    double prevy = ctrlpts[len - 1];
-    double curx = ctrlpts[0];
-    double cury = ctrlpts[1];
-    double midx = (curx + prevx) / 2.0;
-    double midy = (cury + prevy) / 2.0;
-    int i;
-    int pass;
-
-    cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
-
-    cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 1.0);
-    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-    cairo_rectangle (cr, 0, 0, w, h);
-    cairo_fill (cr);
-    cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
-    cairo_set_source_rgba (cr, 0.75, 0.75, 0.75, 1.0);
-    cairo_set_line_width (cr, 1.0);
+    cairo_save (cr); {
+        cairo_translate (cr, -10.0, -10.0);
+        cairo_translate (cr, position[0], position[1]);
+        cairo_rotate (cr, rotation);
+        gear_shape_path (cr, shape);
+        cairo_set_source_rgba (cr, 0.70, 0.70, 0.70, 0.70 + CHEAT_SHADOWS);
+        cairo_fill (cr);
+        cairo_restore (cr);
+    }
+}
 
+static void
+draw_gear_body (cairo_t *cr,
+                double const position[2],
+                double rotation,
+                struct gear_shape *shape)
+{
     cairo_save (cr); {
-        cairo_scale (cr, (double) w / 512.0, (double) h / 512.0);
+        cairo_translate (cr, position[0], position[1]);
+        cairo_rotate (cr, rotation);
+        gear_shape_path (cr, shape);
+        cairo_set_source_rgb (cr, 0.75, 0.75, 0.75);
+        cairo_fill_preserve (cr);
+        cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
+        cairo_stroke (cr);
+        cairo_restore (cr);
+    }
+}
 
-        cairo_save (cr); {
-            cairo_translate (cr, -10.0, -10.0);
-            cairo_translate (cr, 170.0, 330.0);
-            cairo_rotate (cr, gear1_rotation);
-            gear (cr, 30.0, 120.0, 20, 20.0);
-            cairo_set_source_rgba (cr, 0.70, 0.70, 0.70, 0.70 + CHEAT_SHADOWS);
-            cairo_fill (cr);
-            cairo_restore (cr);
-        }
-        cairo_save (cr); {
-            cairo_translate (cr, -10.0, -10.0);
-            cairo_translate (cr, 369.0, 330.0);
-            cairo_rotate (cr, gear2_rotation);
-            gear (cr, 15.0, 75.0, 12, 20.0);
-            cairo_set_source_rgba (cr, 0.70, 0.70, 0.70, 0.70 + CHEAT_SHADOWS);
-            cairo_fill (cr);
-            cairo_restore (cr);
-        }
-        cairo_save (cr); {
-            cairo_translate (cr, -10.0, -10.0);
-            cairo_translate (cr, 170.0, 116.0);
-            cairo_rotate (cr, gear3_rotation);
-            gear (cr, 20.0, 90.0, 14, 20.0);
-            cairo_set_source_rgba (cr, 0.70, 0.70, 0.70, 0.70 + CHEAT_SHADOWS);
-            cairo_fill (cr);
-            cairo_restore (cr);
+/* With -sprites N the gears aren't rasterised every frame.  Instead
+ * each gear and its shadow are pre-rendered at N rotation steps over
+ * one tooth (the gears look the same after turning by a tooth) into a
+ * sprite sheet, and the nearest step is composited each frame.  The
+ * sheets are big: with 16 steps they're 17 MB for a 512x512 cell and
+ * 69 MB for 1024x1024, and building them rasterises 6N gears.  In
+ * return compositing a gear train took about 0.3 ms per frame at
+ * 512x512 and 1 ms at 1024x1024 against a stub cairo with discs
+ * standing in for the gears, not a real desktop.  The time and memory
+ * are printed when the sheets are built. */
+static int num_sprite_frames = 0;
+
+struct gear_sheet {
+    cairo_surface_t *surface;   /* shadows in row 0, bodies in row 1 */
+    int cell_width;
+    int cell_height;
+    int shadow_x, shadow_y;     /* where the cells go in the target */
+    int body_x, body_y;
+};
+
+static struct gear_sheet gear_sheets[3];
+static int gear_sheets_width = 0;
+static int gear_sheets_height = 0;
+
+static void
+build_gear_sheets (int w, int h)
+{
+    double sx = w / 512.0;
+    double sy = h / 512.0;
+    Uint32 start = SDL_GetTicks ();
+    unsigned long num_bytes = 0;
+    int g, k;
+
+    for (g = 0; g < 3; g++) {
+        struct gear_sheet *sheet = gear_sheets + g;
+        struct gear_shape *shape = gear_shapes + g;
+        double const *position = gear_position[g];
+        /* Outer radius including the teeth and half the outline. */
+        double r = shape->outer_radius + shape->tooth_depth / 2.0 + 1.0;
+        double period = 2.0 * M_PI / shape->teeth;
+        cairo_t *cr;
+
+        if (sheet->surface)
+            cairo_surface_destroy (sheet->surface);
+
+        sheet->cell_width = (int)ceil (2.0 * r * sx) + 3;
+        sheet->cell_height = (int)ceil (2.0 * r * sy) + 3;
+        sheet->body_x = (int)floor ((position[0] - r) * sx) - 1;
+        sheet->body_y = (int)floor ((position[1] - r) * sy) - 1;
+        sheet->shadow_x = (int)floor ((position[0] - 10.0 - r) * sx) - 1;
+        sheet->shadow_y = (int)floor ((position[1] - 10.0 - r) * sy) - 1;
+
+        sheet->surface = cairo_image_surface_create (
+            CAIRO_FORMAT_ARGB32,
+            sheet->cell_width * num_sprite_frames,
+            sheet->cell_height * 2);
+        num_bytes += cairo_image_surface_get_stride (sheet->surface) *
+            (unsigned long)cairo_image_surface_get_height (sheet->surface);
+
+        cr = cairo_create (sheet->surface);
+        cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
+        cairo_set_line_width (cr, 1.0);
+
+        for (k = 0; k < num_sprite_frames; k++) {
+            double rotation = k * period / num_sprite_frames;
+            int cell_x = k * sheet->cell_width;
+
+            cairo_save (cr); {
+                cairo_rectangle (cr, cell_x, 0,
+                                 sheet->cell_width, sheet->cell_height);
+                cairo_clip (cr);
+                cairo_translate (cr, cell_x - sheet->shadow_x,
+                                 -sheet->shadow_y);
+                cairo_scale (cr, sx, sy);
+                draw_gear_shadow (cr, position, rotation, shape);
+                cairo_restore (cr);
+            }
+            cairo_save (cr); {
+                cairo_rectangle (cr, cell_x, sheet->cell_height,
+                                 sheet->cell_width, sheet->cell_height);
+                cairo_clip (cr);
+                cairo_translate (cr, cell_x - sheet->body_x,
+                                 sheet->cell_height - sheet->body_y);
+                cairo_scale (cr, sx, sy);
+                draw_gear_body (cr, position, rotation, shape);
+                cairo_restore (cr);
+            }
         }
 
-        cairo_save (cr); {
-            cairo_translate (cr, 170.0, 330.0);
-            cairo_rotate (cr, gear1_rotation);
-            gear (cr, 30.0, 120.0, 20, 20.0);
-            cairo_set_source_rgb (cr, 0.75, 0.75, 0.75);
-            cairo_fill_preserve (cr);
-            cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
-            cairo_stroke (cr);
-            cairo_restore (cr);
+        if (cairo_status (cr) != CAIRO_STATUS_SUCCESS) {
+            fprintf (stderr, "Failed to render gear sprites: %s\n",
+                     cairo_status_to_string (cairo_status (cr)));
+            exit (1);
         }
-        cairo_save (cr); {
-            cairo_translate (cr, 369.0, 330.0);
-            cairo_rotate (cr, gear2_rotation);
-            gear (cr, 15.0, 75.0, 12, 20.0);
-            cairo_set_source_rgb (cr, 0.75, 0.75, 0.75);
-            cairo_fill_preserve (cr);
-            cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
-            cairo_stroke (cr);
-            cairo_restore (cr);
+        cairo_destroy (cr);
+    }
+
+    gear_sheets_width = w;
+    gear_sheets_height = h;
+
+    fprintf (report_file,
+             "pre-rendered %d rotation steps per gear at %dx%d "
+             "in %u ms, %lu KB\n",
+             num_sprite_frames, w, h,
+             SDL_GetTicks () - start, num_bytes / 1024);
+}
+
+/* Composite the gears of every gear train from the sprite sheets,
+ * which are built for the size of a grid cell. */
+static void
+composite_gear_sprites (cairo_t *cr, int w, int h)
+{
+    cairosdl_sprite_t shadows[3];
+    cairosdl_sprite_t bodies[3];
+    struct grid_cell cell;
+    int g, t;
+
+    grid_cell (0, num_gear_trains, w, h, &cell);
+    if (cell.width != gear_sheets_width || cell.height != gear_sheets_height)
+        build_gear_sheets (cell.width, cell.height);
+
+    for (g = 0; g < 3; g++) {
+        struct gear_sheet *sheet = gear_sheets + g;
+        double period = 2.0 * M_PI / gear_shapes[g].teeth;
+        double phase = fmod (gear_rotation[g], period);
+        int k;
+
+        if (phase < 0)
+            phase += period;
+        k = (int)floor (phase / period * num_sprite_frames + 0.5);
+        k %= num_sprite_frames;
+
+        shadows[g].source = sheet->surface;
+        shadows[g].src_x = k * sheet->cell_width;
+        shadows[g].src_y = 0;
+        shadows[g].width = sheet->cell_width;
+        shadows[g].height = sheet->cell_height;
+        shadows[g].opacity = 1.0;
+        shadows[g].spans = NULL;
+
+        bodies[g] = shadows[g];
+        bodies[g].src_y = sheet->cell_height;
+    }
+
+    /* All the shadows go under all the gears. */
+    for (t = 0; t < num_gear_trains; t++) {
+        grid_cell (t, num_gear_trains, w, h, &cell);
+        for (g = 0; g < 3; g++) {
+            shadows[g].dst_x = cell.x + gear_sheets[g].shadow_x;
+            shadows[g].dst_y = cell.y + gear_sheets[g].shadow_y;
         }
-        cairo_save (cr); {
-            cairo_translate (cr, 170.0, 116.0);
-            cairo_rotate (cr, gear3_rotation);
-            gear (cr, 20.0, 90.0, 14, 20.0);
-            cairo_set_source_rgb (cr, 0.75, 0.75, 0.75);
-            cairo_fill_preserve (cr);
-            cairo_set_source_rgb (cr, 0.25, 0.25, 0.25);
-            cairo_stroke (cr);
-            cairo_restore (cr);
+        cairosdl_composite_sprites (cairo_get_target (cr), 3, shadows);
+    }
+    for (t = 0; t < num_gear_trains; t++) {
+        grid_cell (t, num_gear_trains, w, h, &cell);
+        for (g = 0; g < 3; g++) {
+            bodies[g].dst_x = cell.x + gear_sheets[g].body_x;
+            bodies[g].dst_y = cell.y + gear_sheets[g].body_y;
         }
+        cairosdl_composite_sprites (cairo_get_target (cr), 3, bodies);
+    }
+}
 
-        cairo_restore (cr);
+/* Build up front whatever trap_draw() would otherwise build lazily,
+ * so that it only reads shared state and can draw several tiles of a
+ * frame at the same time. */
+static void
+trap_prepare (int w, int h)
+{
+    int i;
+
+    if (!blobs_placed) {
+        srand48 (BLOB_SEED);
+        trap_setup (NULL, w, h);
+        blobs_placed = 1;
+    }
+
+    if (num_gear_trains == 0) {
+        /* nothing to build */
     }
+    else if (num_sprite_frames > 0) {
+        struct grid_cell cell;
 
-    gear1_rotation += 0.01;
-    gear2_rotation -= (0.01 * (20.0 / 12.0));
-    gear3_rotation -= (0.01 * (20.0 / 14.0));
+        grid_cell (0, num_gear_trains, w, h, &cell);
+        if (cell.width != gear_sheets_width ||
+            cell.height != gear_sheets_height)
+            build_gear_sheets (cell.width, cell.height);
+    }
+    else if (cache_gear_paths) {
+        for (i = 0; i < 3; i++) {
+            if (gear_shapes[i].path == NULL)
+                gear_shapes[i].path = build_gear_path (&gear_shapes[i]);
+        }
+    }
+}
+
+/* Advance the animation by a frame. */
+static void
+trap_step (int w, int h)
+{
+    gear_rotation[0] += 0.01;
+    gear_rotation[1] -= (0.01 * (20.0 / 12.0));
+    gear_rotation[2] -= (0.01 * (20.0 / 14.0));
 
     stroke_and_fill_step (w, h);
+}
+
+static void
+draw_blob (cairo_t *cr, double const *ctrlpts)
+{
+    int len = (NUMPTS * 2);
+    double prevx = ctrlpts[len - 2];
+    double prevy = ctrlpts[len - 1];
+    double curx = ctrlpts[0];
+    double cury = ctrlpts[1];
+    double midx = (curx + prevx) / 2.0;
+    double midy = (cury + prevy) / 2.0;
+    int i;
+    int pass;
 
+    cairo_save (cr);
     cairo_translate (cr, -10, -10);
     for (pass = 1; pass <= 2; pass++) {
         cairo_new_path (cr);
@@ -280,7 +631,7 @@ trap_render (cairo_t *cr, int w, int h)
         }
     }
 
-    if (fill_gradient) {
+    if (fill_gradient && governor_use_gradients (&governor)) {
 	double x1, y1, x2, y2;
 	cairo_pattern_t *pattern;
 
@@ -302,50 +653,557 @@ trap_render (cairo_t *cr, int w, int h)
     cairo_set_source_rgba (cr, STROKE_R, STROKE_G, STROKE_B, STROKE_OPACITY);
     cairo_set_line_width (cr, LINEWIDTH);
     cairo_stroke (cr);
+    cairo_restore (cr);
+}
+
+static void
+trap_draw (cairo_t *cr, int w, int h)
+{
+    struct grid_cell cell;
+    int i, t;
+
+    cairo_set_fill_rule (cr, CAIRO_FILL_RULE_EVEN_ODD);
+    governor_apply (&governor, cr, 0.1);
+
+    cairo_set_source_rgba (cr, 1.0, 1.0, 1.0, 1.0);
+    cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+    cairo_rectangle (cr, 0, 0, w, h);
+    cairo_fill (cr);
+    cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+    cairo_set_source_rgba (cr, 0.75, 0.75, 0.75, 1.0);
+    cairo_set_line_width (cr, 1.0);
+
+    if (num_gear_trains == 0) {
+        /* blobs only */
+    }
+    else if (num_sprite_frames > 0) {
+        composite_gear_sprites (cr, w, h);
+    }
+    else {
+        for (t = 0; t < num_gear_trains; t++) {
+            grid_cell (t, num_gear_trains, w, h, &cell);
+            cairo_save (cr); {
+                cairo_translate (cr, cell.x, cell.y);
+                cairo_scale (cr, cell.width / 512.0, cell.height / 512.0);
+                for (i = 0; i < 3; i++)
+                    draw_gear_shadow (cr, gear_position[i], gear_rotation[i],
+                                      &gear_shapes[i]);
+                cairo_restore (cr);
+            }
+        }
+        for (t = 0; t < num_gear_trains; t++) {
+            grid_cell (t, num_gear_trains, w, h, &cell);
+            cairo_save (cr); {
+                cairo_translate (cr, cell.x, cell.y);
+                cairo_scale (cr, cell.width / 512.0, cell.height / 512.0);
+                for (i = 0; i < 3; i++)
+                    draw_gear_body (cr, gear_position[i], gear_rotation[i],
+                                    &gear_shapes[i]);
+                cairo_restore (cr);
+            }
+        }
+    }
+
+    for (i = 0; i < num_blobs; i++) {
+        grid_cell (i, num_blobs, w, h, &cell);
+        cairo_save (cr); {
+            cairo_translate (cr, cell.x, cell.y);
+            draw_blob (cr, blobs[i].pts);
+            cairo_restore (cr);
+        }
+    }
+}
+
+void
+trap_render (cairo_t *cr, int w, int h)
+{
+    trap_prepare (w, h);
+    trap_draw (cr, w, h);
+    trap_step (w, h);
+}
+
+/* With -threads N each frame is drawn by N threads, a band of the
+ * window each. */
+static int num_render_threads = 0;
+
+struct trap_size {
+    int w, h;
+};
+
+static void
+trap_draw_tile (cairo_t *cr, void *closure)
+{
+    struct trap_size const *size = (struct trap_size const *)closure;
+    trap_draw (cr, size->w, size->h);
+}
+
+static cairo_status_t
+trap_render_tiled (cairo_surface_t *surface, int w, int h)
+{
+    struct trap_size size;
+    cairo_status_t status;
+    int band_height;
+
+    size.w = w;
+    size.h = h;
+
+    /* A few bands per thread so that uneven bands even out. */
+    band_height = (h + 4*num_render_threads - 1) / (4*num_render_threads);
+    if (band_height < 16)
+        band_height = 16;
+
+    trap_prepare (w, h);
+    status = cairosdl_surface_draw_tiled (surface, w, band_height,
+                                          trap_draw_tile, &size);
+    trap_step (w, h);
+
+    return status;
 }
 
 
 /* SDL code */
-#include "cairosdl.h"
+
+/* Counters for the stats printed every five seconds.  The latency is
+ * from the first input event after the last frame started drawing to
+ * the present of the next frame. */
+struct frame_stats {
+    unsigned num_presented;
+    unsigned num_rendered;
+    unsigned num_dropped;       /* rendered but replaced unseen */
+    unsigned num_latencies;
+    Uint32 latency_sum;
+    Uint32 latency_max;
+    double cpu_time;            /* process CPU seconds at the last print */
+    unsigned lock_time_us;      /* target held locked by rendered frames */
+    unsigned num_remote_frames; /* encoded for -remote */
+    unsigned remote_bytes;
+    unsigned remote_encode_us;
+};
+
+static struct frame_stats frame_stats;
+
+/* Ticks of the first input event not yet seen by a frame, or 0. */
+static Uint32 pending_input_ticks = 0;
+
+/* The render thread and the main thread share a few words without
+ * locks. */
+#define shared_load(p) __atomic_load_n ((p), __ATOMIC_ACQUIRE)
+#define shared_store(p, v) __atomic_store_n ((p), (v), __ATOMIC_RELEASE)
+#define shared_exchange(p, v) __atomic_exchange_n ((p), (v), __ATOMIC_ACQ_REL)
+#define shared_add(p, v) __atomic_fetch_add ((p), (v), __ATOMIC_RELAXED)
+
+/* With -lockflush frames are drawn into a shadow of the screen that's
+ * kept from frame to frame, and the screen is only locked while the
+ * shadow is copied into it. */
+static int use_lock_on_flush = 0;
+static cairo_surface_t *lock_on_flush_surface = NULL;
+
+static cairo_surface_t *
+get_lock_on_flush_surface (SDL_Surface *target)
+{
+    cairo_surface_t *surface = lock_on_flush_surface;
+
+    if (surface == NULL ||
+        cairosdl_surface_get_target (surface) != target ||
+        cairo_image_surface_get_width (surface) != target->w ||
+        cairo_image_surface_get_height (surface) != target->h)
+    {
+        if (surface)
+            cairo_surface_destroy (surface);
+        surface = cairosdl_surface_create_with_flags (target,
+                                                      CAIROSDL_LOCK_ON_FLUSH);
+        lock_on_flush_surface = surface;
+    }
+    return cairo_surface_reference (surface);
+}
+
+/* With -export NAME every frame is also copied into shared memory for
+ * other processes, like export-consumer, to read, and with -record
+ * FILE written into a Y4M file, or raw BGRA for other file names,
+ * with - for Y4M on the standard output.  Both keep the size of the
+ * first frame. */
+static char const *export_name = NULL;
+static cairosdl_export_t *frame_export = NULL;
+static char const *record_filename = NULL;
+static int record_fps = 60;
+static cairosdl_record_t *frame_record = NULL;
+
+/* With -remote ADDRESS the tiles of every frame that changed are sent
+ * to a remote-viewer listening at the address. */
+static char const *remote_address = NULL;
+static cairosdl_remote_t *frame_remote = NULL;
+
+static void
+destroy_frame_copies (void)
+{
+    cairosdl_export_destroy (frame_export);
+    frame_export = NULL;
+    if (cairosdl_record_destroy (frame_record) != 0)
+        fprintf (stderr, "Failed to record: %s\n", SDL_GetError ());
+    frame_record = NULL;
+    cairosdl_remote_destroy (frame_remote);
+    frame_remote = NULL;
+}
+
+static void
+export_frame (SDL_Surface *frame)
+{
+    if (frame_export == NULL) {
+        frame_export = cairosdl_export_create (export_name,
+                                               frame->w, frame->h,
+                                               CAIROSDL_EXPORT_XRGB32, 4);
+        if (frame_export == NULL) {
+            fprintf (stderr, "Failed to export frames: %s\n",
+                     SDL_GetError ());
+            export_name = NULL;
+            return;
+        }
+    }
+    if (cairosdl_export_frame (frame_export, frame) != 0) {
+        fprintf (stderr, "Failed to export a frame: %s\n", SDL_GetError ());
+        export_name = NULL;
+    }
+}
+
+static void
+record_frame (SDL_Surface *frame)
+{
+    if (frame_record == NULL) {
+        frame_record = cairosdl_record_open (record_filename,
+                                             frame->w, frame->h,
+                                             record_fps);
+        if (frame_record == NULL) {
+            fprintf (stderr, "Failed to record: %s\n", SDL_GetError ());
+            record_filename = NULL;
+            return;
+        }
+    }
+    if (cairosdl_record_frame (frame_record, frame) != 0) {
+        fprintf (stderr, "Failed to record a frame: %s\n", SDL_GetError ());
+        record_filename = NULL;
+    }
+}
+
+static void
+send_frame (SDL_Surface *frame)
+{
+    cairosdl_remote_stats_t stats;
+
+    if (frame_remote == NULL) {
+        frame_remote = cairosdl_remote_connect (remote_address);
+        if (frame_remote == NULL) {
+            fprintf (stderr, "Failed to connect to a remote viewer: %s\n",
+                     SDL_GetError ());
+            remote_address = NULL;
+            return;
+        }
+    }
+    if (cairosdl_remote_send_frame (frame_remote, frame, &stats) != 0) {
+        fprintf (stderr, "Failed to send a frame: %s\n", SDL_GetError ());
+        remote_address = NULL;
+        return;
+    }
+    shared_add (&frame_stats.num_remote_frames, 1);
+    shared_add (&frame_stats.remote_bytes, (unsigned)stats.bytes);
+    shared_add (&frame_stats.remote_encode_us,
+                (unsigned)(stats.encode_time * 1e6));
+}
+
+/* Hand a finished frame to the export, the recording and the remote
+ * viewer. */
+static void
+copy_out_frame (SDL_Surface *frame)
+{
+    if (export_name == NULL && record_filename == NULL &&
+        remote_address == NULL)
+    {
+        return;
+    }
+
+    if (SDL_MUSTLOCK (frame) && SDL_LockSurface (frame) != 0)
+        return;
+    if (export_name != NULL)
+        export_frame (frame);
+    if (record_filename != NULL)
+        record_frame (frame);
+    if (remote_address != NULL)
+        send_frame (frame);
+    if (SDL_MUSTLOCK (frame))
+        SDL_UnlockSurface (frame);
+}
+
+/* Draw a frame into the target, feeding the governors.  Returns the
+ * cairo status of the drawing. */
+static cairo_status_t
+render_frame (SDL_Surface *target, int width, int height)
+{
+    Uint32 start = SDL_GetTicks ();
+    double lock_start = frame_scheduler_now ();
+    double lock_time = 0;
+    cairo_surface_t *surface;
+    cairo_status_t status;
+    int lock_on_flush = use_lock_on_flush &&
+        target == SDL_GetVideoSurface () &&
+        !(use_dynres && resolution.scale < 1.0);
+
+    if (lock_on_flush) {
+        surface = get_lock_on_flush_surface (target);
+        lock_time = -cairosdl_surface_get_lock_time (surface);
+    }
+    else {
+        while (SDL_LockSurface (target) != 0)
+            SDL_Delay (1);
+        surface = get_screen_surface (target);
+    }
+
+    if (num_render_threads > 1) {
+        status = trap_render_tiled (surface, width, height);
+    }
+    else {
+        cairo_t *cr = cairo_create (surface);
+        trap_render (cr, width, height);
+        status = cairo_status (cr);
+        cairosdl_destroy (cr);
+    }
+
+    if (lock_on_flush) {
+        lock_time += cairosdl_surface_get_lock_time (surface);
+        cairo_surface_destroy (surface);
+    }
+    else {
+        cairo_surface_destroy (surface);
+        SDL_UnlockSurface (target);
+        lock_time = frame_scheduler_now () - lock_start;
+    }
+    shared_add (&frame_stats.lock_time_us, (unsigned)(lock_time * 1e6));
+
+    governor_frame (&governor, (SDL_GetTicks () - start) / 1000.0);
+    if (use_dynres) {
+        resolution_governor_frame (&resolution,
+                                   (SDL_GetTicks () - start) / 1000.0);
+    }
+    return status;
+}
+
+static void
+check_render_status (cairo_status_t status)
+{
+    if (status != CAIRO_STATUS_SUCCESS) {
+        fprintf (stderr, "Failed to render: %s\n",
+                 cairo_status_to_string (status));
+        exit (1);
+    }
+}
+
+static void
+note_input (void)
+{
+    Uint32 ticks = SDL_GetTicks ();
+    if (ticks == 0)
+        ticks = 1;
+    if (shared_load (&pending_input_ticks) == 0)
+        shared_store (&pending_input_ticks, ticks);
+}
+
+static void
+note_present (Uint32 input_ticks)
+{
+    shared_add (&frame_stats.num_presented, 1);
+    if (input_ticks != 0) {
+        Uint32 latency = SDL_GetTicks () - input_ticks;
+        frame_stats.num_latencies++;
+        frame_stats.latency_sum += latency;
+        if (latency > frame_stats.latency_max)
+            frame_stats.latency_max = latency;
+    }
+}
 
 static Uint32
 print_fps_timer (Uint32 interval, void *param)
 {
-    unsigned *frame_counter = (unsigned *)param;
-    unsigned num_frames = *frame_counter;
-    *frame_counter = 0;
-
-    printf("%u frames in %u ms = %.3f fps\n",
-           num_frames, interval, 1000.0*num_frames / interval);
+    struct frame_stats *stats = (struct frame_stats *)param;
+    unsigned num_frames = shared_exchange (&stats->num_presented, 0);
+    unsigned num_rendered = shared_exchange (&stats->num_rendered, 0);
+    unsigned num_dropped = shared_exchange (&stats->num_dropped, 0);
+    unsigned lock_time_us = shared_exchange (&stats->lock_time_us, 0);
+    unsigned num_remote_frames = shared_exchange (&stats->num_remote_frames, 0);
+    unsigned remote_bytes = shared_exchange (&stats->remote_bytes, 0);
+    unsigned remote_encode_us = shared_exchange (&stats->remote_encode_us, 0);
+    double cpu_time = frame_scheduler_cpu_time ();
+
+    fprintf(report_file, "%u frames in %u ms = %.3f fps",
+            num_frames, interval, 1000.0*num_frames / interval);
+    if (num_frames > 0) {
+        fprintf(report_file, ", %.2f ms CPU per frame",
+                1000.0*(cpu_time - stats->cpu_time) / num_frames);
+    }
+    stats->cpu_time = cpu_time;
+    if (num_rendered != num_frames) {
+        fprintf(report_file, ", %u rendered, %u dropped",
+                num_rendered, num_dropped);
+    }
+    if (num_rendered > 0) {
+        fprintf(report_file, ", screen locked %.2f ms per frame",
+                lock_time_us / 1000.0 / num_rendered);
+    }
+    if (num_remote_frames > 0) {
+        fprintf(report_file,
+                ", remote %.1f KB and %.2f ms to encode per frame",
+                remote_bytes / 1024.0 / num_remote_frames,
+                remote_encode_us / 1000.0 / num_remote_frames);
+    }
+    if (stats->num_latencies > 0) {
+        fprintf(report_file, ", input latency %.1f ms avg %u ms max",
+                (double)stats->latency_sum / stats->num_latencies,
+                stats->latency_max);
+        stats->num_latencies = 0;
+        stats->latency_sum = 0;
+        stats->latency_max = 0;
+    }
+    fprintf(report_file, "\n");
 
     return interval;
 }
 
 
-static void
-push_expose ()
+/* With -pipeline a render thread draws frames into three off-screen
+ * buffers while the main thread presents the latest finished one and
+ * handles events.  The buffers are handed over by exchanging indices
+ * through pipeline_ready: whoever holds an index owns that buffer.
+ * The render thread never waits, so a finished frame may be replaced
+ * by a newer one before it's presented.
+ *
+ * That only raises the frame rate if there's a CPU to spare for the
+ * render thread, and a finished frame can wait up to a frame before
+ * it's shown, so it may add latency rather than take it away.  The
+ * five second stats give the fps, the frames rendered and dropped and
+ * the input-to-present latency in both modes to compare. */
+static int use_pipeline = 0;
+
+struct frame_buffer {
+    SDL_Surface *surface;
+    Uint32 input_ticks;         /* pending input when drawing started */
+};
+
+#define FRAME_READY_EVENT SDL_USEREVENT
+#define FRAME_FRESH 4           /* flag: not yet seen by the main thread */
+
+static struct frame_buffer frame_buffers[3];
+static int pipeline_ready = 1;  /* last finished buffer | FRAME_FRESH */
+static int pipeline_size = 0;   /* wanted width << 16 | height */
+static int pipeline_quit = 0;
+
+static int
+render_thread (void *param)
 {
-    SDL_Event event[1];
-    event->type = SDL_VIDEOEXPOSE;
-    if (SDL_PushEvent (event) != 0) {
-        fprintf (stderr, "Failed to push an expose event: %s\n",
-                 SDL_GetError ());
+    int back = 0;
+    (void)param;
+
+    while (!shared_load (&pipeline_quit)) {
+        struct frame_buffer *frame = frame_buffers + back;
+        int size = shared_load (&pipeline_size);
+        int width = size >> 16;
+        int height = size & 0xffff;
+        int prev;
+
+        if (frame->surface == NULL ||
+            frame->surface->w != width ||
+            frame->surface->h != height)
+        {
+            if (frame->surface)
+                SDL_FreeSurface (frame->surface);
+            frame->surface = SDL_CreateRGBSurface (
+                SDL_SWSURFACE, width, height, 32,
+                CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, 0);
+            if (frame->surface == NULL) {
+                fprintf (stderr, "Failed to create a frame buffer: %s\n",
+                         SDL_GetError ());
+                exit (1);
+            }
+        }
+
+        frame_scheduler_wait_frame (&scheduler);
+        frame->input_ticks = shared_exchange (&pending_input_ticks, 0);
+        check_render_status (render_frame (frame->surface, width, height));
+        copy_out_frame (frame->surface);
+        frame_scheduler_frame_done (&scheduler);
+        shared_add (&frame_stats.num_rendered, 1);
+
+        prev = shared_exchange (&pipeline_ready, back | FRAME_FRESH);
+        back = prev & ~FRAME_FRESH;
+        if (prev & FRAME_FRESH) {
+            /* The main thread hasn't got to the last one yet and
+             * already has an event coming. */
+            shared_add (&frame_stats.num_dropped, 1);
+        }
+        else {
+            SDL_Event event[1];
+            event->type = FRAME_READY_EVENT;
+            SDL_PushEvent (event);
+        }
     }
+    return 0;
+}
+
+/* Swap the latest finished frame for the one on screen and show it. */
+static void
+present_ready_frame (int *front)
+{
+    SDL_Surface *screen = SDL_GetVideoSurface ();
+    struct frame_buffer *frame;
+
+    if (!(shared_load (&pipeline_ready) & FRAME_FRESH))
+        return;
+    *front = shared_exchange (&pipeline_ready, *front) & ~FRAME_FRESH;
+    frame = frame_buffers + *front;
+
+    SDL_BlitSurface (frame->surface, NULL, screen, NULL);
+    SDL_Flip (screen);
+    note_present (frame->input_ticks);
 }
 
 static void
 event_loop (unsigned flags, int width, int height)
 {
-    unsigned num_frames_rendered = 0;
+    SDL_Thread *renderer = NULL;
+    struct frame_scheduler events_only;
+    struct frame_scheduler *main_scheduler = &scheduler;
+    int front = 2;
+    int status;
     SDL_Event event[1];
     event->resize.type = SDL_VIDEORESIZE;
     event->resize.w = width;
     event->resize.h = height;
     SDL_PushEvent (event);
 
-    SDL_AddTimer (5000, print_fps_timer, &num_frames_rendered);
+    /* The main thread of a pipeline only handles events. */
+    if (use_pipeline) {
+        frame_scheduler_init (&events_only, FRAME_SCHEDULE_ON_DEMAND, 0);
+        main_scheduler = &events_only;
+    }
+
+    frame_stats.cpu_time = frame_scheduler_cpu_time ();
+    SDL_AddTimer (5000, print_fps_timer, &frame_stats);
+
+    while ((status = frame_scheduler_next_event (main_scheduler,
+                                                 event)) >= 0)
+    {
+        if (status == 0) {
+            SDL_Surface *screen = SDL_GetVideoSurface ();
+            Uint32 input_ticks;
+
+            if (!use_pipeline) {
+                input_ticks = shared_exchange (&pending_input_ticks, 0);
+                check_render_status (render_frame (screen, width, height));
+                copy_out_frame (screen);
+                SDL_Flip (screen);
+                shared_add (&frame_stats.num_rendered, 1);
+                note_present (input_ticks);
+            }
+            frame_scheduler_frame_done (main_scheduler);
+            continue;
+        }
 
-    while (SDL_WaitEvent (event)) {
         switch (event->type) {
         case SDL_VIDEORESIZE:
             if (SDL_SetVideoMode (event->resize.w,
@@ -358,38 +1216,37 @@ event_loop (unsigned flags, int width, int height)
             }
             width = event->resize.w;
             height = event->resize.h;
-            /* fallthrough  */
 
-        case SDL_VIDEOEXPOSE: {
-            SDL_Surface *screen = SDL_GetVideoSurface ();
-            cairo_t *cr;
-            cairo_status_t status;
-
-            while (SDL_LockSurface (screen) != 0)
-                SDL_Delay (1);
-
-            cr = cairosdl_create (screen);
-            trap_render (cr, width, height);
-            status = cairo_status (cr);
-            cairosdl_destroy (cr);
-
-            SDL_UnlockSurface (screen);
-            SDL_Flip (screen);
-
-            ++num_frames_rendered;
-
-            if (status != CAIRO_STATUS_SUCCESS) {
-                fprintf (stderr, "Failed to render: %s\n",
-                         cairo_status_to_string (status));
-                exit (1);
+            if (use_pipeline) {
+                shared_store (&pipeline_size, width << 16 | height);
+                if (renderer == NULL)
+                    renderer = SDL_CreateThread (render_thread, NULL);
+                if (renderer == NULL) {
+                    fprintf (stderr, "Failed to start the render thread: %s\n",
+                             SDL_GetError ());
+                    exit (1);
+                }
             }
+            break;
 
-            push_expose ();             /* Schedule another expose soon, */
+        case FRAME_READY_EVENT:
+            present_ready_frame (&front);
             break;
-        }
+
+        case SDL_MOUSEMOTION:
+        case SDL_MOUSEBUTTONDOWN:
+            note_input ();
+            break;
+
         case SDL_KEYDOWN:
-            if (event->key.keysym.sym == SDLK_q)
+            note_input ();
+            if (event->key.keysym.sym == SDLK_q) {
+                if (renderer) {
+                    shared_store (&pipeline_quit, 1);
+                    SDL_WaitThread (renderer, NULL);
+                }
                 return;
+            }
         }
     }
     fprintf (stderr, "WaitEvent failed: %s\n", SDL_GetError ());
@@ -402,6 +1259,7 @@ main (int argc, char **argv)
     int height = 512;
     int flags = SDL_SWSURFACE;
     int init_flags = SDL_INIT_TIMER | SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE;
+    double target_fps = 0;
     int i;
 
     if (SDL_Init (init_flags) < 0) {
@@ -430,11 +1288,84 @@ main (int argc, char **argv)
         else if (0 == strcmp(argv[i], "-resizable")) {
             flags |= SDL_RESIZABLE;
         }
+        else if (0 == strcmp(argv[i], "-nocache")) {
+            cache_gear_paths = 0;
+        }
+        else if (0 == strcmp(argv[i], "-sprites") && i+1 < argc) {
+            num_sprite_frames = atoi(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-threads") && i+1 < argc) {
+            num_render_threads = atoi(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-gears") && i+1 < argc) {
+            num_gear_trains = atoi(argv[++i]);
+            if (num_gear_trains < 0)
+                num_gear_trains = 0;
+        }
+        else if (0 == strcmp(argv[i], "-blobs") && i+1 < argc) {
+            num_blobs = atoi(argv[++i]);
+            if (num_blobs < 0)
+                num_blobs = 0;
+            blobs = (struct blob *)calloc (num_blobs + 1, sizeof (*blobs));
+            blobs_placed = 0;
+        }
+        else if (0 == strcmp(argv[i], "-target-fps") && i+1 < argc) {
+            target_fps = atof(argv[++i]);
+        }
+        else if (0 == strcmp(argv[i], "-dynres")) {
+            use_dynres = 1;
+        }
+        else if (0 == strcmp(argv[i], "-pipeline")) {
+            use_pipeline = 1;
+        }
+        else if (0 == strcmp(argv[i], "-lockflush")) {
+            use_lock_on_flush = 1;
+        }
+        else if (0 == strcmp(argv[i], "-export") && i+1 < argc) {
+            export_name = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-record") && i+1 < argc) {
+            record_filename = argv[++i];
+        }
+        else if (0 == strcmp(argv[i], "-remote") && i+1 < argc) {
+            remote_address = argv[++i];
+        }
         else {
-            fprintf(stderr, "usage: [-gradient] [-fullscreen] [-resizable]\n");
+            fprintf(stderr, "usage: [-gradient] [-fullscreen] [-resizable] [-nocache]\n"
+                    "       [-sprites N] [-threads N] [-gears N] [-blobs M]\n"
+                    "       [-target-fps F] [-dynres] [-pipeline] [-lockflush]\n"
+                    "       [-export /NAME] [-record FILE.y4m|-]\n"
+                    "       [-remote ADDRESS]\n");
         }
     }
 
+    if (target_fps >= 1)
+        record_fps = (int)(target_fps + 0.5);
+    report_file = stdout;
+    if (record_filename != NULL && 0 == strcmp (record_filename, "-"))
+        report_file = stderr;
+
+    governor_init (&governor, target_fps);
+    governor.log = report_file;
+    /* The gears turn by a step per frame, so a recording plays back at
+     * record_fps however fast its frames are drawn. */
+    frame_scheduler_init (&scheduler, FRAME_SCHEDULE_TARGET, target_fps);
+    if (export_name != NULL || record_filename != NULL ||
+        remote_address != NULL)
+    {
+        atexit (destroy_frame_copies);
+    }
+    resolution_governor_init (&resolution,
+                              target_fps > 0 ? target_fps : 60, 0.25);
+    resolution.log = report_file;
+
+    if (num_render_threads > 1)
+        cairosdl_set_num_threads (num_render_threads);
+
+    if (num_gear_trains != 1 || blobs != &default_blob)
+        fprintf (report_file, "%d gear trains, %d blobs\n",
+                 num_gear_trains, num_blobs);
+
     event_loop (flags, width, height);
     return 0;
 }
@@ -0,0 +1,205 @@
+/* A rendering quality governor for the demos.  See governor.h. */
+#include <math.h>
+#include <stdio.h>
+#include "governor.h"
+
+struct quality_level {
+    double tolerance_scale;
+    cairo_antialias_t antialias;
+    int use_gradients;
+};
+
+static struct quality_level const quality_levels[] = {
+    { 1.0, CAIRO_ANTIALIAS_DEFAULT, 1 },
+    { 2.0, CAIRO_ANTIALIAS_DEFAULT, 1 },
+    { 4.0, CAIRO_ANTIALIAS_FAST,    1 },
+    { 4.0, CAIRO_ANTIALIAS_FAST,    0 },
+    { 8.0, CAIRO_ANTIALIAS_NONE,    0 },
+};
+
+#define NUM_QUALITY_LEVELS \
+    ((int)(sizeof (quality_levels) / sizeof (quality_levels[0])))
+
+/* Step down when the average is this much over budget and has been
+ * for long enough for the average to have caught up with the last
+ * change. */
+#define SLOW_FRACTION 1.10
+#define SLOW_SETTLE_TIME 0.5
+
+/* Step up only when there's this much headroom and has been for a
+ * good while.  The gap between the two fractions is the hysteresis. */
+#define FAST_FRACTION 0.70
+#define FAST_SETTLE_TIME 3.0
+
+/* Weight of a new frame time in the moving average. */
+#define AVERAGE_WEIGHT 0.1
+
+static char const *
+antialias_name (cairo_antialias_t antialias)
+{
+    switch (antialias) {
+    case CAIRO_ANTIALIAS_DEFAULT: return "default";
+    case CAIRO_ANTIALIAS_NONE: return "none";
+    case CAIRO_ANTIALIAS_FAST: return "fast";
+    default: return "other";
+    }
+}
+
+void
+governor_init (struct governor *governor, double target_fps)
+{
+    governor->target_frame_time = target_fps > 0 ? 1.0 / target_fps : 0;
+    governor->average_frame_time = 0;
+    governor->time_at_level = 0;
+    governor->level = 0;
+    governor->num_frames = 0;
+    governor->log = stdout;
+}
+
+static void
+governor_set_level (struct governor *governor, int level)
+{
+    struct quality_level const *q = quality_levels + level;
+
+    fprintf (governor->log,
+             "quality %d -> %d: tolerance x%g, antialias %s, gradients %s "
+             "(%.2f ms/frame, target %.2f ms)\n",
+             governor->level, level,
+             q->tolerance_scale,
+             antialias_name (q->antialias),
+             q->use_gradients ? "on" : "off",
+             1000 * governor->average_frame_time,
+             1000 * governor->target_frame_time);
+
+    governor->level = level;
+    governor->time_at_level = 0;
+}
+
+int
+governor_frame (struct governor *governor, double frame_time)
+{
+    double target = governor->target_frame_time;
+    double average;
+    int level = governor->level;
+
+    if (target <= 0)
+        return 0;
+
+    if (governor->num_frames++ == 0)
+        governor->average_frame_time = frame_time;
+    else
+        governor->average_frame_time +=
+            AVERAGE_WEIGHT * (frame_time - governor->average_frame_time);
+    governor->time_at_level += frame_time;
+    average = governor->average_frame_time;
+
+    if (average > SLOW_FRACTION * target &&
+        governor->time_at_level >= SLOW_SETTLE_TIME &&
+        level + 1 < NUM_QUALITY_LEVELS)
+    {
+        governor_set_level (governor, level + 1);
+        return 1;
+    }
+
+    if (average < FAST_FRACTION * target &&
+        governor->time_at_level >= FAST_SETTLE_TIME &&
+        level > 0)
+    {
+        governor_set_level (governor, level - 1);
+        return 1;
+    }
+
+    return 0;
+}
+
+void
+governor_apply (struct governor const *governor,
+                cairo_t *cr,
+                double base_tolerance)
+{
+    struct quality_level const *q = quality_levels + governor->level;
+    cairo_set_tolerance (cr, base_tolerance * q->tolerance_scale);
+    cairo_set_antialias (cr, q->antialias);
+}
+
+int
+governor_use_gradients (struct governor const *governor)
+{
+    return quality_levels[governor->level].use_gradients;
+}
+
+/* The resolution governor aims for frames this far within budget. */
+#define RESOLUTION_AIM 0.85
+#define RESOLUTION_STEPS 16.0
+#define RESOLUTION_MAX_STEP_UP (2 / RESOLUTION_STEPS)
+
+void
+resolution_governor_init (struct resolution_governor *governor,
+                          double target_fps,
+                          double min_scale)
+{
+    governor->target_frame_time = target_fps > 0 ? 1.0 / target_fps : 0;
+    governor->average_frame_time = 0;
+    governor->time_at_scale = 0;
+    governor->scale = 1.0;
+    governor->min_scale = min_scale > 0 && min_scale < 1 ? min_scale : 1.0;
+    governor->num_frames = 0;
+    governor->log = stdout;
+}
+
+int
+resolution_governor_frame (struct resolution_governor *governor,
+                           double frame_time)
+{
+    double target = governor->target_frame_time;
+    double average, scale;
+
+    if (target <= 0)
+        return 0;
+
+    /* Frame times from before the last change say little about the
+     * current scale, so the average starts over. */
+    if (governor->num_frames++ == 0)
+        governor->average_frame_time = frame_time;
+    else
+        governor->average_frame_time +=
+            AVERAGE_WEIGHT * (frame_time - governor->average_frame_time);
+    governor->time_at_scale += frame_time;
+    average = governor->average_frame_time;
+
+    if (average > SLOW_FRACTION * target) {
+        if (governor->time_at_scale < SLOW_SETTLE_TIME)
+            return 0;
+    }
+    else if (average < FAST_FRACTION * target && governor->scale < 1.0) {
+        if (governor->time_at_scale < FAST_SETTLE_TIME)
+            return 0;
+    }
+    else {
+        return 0;
+    }
+
+    /* Pixels go with the square of the scale. */
+    scale = average > 0
+        ? governor->scale * sqrt (RESOLUTION_AIM * target / average)
+        : 1.0;
+    if (scale > governor->scale + RESOLUTION_MAX_STEP_UP)
+        scale = governor->scale + RESOLUTION_MAX_STEP_UP;
+    scale = floor (scale * RESOLUTION_STEPS) / RESOLUTION_STEPS;
+    if (scale < governor->min_scale)
+        scale = governor->min_scale;
+    if (scale > 1.0)
+        scale = 1.0;
+    if (scale == governor->scale)
+        return 0;
+
+    fprintf (governor->log, "resolution %.0f%% -> %.0f%% "
+             "(%.2f ms/frame, target %.2f ms)\n",
+             100 * governor->scale, 100 * scale,
+             1000 * average, 1000 * target);
+
+    governor->scale = scale;
+    governor->time_at_scale = 0;
+    governor->num_frames = 0;
+    return 1;
+}
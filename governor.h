@@ -0,0 +1,80 @@
+/* A rendering quality governor for the demos.
+ *
+ * The governor watches how long frames take to draw against the
+ * frame time budget of a target frame rate and steps the rendering
+ * quality down when frames are too slow and back up when there's
+ * room to spare.  Quality is a ladder of levels, each one trading
+ * some of the path flattening tolerance, antialiasing and gradient
+ * fills for speed.  Level 0 is the demo's normal rendering.
+ *
+ * To avoid flip-flopping between two levels the governor only steps
+ * down when the average frame is clearly over budget and only steps
+ * back up after a longer spell of frames well under budget.  Every
+ * change of level is logged to the governor's log, stdout unless the
+ * demo says otherwise.
+ */
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <stdio.h>
+#include <cairo.h>
+
+struct governor {
+    double target_frame_time;   /* seconds per frame, 0 for no target */
+    double average_frame_time;  /* moving average of frame times */
+    double time_at_level;       /* seconds of frames since the last change */
+    int level;                  /* current quality level, 0 is best */
+    int num_frames;             /* frames seen, for warming up the average */
+    FILE *log;                  /* where changes of level go */
+};
+
+/* Initialise the governor for the given target frame rate.  A target
+ * of zero or less disables it, leaving the quality at level 0. */
+void
+governor_init (struct governor *governor, double target_fps);
+
+/* Tell the governor how many seconds the last frame took to draw.
+ * Returns nonzero if this changed the quality level. */
+int
+governor_frame (struct governor *governor, double frame_time);
+
+/* Set up the tolerance and antialiasing of a context to the current
+ * quality level.  The tolerance is scaled from the base tolerance the
+ * demo would normally use. */
+void
+governor_apply (struct governor const *governor,
+                cairo_t *cr,
+                double base_tolerance);
+
+/* Whether gradient fills should be used at the current quality
+ * level, or replaced by solid colours. */
+int
+governor_use_gradients (struct governor const *governor);
+
+
+/* A dynamic resolution governor.  It picks the scale to draw frames
+ * at, as for cairosdl_surface_create_scaled(), from the same frame
+ * time feedback, assuming that the time to draw a frame goes with its
+ * number of pixels.  The scale moves in steps of 1/16 and is also
+ * logged on every change. */
+struct resolution_governor {
+    double target_frame_time;   /* seconds per frame, 0 for no target */
+    double average_frame_time;  /* moving average since the last change */
+    double time_at_scale;       /* seconds of frames since the last change */
+    double scale;               /* current scale, 1 is full resolution */
+    double min_scale;
+    int num_frames;             /* frames since the last change */
+    FILE *log;                  /* where changes of scale go */
+};
+
+void
+resolution_governor_init (struct resolution_governor *governor,
+                          double target_fps,
+                          double min_scale);
+
+/* Returns nonzero if this frame time changed the scale. */
+int
+resolution_governor_frame (struct resolution_governor *governor,
+                           double frame_time);
+
+#endif /* GOVERNOR_H */
@@ -0,0 +1,126 @@
+/*
+ * Shows the frames a demo sends with -remote ADDRESS.  Start this
+ * first, listening at the same address, like
+ *
+ *   remote-viewer -listen /tmp/gears.sock & gears -remote /tmp/gears.sock
+ *   remote-viewer -listen :5999            # and elsewhere
+ *   gears -remote viewerhost:5999
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cairosdl-remote.h"
+
+struct viewer_stats {
+    unsigned long frames;
+    double bytes;
+    double decode_time;
+    Uint32 last_report;
+};
+
+static void
+print_stats (struct viewer_stats *stats)
+{
+    Uint32 now = SDL_GetTicks ();
+    Uint32 elapsed = now - stats->last_report;
+
+    if (elapsed < 5000)
+        return;
+    if (stats->frames > 0) {
+        printf ("%lu frames in %u ms, %.1f KB and %.2f ms to decode "
+                "per frame\n",
+                stats->frames, elapsed,
+                stats->bytes / 1024 / stats->frames,
+                stats->decode_time * 1000 / stats->frames);
+    }
+    stats->frames = 0;
+    stats->bytes = 0;
+    stats->decode_time = 0;
+    stats->last_report = now;
+}
+
+int
+main (int argc, char **argv)
+{
+    char const *address = "/tmp/cairosdl-remote";
+    cairosdl_remote_t *remote;
+    struct viewer_stats stats;
+    SDL_Surface *screen = NULL;
+    int status = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp (argv[i], "-listen") && i+1 < argc) {
+            address = argv[++i];
+        }
+        else {
+            fprintf (stderr, "usage: [-listen /socket/path | [host]:port]\n");
+            return 1;
+        }
+    }
+
+    if (SDL_Init (SDL_INIT_VIDEO) < 0) {
+        fprintf (stderr, "Unable to initialize SDL: %s\n", SDL_GetError ());
+        return 1;
+    }
+
+    printf ("Waiting for frames at %s\n", address);
+    remote = cairosdl_remote_accept (address);
+    if (remote == NULL) {
+        fprintf (stderr, "Unable to accept a sender: %s\n", SDL_GetError ());
+        SDL_Quit ();
+        return 1;
+    }
+
+    memset (&stats, 0, sizeof (stats));
+    stats.last_report = SDL_GetTicks ();
+    for (;;) {
+        cairosdl_remote_stats_t frame_stats;
+        SDL_Surface *frame;
+        SDL_Event event;
+
+        while (SDL_PollEvent (&event)) {
+            if (event.type == SDL_QUIT ||
+                (event.type == SDL_KEYDOWN &&
+                 event.key.keysym.sym == SDLK_q))
+            {
+                goto DONE;
+            }
+        }
+        print_stats (&stats);
+
+        /* Don't sleep for long so that events aren't kept waiting. */
+        status = cairosdl_remote_wait (remote, 20);
+        if (status == 0)
+            continue;
+        if (status > 0)
+            status = cairosdl_remote_receive_frame (remote, &frame_stats);
+        if (status <= 0)
+            break;
+
+        stats.frames++;
+        stats.bytes += frame_stats.bytes;
+        stats.decode_time += frame_stats.encode_time;
+
+        frame = cairosdl_remote_get_frame (remote);
+        if (screen == NULL || screen->w != frame->w || screen->h != frame->h) {
+            screen = SDL_SetVideoMode (frame->w, frame->h, 32, SDL_SWSURFACE);
+            if (screen == NULL) {
+                fprintf (stderr, "Unable to set %ix%i video: %s\n",
+                         frame->w, frame->h, SDL_GetError ());
+                status = -1;
+                break;
+            }
+            SDL_WM_SetCaption (address, address);
+        }
+        SDL_BlitSurface (frame, NULL, screen, NULL);
+        SDL_UpdateRect (screen, 0, 0, 0, 0);
+    }
+    if (status < 0)
+        fprintf (stderr, "Lost the sender: %s\n", SDL_GetError ());
+
+ DONE:
+    cairosdl_remote_destroy (remote);
+    SDL_Quit ();
+    return status < 0 ? 1 : 0;
+}
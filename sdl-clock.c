@@ -6,21 +6,28 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <math.h>
 #include "cairosdl.h"
+#include "cairosdl-remote.h"
+#include "frame-scheduler.h"
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
 #endif
 
-/* Draws a clock on a normalized Cairo context */
+/* The angles of the clock's indicators. */
+struct clock_hands {
+    double seconds, minutes, hours;
+};
+
 static void
-draw (cairo_t *cr)
+get_clock_hands (struct clock_hands *hands)
 {
     time_t t;
     struct tm *tm;
-    double seconds, minutes, hours;
 
     /* In newer versions of Visual Studio localtime(..) is deprecated. */
     /* Use localtime_s instead. See MSDN. */
@@ -28,10 +35,16 @@ draw (cairo_t *cr)
     tm = localtime (&t);
 
     /* compute the angles for the indicators of our clock */
-    seconds = tm->tm_sec * M_PI / 30;
-    minutes = tm->tm_min * M_PI / 30;
-    hours = tm->tm_hour * M_PI / 6;
+    hands->seconds = tm->tm_sec * M_PI / 30;
+    hands->minutes = tm->tm_min * M_PI / 30;
+    hands->hours = tm->tm_hour * M_PI / 6;
+}
 
+/* Draws the parts of the clock that don't move, the face and its
+ * outline, on a normalized Cairo context. */
+static void
+draw_dial (cairo_t *cr)
+{
     /* Fill the background with white. */
     cairo_set_source_rgb (cr, 1, 1, 1);
     cairo_paint (cr);
@@ -46,6 +59,19 @@ draw (cairo_t *cr)
     cairo_translate (cr, 0.5, 0.5);
     cairo_arc (cr, 0, 0, 0.4, 0, M_PI * 2);
     cairo_stroke (cr);
+}
+
+/* Draws the clock's indicators on a normalized Cairo context. */
+static void
+draw_hands (cairo_t *cr, struct clock_hands const *hands)
+{
+    double seconds = hands->seconds;
+    double minutes = hands->minutes;
+    double hours = hands->hours;
+
+    cairo_set_line_cap (cr, CAIRO_LINE_CAP_ROUND);
+    cairo_set_line_width (cr, 0.1);
+    cairo_translate (cr, 0.5, 0.5);
 
     /* draw a white dot on the current second. */
     cairo_set_source_rgba (cr, 1, 1, 1, 0.6);
@@ -66,33 +92,216 @@ draw (cairo_t *cr)
     cairo_stroke (cr);
 }
 
-/* Shows how to draw with Cairo on SDL surfaces */
+/* The screen area covered by a line at the given angle from start to
+ * length away from the center of the clock, stroked with the width
+ * of the hands.  The second dot is a line of no length, since its
+ * radius is the same as half the width.  The area is padded a pixel
+ * for antialiasing and clipped to the screen. */
+static void
+get_hand_extents (double angle, double start, double length,
+                  int width, int height, SDL_Rect *rect)
+{
+    double x0 = 0.5 + sin (angle) * start;
+    double y0 = 0.5 - cos (angle) * start;
+    double x1 = 0.5 + sin (angle) * length;
+    double y1 = 0.5 - cos (angle) * length;
+    double r = 0.05;
+    int left = floor (((x0 < x1 ? x0 : x1) - r) * width) - 1;
+    int top = floor (((y0 < y1 ? y0 : y1) - r) * height) - 1;
+    int right = ceil (((x0 > x1 ? x0 : x1) + r) * width) + 1;
+    int bottom = ceil (((y0 > y1 ? y0 : y1) + r) * height) + 1;
+
+    if (left < 0) left = 0;
+    if (top < 0) top = 0;
+    if (right > width) right = width;
+    if (bottom > height) bottom = height;
+    if (right < left) right = left;
+    if (bottom < top) bottom = top;
+
+    rect->x = left;
+    rect->y = top;
+    rect->w = right - left;
+    rect->h = bottom - top;
+}
+
+/* Adds the screen areas of the indicators that moved between two
+ * readings of the clock, before and after.  Returns the number of
+ * rectangles stored, at most six. */
+static int
+get_damage (struct clock_hands const *old,
+            struct clock_hands const *new_hands,
+            int width, int height,
+            SDL_Rect *rects)
+{
+    int n = 0;
+
+    if (old->seconds != new_hands->seconds) {
+        get_hand_extents (old->seconds, 0.4, 0.4, width, height, rects + n++);
+        get_hand_extents (new_hands->seconds, 0.4, 0.4, width, height, rects + n++);
+    }
+    if (old->minutes != new_hands->minutes) {
+        get_hand_extents (old->minutes, 0, 0.4, width, height, rects + n++);
+        get_hand_extents (new_hands->minutes, 0, 0.4, width, height, rects + n++);
+    }
+    if (old->hours != new_hands->hours) {
+        get_hand_extents (old->hours, 0, 0.2, width, height, rects + n++);
+        get_hand_extents (new_hands->hours, 0, 0.2, width, height, rects + n++);
+    }
+    return n;
+}
+
+/* With -threads N the dial is drawn by N threads, a band each. */
+static int num_render_threads = 0;
+
+struct clock_frame {
+    int width, height;
+    struct clock_hands hands;
+};
+
+/* The clock is a stack of two layers, the dial and the hands on top,
+ * so that only the hands are redrawn as they move. */
+struct clock_display {
+    struct clock_frame frame;   /* as last drawn */
+    cairosdl_layers_t *layers;
+    cairosdl_layer_t *hands_layer;
+
+    /* A shadow of the screen, so that the screen is only locked while
+     * what changed is copied into it. */
+    cairo_surface_t *surface;
+};
+
 static void
-draw_screen (SDL_Surface *screen)
+draw_dial_tile (cairo_t *cr, void *closure)
 {
-    cairo_t *cr;
-    cairo_status_t status;
+    struct clock_frame const *frame = (struct clock_frame const *)closure;
+    cairo_scale (cr, frame->width, frame->height);
+    draw_dial (cr);
+}
 
-    /* Create a cairo drawing context, normalize it and draw a clock. */
-    SDL_LockSurface (screen); {
-        cr = cairosdl_create (screen);
+static void
+draw_dial_layer (cairo_t *cr, void *closure)
+{
+    struct clock_frame const *frame = (struct clock_frame const *)closure;
+
+    if (num_render_threads > 1) {
+        int band_height = (frame->height + num_render_threads - 1) /
+            num_render_threads;
+        cairosdl_surface_draw_tiled (cairo_get_target (cr),
+                                     frame->width, band_height,
+                                     draw_dial_tile, closure);
+    }
+    else {
+        draw_dial_tile (cr, closure);
+    }
+}
 
-        cairo_scale (cr, screen->w, screen->h);
-        draw (cr);
+static void
+draw_hands_layer (cairo_t *cr, void *closure)
+{
+    struct clock_frame const *frame = (struct clock_frame const *)closure;
+    cairo_scale (cr, frame->width, frame->height);
+    draw_hands (cr, &frame->hands);
+}
 
-        status = cairo_status (cr);
-        cairosdl_destroy (cr);
+/* Shows how to draw with Cairo on SDL surfaces.  The screen is only
+ * drawn when the time shown changes, and then only around the
+ * indicators that moved, unless a full redraw is asked for. */
+static void
+draw_screen (SDL_Surface *screen, struct clock_display *display, int full)
+{
+    struct clock_frame *frame = &display->frame;
+    SDL_Rect rects[8];
+    int num_rects;
+
+    if (display->layers == NULL ||
+        frame->width != screen->w ||
+        frame->height != screen->h)
+    {
+        cairosdl_layers_destroy (display->layers);
+        if (display->surface)
+            cairo_surface_destroy (display->surface);
+        display->surface =
+            cairosdl_surface_create_with_flags (screen,
+                                                CAIROSDL_LOCK_ON_FLUSH);
+        frame->width = screen->w;
+        frame->height = screen->h;
+        get_clock_hands (&frame->hands);
+
+        display->layers = cairosdl_layers_create (screen->w, screen->h);
+        if (display->layers == NULL ||
+            cairosdl_layers_add (display->layers,
+                                 draw_dial_layer, frame) == NULL ||
+            (display->hands_layer =
+             cairosdl_layers_add (display->layers,
+                                  draw_hands_layer, frame)) == NULL)
+        {
+            fprintf (stderr, "Unable to create the clock's layers\n");
+            exit (1);
+        }
     }
-    SDL_UnlockSurface (screen);
-    SDL_Flip (screen);
+    else {
+        struct clock_hands hands;
+        int i;
+
+        get_clock_hands (&hands);
+        num_rects = get_damage (&frame->hands, &hands,
+                                screen->w, screen->h, rects);
+        if (num_rects == 0 && !full)
+            return;
+
+        for (i = 0; i < num_rects; i++) {
+            cairosdl_layer_invalidate_rect (display->hands_layer,
+                                            rects[i].x, rects[i].y,
+                                            rects[i].w, rects[i].h);
+        }
+        frame->hands = hands;
+        if (full)
+            cairosdl_layers_mark_dirty (display->layers);
+    }
+
+    /* Redraw what moved and composite it onto the screen. */
+    num_rects = cairosdl_layers_update (display->layers, display->surface,
+                                        8, rects);
 
     /* Nasty nasty error handling. */
-    if (status != CAIRO_STATUS_SUCCESS) {
-        fprintf (stderr, "Unable to create or draw with a cairo context "
-                 "for the screen: %s\n",
-                 cairo_status_to_string (status));
+    if (num_rects < 0) {
+        fprintf (stderr, "Unable to draw the clock on the screen\n");
+        exit (1);
+    }
+    SDL_UpdateRects (screen, num_rects, rects);
+}
+
+/* With -remote ADDRESS the parts of the screen that changed are also
+ * sent to a remote-viewer listening at the address. */
+struct clock_remote {
+    cairosdl_remote_t *remote;
+    unsigned long num_frames;   /* looked at */
+    unsigned long num_sent;     /* with something changed */
+    double bytes;
+    double encode_time;
+};
+
+static void
+send_screen (SDL_Surface *screen, struct clock_remote *remote)
+{
+    cairosdl_remote_stats_t stats;
+    int status;
+
+    if (SDL_MUSTLOCK (screen) && SDL_LockSurface (screen) != 0)
+        return;
+    status = cairosdl_remote_send_frame (remote->remote, screen, &stats);
+    if (SDL_MUSTLOCK (screen))
+        SDL_UnlockSurface (screen);
+
+    if (status != 0) {
+        fprintf (stderr, "Unable to send the screen: %s\n",
+                 SDL_GetError ());
         exit (1);
     }
+    remote->num_frames++;
+    remote->num_sent += stats.tiles > 0;
+    remote->bytes += stats.bytes;
+    remote->encode_time += stats.encode_time;
 }
 
 static SDL_Surface *
@@ -101,7 +310,7 @@ init_screen (int width, int height, int bpp)
     SDL_Surface *screen;
 
     /* Initialize SDL */
-    if (SDL_Init (SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
+    if (SDL_Init (SDL_INIT_VIDEO) < 0) {
 	fprintf (stderr, "Unable to initialize SDL: %s\n",
 		 SDL_GetError ());
 	exit (1);
@@ -122,39 +331,61 @@ init_screen (int width, int height, int bpp)
     return screen;
 }
 
-/* This function pushes a custom event onto the SDL event queue.
- * Whenever the main loop receives it, the window will be redrawn.
- * We can't redraw the window here, since this function could be called
- * from another thread.
- */
-static Uint32
-timer_cb (Uint32 interval, void *param)
-{
-    SDL_Event event;
-
-    event.type = SDL_USEREVENT;
-    SDL_PushEvent (&event);
-
-    (void)param;
-    return interval;
-}
-
 int
 main (int argc, char **argv)
 {
     SDL_Surface *screen;
     SDL_Event event;
-
-    (void)argc;
-    (void)argv;
+    struct frame_scheduler scheduler;
+    struct clock_display display;
+    struct clock_remote remote;
+    char const *remote_address = NULL;
+    int status;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (0 == strcmp (argv[i], "-threads") && i+1 < argc) {
+            num_render_threads = atoi (argv[++i]);
+        }
+        else if (0 == strcmp (argv[i], "-remote") && i+1 < argc) {
+            remote_address = argv[++i];
+        }
+        else {
+            fprintf (stderr, "usage: [-threads N] [-remote ADDRESS]\n");
+        }
+    }
+    if (num_render_threads > 1)
+        cairosdl_set_num_threads (num_render_threads);
+
+    memset (&remote, 0, sizeof (remote));
+    if (remote_address != NULL) {
+        remote.remote = cairosdl_remote_connect (remote_address);
+        if (remote.remote == NULL) {
+            fprintf (stderr, "Unable to connect to a remote viewer: %s\n",
+                     SDL_GetError ());
+            exit (1);
+        }
+    }
 
     /* Initialize SDL, open a screen */
     screen = init_screen (640, 480, 32);
 
-    /* Create a timer which will redraw the screen every 100 ms. */
-    SDL_AddTimer (100, timer_cb, NULL);
+    /* Look at the time ten times a second.  The screen is only
+     * redrawn when the time shown has changed, or everything after
+     * an expose or resize. */
+    frame_scheduler_init (&scheduler, FRAME_SCHEDULE_TARGET, 10);
+    display.layers = NULL;
+    display.surface = NULL;
+
+    while ((status = frame_scheduler_next_event (&scheduler, &event)) >= 0) {
+        if (status == 0) {
+            draw_screen (screen, &display, scheduler.redraw_requested);
+            if (remote.remote)
+                send_screen (screen, &remote);
+            frame_scheduler_frame_done (&scheduler);
+            continue;
+        }
 
-    while (SDL_WaitEvent (&event)) {
 	switch (event.type) {
 	case SDL_KEYDOWN:
 	    if (event.key.keysym.sym == SDLK_q) {
@@ -170,9 +401,6 @@ main (int argc, char **argv)
 				       event.resize.h, 32,
 				       SDL_HWSURFACE |
 				       SDL_RESIZABLE);
-	    /* fall-through */
-	case SDL_USEREVENT:
-	    draw_screen (screen);
 	    break;
 
 	default:
@@ -181,6 +409,17 @@ main (int argc, char **argv)
     }
 
 done:
+    if (remote.num_frames > 0) {
+        printf ("%lu frames sent remotely of %lu, %.1f KB per frame sent "
+                "and %.3f ms to encode per frame\n",
+                remote.num_sent, remote.num_frames,
+                remote.num_sent ? remote.bytes / 1024 / remote.num_sent : 0,
+                remote.encode_time * 1000 / remote.num_frames);
+    }
+    cairosdl_remote_destroy (remote.remote);
+    cairosdl_layers_destroy (display.layers);
+    if (display.surface)
+        cairo_surface_destroy (display.surface);
     SDL_FreeSurface (screen);
     SDL_Quit ();
     return 0;
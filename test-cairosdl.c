@@ -1,6 +1,11 @@
 #include <assert.h>
+#include <stdio.h>
 #include <string.h>
 #include "cairosdl.h"
+#include "cairosdl-assets.h"
+#include "cairosdl-export.h"
+#include "cairosdl-record.h"
+#include "cairosdl-remote.h"
 
 static int
 sdl_surface_eq(SDL_Surface *a, SDL_Surface *b)
@@ -109,11 +114,1059 @@ test_argb32()
     }
 }
 
+/* Fill an image surface with an arbitrary mix of clear, solid and
+ * translucent premultiplied pixels. */
+static void
+fill_test_pattern(cairo_surface_t *image, unsigned seed)
+{
+    unsigned char *bytes = cairo_image_surface_get_data(image);
+    int stride = cairo_image_surface_get_stride(image);
+    int w = cairo_image_surface_get_width(image);
+    int h = cairo_image_surface_get_height(image);
+    int x, y;
+
+    cairo_surface_flush(image);
+    for (y=0; y<h; y++) {
+        unsigned *row = (unsigned *)(bytes + y*stride);
+        for (x=0; x<w; x++) {
+            unsigned a, r, g, b;
+            seed = seed*1103515245 + 12345;
+            a = (seed >> 16) & 255;
+            if (x % 7 == 0) a = 0;
+            if (y % 5 == 0) a = 255;
+            r = ((seed >> 8) & 255) * a / 255;
+            g = (x*255/w) * a / 255;
+            b = (y*255/h) * a / 255;
+            row[x] = (a << 24) | (r << 16) | (g << 8) | b;
+        }
+    }
+    cairo_surface_mark_dirty(image);
+}
+
+/* Check that two image surfaces agree to within one unit per
+ * channel.  The unused byte of RGB24 pixels isn't compared. */
+static int
+image_surface_close(cairo_surface_t *a, cairo_surface_t *b)
+{
+    int w = cairo_image_surface_get_width(a);
+    int h = cairo_image_surface_get_height(a);
+    int num_bits = cairo_image_surface_get_format(a) == CAIRO_FORMAT_RGB24
+        ? 24 : 32;
+    int x, y, i;
+
+    cairo_surface_flush(a);
+    cairo_surface_flush(b);
+    for (y=0; y<h; y++) {
+        unsigned *a_row = (unsigned *)(cairo_image_surface_get_data(a) +
+                                       y*cairo_image_surface_get_stride(a));
+        unsigned *b_row = (unsigned *)(cairo_image_surface_get_data(b) +
+                                       y*cairo_image_surface_get_stride(b));
+        for (x=0; x<w; x++) {
+            for (i=0; i<num_bits; i+=8) {
+                int d = (int)((a_row[x] >> i) & 255) -
+                    (int)((b_row[x] >> i) & 255);
+                if (d < -1 || d > 1)
+                    return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+static int
+test_composite_sprites()
+{
+    cairo_surface_t *source = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 40, 30);
+    cairo_surface_t *ref = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 64, 64);
+    cairo_surface_t *out = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 64, 64);
+    cairosdl_sprite_t sprites[3];
+    int i, ok;
+
+    fill_test_pattern(source, 1);
+    fill_test_pattern(ref, 2);
+    fill_test_pattern(out, 2);
+
+    /* A sprite hanging off the top left, one off the bottom right
+     * and a translucent one in the middle. */
+    for (i=0; i<3; i++) {
+        sprites[i].source = source;
+        sprites[i].src_x = 5;
+        sprites[i].src_y = 3;
+        sprites[i].width = 30;
+        sprites[i].height = 25;
+        sprites[i].opacity = 1.0;
+        sprites[i].spans = NULL;
+    }
+    sprites[0].dst_x = -10; sprites[0].dst_y = -7;
+    sprites[1].dst_x = 50;  sprites[1].dst_y = 45;
+    sprites[2].dst_x = 17;  sprites[2].dst_y = 20;
+    sprites[2].opacity = 0.4;
+
+    cairosdl_composite_sprites(out, 3, sprites);
+
+    {
+        cairo_t *cr = cairo_create(ref);
+        for (i=0; i<3; i++) {
+            cairo_save(cr);
+            cairo_set_source_surface(cr, source,
+                                     sprites[i].dst_x - sprites[i].src_x,
+                                     sprites[i].dst_y - sprites[i].src_y);
+            cairo_rectangle(cr, sprites[i].dst_x, sprites[i].dst_y,
+                            sprites[i].width, sprites[i].height);
+            cairo_clip(cr);
+            cairo_paint_with_alpha(cr, sprites[i].opacity);
+            cairo_restore(cr);
+        }
+        cairo_destroy(cr);
+    }
+
+    ok = image_surface_close(ref, out);
+    cairo_surface_destroy(source);
+    cairo_surface_destroy(ref);
+    cairo_surface_destroy(out);
+    return ok;
+}
+
+static int
+test_composite_spans()
+{
+    cairo_surface_t *source = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 40, 30);
+    cairo_surface_t *ref = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 64, 64);
+    cairo_surface_t *out = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 64, 64);
+    cairosdl_spans_t *spans = cairosdl_spans_create();
+    cairosdl_sprite_t sprites[2];
+    int i, ok;
+
+    fill_test_pattern(source, 4);
+    fill_test_pattern(ref, 5);
+    fill_test_pattern(out, 5);
+
+    for (i=0; i<2; i++) {
+        sprites[i].source = source;
+        sprites[i].src_x = 3;
+        sprites[i].src_y = 4;
+        sprites[i].width = 35;
+        sprites[i].height = 20;
+        sprites[i].dst_x = -9 + 50*i;
+        sprites[i].dst_y = 7 + 50*i;
+        sprites[i].opacity = 1.0 - 0.3*i;
+        sprites[i].spans = NULL;
+    }
+    cairosdl_composite_sprites(ref, 2, sprites);
+
+    ok = cairosdl_spans_encode(spans, source, 3, 4, 35, 20) == 0;
+    sprites[0].spans = sprites[1].spans = spans;
+    cairosdl_composite_sprites(out, 2, sprites);
+
+    /* The span encoded path must be exact. */
+    for (i=0; ok && i<64; i++) {
+        ok = 0 == memcmp(cairo_image_surface_get_data(ref) +
+                         i*cairo_image_surface_get_stride(ref),
+                         cairo_image_surface_get_data(out) +
+                         i*cairo_image_surface_get_stride(out),
+                         4*64);
+    }
+
+    cairosdl_spans_destroy(spans);
+    cairo_surface_destroy(source);
+    cairo_surface_destroy(ref);
+    cairo_surface_destroy(out);
+    return ok;
+}
+
+/* Blit onto a destination with or without alpha; with alpha the
+ * destination is translucent so the result is unpremultiplied. */
+static int
+test_blit_image(Uint32 amask)
+{
+    cairo_surface_t *source = cairo_image_surface_create(
+        CAIRO_FORMAT_ARGB32, 40, 30);
+    SDL_Surface *ref = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 64, 64, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, amask);
+    SDL_Surface *out;
+    cairo_surface_t *ref_image, *out_image;
+    SDL_Rect src_rect, dst_rect;
+    int ok;
+
+    fill_test_pattern(source, 3);
+    SDL_FillRect(ref, NULL, SDL_MapRGBA(ref->format, 20, 200, 90, 160));
+    out = dup_sdl_surface(ref);
+
+    src_rect.x = 4; src_rect.y = 2;
+    src_rect.w = 30; src_rect.h = 25;
+    dst_rect.x = 45; dst_rect.y = -5;
+    ok = cairosdl_blit_image(source, &src_rect, out, &dst_rect) == 0;
+    ok = ok && dst_rect.x == 45 && dst_rect.y == 0;
+    ok = ok && dst_rect.w == 19 && dst_rect.h == 20;
+
+    {
+        cairo_t *cr = cairosdl_create(ref);
+        cairo_set_source_surface(cr, source, 45 - 4, -5 - 2);
+        cairo_rectangle(cr, 45, -5, 30, 25);
+        cairo_fill(cr);
+        cairosdl_destroy(cr);
+    }
+
+    ref_image = cairosdl_surface_create(ref);
+    out_image = cairosdl_surface_create(out);
+    ok = ok && image_surface_close(ref_image, out_image);
+
+    cairo_surface_destroy(ref_image);
+    cairo_surface_destroy(out_image);
+    cairo_surface_destroy(source);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(out);
+    return ok;
+}
+
+static void
+draw_tiled_test_pattern(cairo_t *cr, void *closure)
+{
+    (void)closure;
+    cairo_set_source_rgba(cr, 1,1,0,0.5);
+    cairo_rectangle(cr, 25,25,50,50);
+    cairo_fill(cr);
+    cairo_set_source_rgba(cr, 0,0,1,0.75);
+    cairo_rectangle(cr, 10,60,80,13);
+    cairo_fill(cr);
+}
+
+static int
+test_draw_tiled()
+{
+    SDL_Surface *ref;
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE,
+        100, 100, 32,
+        CAIROSDL_RMASK,
+        CAIROSDL_GMASK,
+        CAIROSDL_BMASK,
+        CAIROSDL_AMASK);
+    cairo_surface_t *surface;
+    int ok;
+
+    SDL_FillRect(sdlsurf, NULL,
+                 SDL_MapRGBA(sdlsurf->format,255,0,0,128));
+    ref = dup_sdl_surface(sdlsurf);
+
+    {
+        cairo_t *cr = cairosdl_create(ref);
+        draw_tiled_test_pattern(cr, NULL);
+        cairosdl_destroy(cr);
+    }
+
+    /* Uneven tiles on a few threads; each tile is flushed by the
+     * thread that drew it. */
+    cairosdl_set_num_threads(3);
+    surface = cairosdl_surface_create(sdlsurf);
+    ok = cairosdl_surface_draw_tiled(surface, 16, 7,
+                                     draw_tiled_test_pattern, NULL)
+        == CAIRO_STATUS_SUCCESS;
+    cairo_surface_destroy(surface);
+    cairosdl_set_num_threads(0);
+
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_scaled()
+{
+    SDL_Surface *ref;
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE,
+        100, 100, 32,
+        CAIROSDL_RMASK,
+        CAIROSDL_GMASK,
+        CAIROSDL_BMASK,
+        CAIROSDL_AMASK);
+    int ok;
+
+    SDL_FillRect(sdlsurf, NULL,
+                 SDL_MapRGBA(sdlsurf->format,255,0,0,128));
+    ref = dup_sdl_surface(sdlsurf);
+
+    /* Edges on even pixels survive a nearest neighbour half scale
+     * round trip exactly. */
+    {
+        cairo_t *cr = cairosdl_create(ref);
+        cairo_set_source_rgba(cr, 1,1,0,0.5);
+        cairo_rectangle(cr, 24,24,50,50);
+        cairo_fill(cr);
+        cairosdl_destroy(cr);
+    }
+    {
+        cairo_surface_t *surface = cairosdl_surface_create_scaled(
+            sdlsurf, 0.5, CAIROSDL_SCALE_NEAREST);
+        cairo_t *cr = cairo_create(surface);
+        ok = cairo_image_surface_get_width(surface) == 50 &&
+            cairosdl_surface_get_scale(surface) == 0.5;
+        cairo_surface_destroy(surface);
+
+        cairo_set_source_rgba(cr, 1,1,0,0.5);
+        cairo_rectangle(cr, 24,24,50,50);
+        cairo_fill(cr);
+        cairosdl_destroy(cr);
+    }
+
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_flush_async()
+{
+    SDL_Surface *ref;
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE,
+        100, 100, 32,
+        CAIROSDL_RMASK,
+        CAIROSDL_GMASK,
+        CAIROSDL_BMASK,
+        CAIROSDL_AMASK);
+    cairo_surface_t *surface, *next;
+    cairo_t *cr;
+    int ok;
+
+    SDL_FillRect(sdlsurf, NULL,
+                 SDL_MapRGBA(sdlsurf->format,255,0,0,128));
+    ref = dup_sdl_surface(sdlsurf);
+    {
+        cairo_t *cr = cairosdl_create(ref);
+        draw_tiled_test_pattern(cr, NULL);
+        cairosdl_destroy(cr);
+    }
+
+    cairosdl_set_num_threads(3);
+    surface = cairosdl_surface_create(sdlsurf);
+    cr = cairo_create(surface);
+    draw_tiled_test_pattern(cr, NULL);
+    cairo_destroy(cr);
+
+    /* Draw the next frame while the first is being flushed. */
+    next = cairosdl_surface_flush_async(surface);
+    ok = next != surface;
+    cr = cairo_create(next);
+    cairo_set_source_rgba(cr, 0,1,0,1);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairosdl_surface_flush_wait(next);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+
+    /* And the other way around. */
+    ok = ok && cairosdl_surface_flush_async(next) == surface;
+    cairosdl_surface_flush_wait(surface);
+    SDL_FillRect(ref, NULL, SDL_MapRGBA(ref->format,0,255,0,255));
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+
+    cairo_surface_destroy(surface);
+    cairosdl_set_num_threads(0);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_flush_async_destroy()
+{
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 100, 100, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, CAIROSDL_AMASK);
+    cairo_surface_t *surface, *next;
+    cairo_t *cr;
+    int ok;
+
+    cairosdl_set_num_threads(3);
+    surface = cairosdl_surface_create(sdlsurf);
+    cr = cairo_create(surface);
+    cairo_set_source_rgba(cr, 0, 1, 0, 1);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+
+    /* Letting go of the first surface while its flush is pending
+     * finishes the flush, and the partner kept goes on. */
+    next = cairo_surface_reference(cairosdl_surface_flush_async(surface));
+    ok = next != surface;
+    cairo_surface_destroy(surface);
+    ok = ok && ((Uint32 *)sdlsurf->pixels)[0] == 0xFF00FF00;
+
+    /* The partner is on its own now and still works. */
+    cr = cairo_create(next);
+    cairo_set_source_rgba(cr, 0, 0, 1, 1);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairosdl_surface_flush(next);
+    ok = ok && ((Uint32 *)sdlsurf->pixels)[0] == 0xFF0000FF;
+
+    cairo_surface_destroy(next);
+    ok = ok && sdlsurf->refcount == 1;
+
+    /* Nothing is left behind without the partner either. */
+    surface = cairosdl_surface_create(sdlsurf);
+    cr = cairo_create(surface);
+    cairo_set_source_rgba(cr, 1, 0, 0, 1);
+    cairo_paint(cr);
+    cairo_destroy(cr);
+    cairosdl_surface_flush_async(surface);
+    cairo_surface_destroy(surface);
+    ok = ok && ((Uint32 *)sdlsurf->pixels)[0] == 0xFFFF0000;
+    ok = ok && sdlsurf->refcount == 1;
+    cairosdl_set_num_threads(0);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_flush_many()
+{
+    SDL_Surface *sdlsurfs[21];
+    cairo_surface_t *surfaces[21];
+    SDL_Rect const *rects[21];
+    int num_rects[21];
+    SDL_Rect rect = { 300, 0, 100, 1000 };
+    int ok = 1;
+    int i, x, y;
+
+    cairosdl_set_num_threads(3);
+    for (i = 0; i < 21; i++) {
+        cairo_t *cr;
+        int size = i < 20 ? 30 : 500;
+        sdlsurfs[i] = SDL_CreateRGBSurface(
+            SDL_SWSURFACE, size, size, 32,
+            CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, CAIROSDL_AMASK);
+        surfaces[i] = cairosdl_surface_create(sdlsurfs[i]);
+        cr = cairo_create(surfaces[i]);
+        cairo_set_source_rgba(cr, 1, 0, 0, 0.5);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+        rects[i] = NULL;
+        num_rects[i] = 0;
+    }
+
+    /* Only a column of the big one. */
+    rects[20] = &rect;
+    num_rects[20] = 1;
+    cairosdl_surface_flush_many(21, surfaces, num_rects, rects);
+
+    for (i = 0; ok && i < 21; i++) {
+        SDL_Surface *sdlsurf = sdlsurfs[i];
+        for (y = 0; ok && y < sdlsurf->h; y++) {
+            Uint32 const *row = (Uint32 const *)
+                ((char const *)sdlsurf->pixels + y*sdlsurf->pitch);
+            for (x = 0; ok && x < sdlsurf->w; x++) {
+                int flushed = i < 20 || (x >= 300 && x < 400);
+                ok = row[x] == (flushed ? 0x80FF0000 : 0);
+            }
+        }
+    }
+
+    for (i = 0; i < 21; i++) {
+        cairo_surface_destroy(surfaces[i]);
+        SDL_FreeSurface(sdlsurfs[i]);
+    }
+    cairosdl_set_num_threads(0);
+    return ok;
+}
+
+static int num_layer_draws = 0;
+
+static void
+draw_test_layer(cairo_t *cr, void *closure)
+{
+    double const *square = (double const *)closure;
+    num_layer_draws++;
+    if (square) {
+        cairo_set_source_rgba(cr, 0, 1, 0, 0.5);
+        cairo_rectangle(cr, square[0], square[1], 10, 10);
+        cairo_fill(cr);
+    }
+    else {
+        draw_tiled_test_pattern(cr, NULL);
+    }
+}
+
+static int
+test_layers()
+{
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 64, 64, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, 0);
+    SDL_Surface *ref = dup_sdl_surface(sdlsurf);
+    cairosdl_layers_t *layers = cairosdl_layers_create(64, 64);
+    cairosdl_layer_t *top;
+    cairo_surface_t *surface = cairosdl_surface_create(sdlsurf);
+    cairo_surface_t *ref_image;
+    double square[2] = { 5, 5 };
+    SDL_Rect rects[4];
+    int ok;
+
+    cairosdl_layers_add(layers, draw_test_layer, NULL);
+    top = cairosdl_layers_add(layers, draw_test_layer, square);
+    ok = cairosdl_layers_update(layers, surface, 4, rects) > 0;
+    ok = ok && num_layer_draws == 2;
+
+    /* Nothing changed: nothing drawn. */
+    ok = ok && cairosdl_layers_update(layers, surface, 4, rects) == 0;
+    ok = ok && num_layer_draws == 2;
+
+    /* Move the square and only its layer is redrawn. */
+    cairosdl_layer_invalidate_rect(top, 5, 5, 10, 10);
+    square[0] = square[1] = 30;
+    cairosdl_layer_invalidate_rect(top, 30, 30, 10, 10);
+    cairosdl_layer_set_opacity(top, 0.5);
+    ok = ok && cairosdl_layers_update(layers, surface, 4, rects) > 0;
+    ok = ok && num_layer_draws == 3;
+
+    {
+        cairo_t *cr = cairosdl_create(ref);
+        draw_tiled_test_pattern(cr, NULL);
+        cairo_push_group(cr);
+        draw_test_layer(cr, square);
+        cairo_pop_group_to_source(cr);
+        cairo_paint_with_alpha(cr, 0.5);
+        cairosdl_destroy(cr);
+    }
+    ref_image = cairosdl_surface_create(ref);
+    ok = ok && image_surface_close(ref_image, surface);
+
+    cairo_surface_destroy(ref_image);
+    cairo_surface_destroy(surface);
+    cairosdl_layers_destroy(layers);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_lock_on_flush()
+{
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 100, 100, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, 0);
+    SDL_Surface *ref;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    int ok;
+
+    SDL_FillRect(sdlsurf, NULL, SDL_MapRGB(sdlsurf->format, 10, 20, 30));
+    ref = dup_sdl_surface(sdlsurf);
+    cr = cairosdl_create(ref);
+    draw_tiled_test_pattern(cr, NULL);
+    cairosdl_destroy(cr);
+
+    surface = cairosdl_surface_create_with_flags(sdlsurf,
+                                                 CAIROSDL_LOCK_ON_FLUSH);
+    ok = cairo_image_surface_get_data(surface) != sdlsurf->pixels;
+    cr = cairo_create(surface);
+    draw_tiled_test_pattern(cr, NULL);
+    cairosdl_destroy(cr);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    ok = ok && cairosdl_surface_get_lock_time(surface) >= 0;
+
+    cairo_surface_destroy(surface);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_in_place()
+{
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 100, 100, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, CAIROSDL_AMASK);
+    SDL_Surface *ref;
+    SDL_Rect overlapping[2] = { { 3, 4, 40, 30 }, { 20, 10, 50, 40 } };
+    SDL_Rect const *rects = overlapping;
+    int num_overlapping = 2;
+    cairo_surface_t *surface;
+    cairo_t *cr;
+    int ok;
+
+    SDL_FillRect(sdlsurf, NULL,
+                 SDL_MapRGBA(sdlsurf->format, 255, 0, 0, 128));
+    ref = dup_sdl_surface(sdlsurf);
+    cr = cairosdl_create(ref);
+    draw_tiled_test_pattern(cr, NULL);
+    cairosdl_destroy(cr);
+
+    /* No shadow: the pixels are premultiplied while bound. */
+    surface = cairosdl_surface_create_with_flags(sdlsurf, CAIROSDL_IN_PLACE);
+    ok = cairo_image_surface_get_data(surface) == sdlsurf->pixels;
+    ok = ok && *(Uint32 *)sdlsurf->pixels == 0x80800000;
+
+    cr = cairo_create(surface);
+    draw_tiled_test_pattern(cr, NULL);
+    cairosdl_destroy(cr);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+
+    /* Going back to premultiplied and flushing again is lossless. */
+    cairosdl_surface_mark_dirty(surface);
+    cairosdl_surface_flush(surface);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+
+    /* No pixel is converted twice, however often it's flushed or
+     * marked dirty or however the rectangles overlap. */
+    cairosdl_surface_flush(surface);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    cairosdl_surface_mark_dirty(surface);
+    cairosdl_surface_mark_dirty(surface);
+    cairosdl_surface_flush(surface);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    cairosdl_surface_mark_dirty_rects(surface, 2, overlapping);
+    cairosdl_surface_mark_dirty_rects(surface, 2, overlapping);
+    cairosdl_surface_flush_rects(surface, 2, overlapping);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    cairosdl_surface_mark_dirty(surface);
+    cairosdl_surface_flush_many(1, &surface, &num_overlapping, &rects);
+    cairosdl_surface_flush(surface);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+    cairo_surface_destroy(surface);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+
+    /* Destroying it puts back what was left premultiplied and only
+     * that. */
+    surface = cairosdl_surface_create_with_flags(sdlsurf, CAIROSDL_IN_PLACE);
+    cairosdl_surface_flush_rect(surface, 0, 0, 50, 50);
+    cairosdl_surface_mark_dirty_rect(surface, 5, 7, 13, 30);
+    cairo_surface_destroy(surface);
+    ok = ok && sdl_surface_eq(ref, sdlsurf);
+
+    surface = cairosdl_surface_create_with_flags(
+        sdlsurf, CAIROSDL_IN_PLACE | CAIROSDL_LOCK_ON_FLUSH);
+    ok = ok && cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS;
+
+    cairo_surface_destroy(surface);
+    SDL_FreeSurface(ref);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_pattern_cache()
+{
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 10, 10, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, CAIROSDL_AMASK);
+    cairo_surface_t *images[3];
+    cairo_pattern_t *patterns[3];
+    Uint32 *pixels = (Uint32 *)sdlsurf->pixels;
+    int ok = 1;
+    int i;
+
+    SDL_FillRect(sdlsurf, NULL, 0x80FF0000);
+    patterns[0] = cairosdl_pattern_create_for_sdl_surface(sdlsurf, 1);
+    patterns[1] = cairosdl_pattern_create_for_sdl_surface(sdlsurf, 1);
+    SDL_FillRect(sdlsurf, NULL, 0xFF00FF00);
+    patterns[2] = cairosdl_pattern_create_for_sdl_surface(sdlsurf, 2);
+    for (i = 0; i < 3; i++) {
+        ok = ok && cairo_pattern_status(patterns[i]) == CAIRO_STATUS_SUCCESS;
+        ok = ok && cairo_pattern_get_surface(patterns[i], &images[i]) ==
+            CAIRO_STATUS_SUCCESS;
+    }
+
+    /* The same generation reuses the snapshot, a new one copies
+     * again. */
+    ok = ok && images[0] == images[1] && images[1] != images[2];
+    ok = ok && cairosdl_pattern_cache_get_size() == 10*10*4;
+    ok = ok && *(Uint32 *)cairo_image_surface_get_data(images[0]) ==
+        0x80800000;
+    ok = ok && *(Uint32 *)cairo_image_surface_get_data(images[2]) ==
+        0xFF00FF00;
+
+    /* The snapshots outlive the cache. */
+    cairosdl_pattern_cache_set_max_size(0);
+    ok = ok && cairosdl_pattern_cache_get_size() == 0;
+    ok = ok && *(Uint32 *)cairo_image_surface_get_data(images[0]) ==
+        0x80800000;
+    cairosdl_pattern_cache_set_max_size(CAIROSDL_DEFAULT_PATTERN_CACHE_SIZE);
+
+    ok = ok && pixels[0] == 0xFF00FF00;
+    for (i = 0; i < 3; i++)
+        cairo_pattern_destroy(patterns[i]);
+    ok = ok && sdlsurf->refcount == 1;
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+test_assets()
+{
+    char const *names[2] = { "ball", "gear" };
+    cairo_surface_t *images[2];
+    cairo_surface_t *loaded = NULL;
+    cairosdl_assets_t *assets;
+    int ok = 1;
+    int i;
+
+    images[0] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 3, 2);
+    images[1] = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 5, 7);
+    for (i = 0; i < 2; i++) {
+        cairo_t *cr = cairo_create(images[i]);
+        cairo_set_source_rgba(cr, 1, 0.5*i, 0, 0.5);
+        cairo_paint(cr);
+        cairo_destroy(cr);
+    }
+
+    ok = ok && cairosdl_assets_write("test-cairosdl.csa", 2, names,
+                                     images) == 0;
+    assets = cairosdl_assets_open("test-cairosdl.csa");
+    remove("test-cairosdl.csa");
+    ok = ok && assets != NULL;
+    ok = ok && cairosdl_assets_get_num_images(assets) == 2;
+    ok = ok && cairosdl_assets_find(assets, "gear") == 1;
+    ok = ok && cairosdl_assets_find(assets, "wheel") == -1;
+    ok = ok && 0 == strcmp(cairosdl_assets_get_name(assets, 0), "ball");
+    if (ok)
+        loaded = cairosdl_assets_get_surface(assets, 1);
+    cairosdl_assets_destroy(assets);
+
+    /* The surface keeps the file mapped. */
+    ok = ok && loaded != NULL;
+    ok = ok && cairo_image_surface_get_width(loaded) == 5;
+    ok = ok && cairo_image_surface_get_height(loaded) == 7;
+    for (i = 0; ok && i < 7; i++) {
+        ok = 0 == memcmp(
+            cairo_image_surface_get_data(loaded) +
+            i*cairo_image_surface_get_stride(loaded),
+            cairo_image_surface_get_data(images[1]) +
+            i*cairo_image_surface_get_stride(images[1]),
+            5*4);
+    }
+
+    if (loaded)
+        cairo_surface_destroy(loaded);
+    cairo_surface_destroy(images[0]);
+    cairo_surface_destroy(images[1]);
+    return ok;
+}
+
+/* A backing store of up to 16 tiles of 64x64 pixels for
+ * test_canvas(). */
+static struct {
+    int column, row;
+    Uint32 pixels[64*64];
+} stored_tiles[16];
+static int num_stored_tiles = 0;
+
+static int
+find_stored_tile(int column, int row)
+{
+    int i;
+    for (i = 0; i < num_stored_tiles; i++) {
+        if (stored_tiles[i].column == column && stored_tiles[i].row == row)
+            return i;
+    }
+    return -1;
+}
+
+static int
+store_test_tile(SDL_Surface *tile, int column, int row, void *closure)
+{
+    int i = find_stored_tile(column, row);
+    int y;
+    (void)closure;
+    if (i < 0) {
+        if (num_stored_tiles == 16)
+            return -1;
+        i = num_stored_tiles++;
+        stored_tiles[i].column = column;
+        stored_tiles[i].row = row;
+    }
+    for (y = 0; y < tile->h; y++) {
+        memcpy(stored_tiles[i].pixels + 64*y,
+               (char *)tile->pixels + y*tile->pitch, 4*tile->w);
+    }
+    return 0;
+}
+
+static int
+load_test_tile(SDL_Surface *tile, int column, int row, void *closure)
+{
+    int i = find_stored_tile(column, row);
+    int y;
+    (void)closure;
+    if (i < 0)
+        return 0;
+    for (y = 0; y < tile->h; y++) {
+        memcpy((char *)tile->pixels + y*tile->pitch,
+               stored_tiles[i].pixels + 64*y, 4*tile->w);
+    }
+    return 1;
+}
+
+static void
+draw_canvas_square(cairo_t *cr, void *closure)
+{
+    (void)closure;
+    cairo_set_source_rgba(cr, 0, 0, 1, 0.5);
+    cairo_rectangle(cr, 39950, 39950, 100, 100);
+    cairo_fill(cr);
+}
+
+static int
+test_canvas()
+{
+    /* Bigger than an SDL_Rect can cover and with room for only two
+     * tiles in memory, so drawing the square across four tiles at
+     * the corner stores some and loads them back. */
+    cairosdl_canvas_t *canvas = cairosdl_canvas_create(
+        40030, 40030, 64, 2, store_test_tile, load_test_tile, NULL);
+    cairo_surface_t *tile;
+    int ok = canvas != NULL;
+
+    ok = ok && cairosdl_canvas_draw(canvas, 39950, 39950, 100, 100,
+                                    draw_canvas_square, NULL) == 0;
+    ok = ok && cairosdl_canvas_get_num_resident_tiles(canvas) == 2;
+    ok = ok && cairosdl_canvas_flush(canvas) == 0;
+    ok = ok && num_stored_tiles == 4;
+
+    /* The corner tile is 30x30 and the square covers it all. */
+    tile = ok ? cairosdl_canvas_get_tile(canvas, 625, 625) : NULL;
+    ok = ok && tile != NULL;
+    ok = ok && cairo_image_surface_get_width(tile) == 30;
+    ok = ok && *(Uint32 *)cairo_image_surface_get_data(tile) == 0x80000080;
+    ok = ok && stored_tiles[find_stored_tile(625, 625)].pixels[0] ==
+        0x800000FF;
+    ok = ok && cairosdl_canvas_get_tile(canvas, 626, 0) == NULL;
+
+    cairosdl_canvas_destroy(canvas);
+    return ok;
+}
+
+static int
+test_export()
+{
+    cairosdl_export_t *producer = cairosdl_export_create(
+        "/test-cairosdl", 100, 100, CAIROSDL_EXPORT_XRGB32, 2);
+    cairosdl_export_t *consumer;
+    cairosdl_export_t *restarted;
+    SDL_Surface *frame;
+    SDL_Surface *ref;
+    cairo_t *cr;
+    unsigned char const *pixels;
+    int ok = 1;
+    int y;
+
+    if (producer == NULL)
+        return 1;               /* no shared memory here */
+
+    frame = cairosdl_export_get_frame(producer);
+    cr = cairosdl_create(frame);
+    draw_tiled_test_pattern(cr, NULL);
+    cairosdl_destroy(cr);
+    ref = dup_sdl_surface(frame);
+    cairosdl_export_publish(producer);
+
+    consumer = cairosdl_export_open("/test-cairosdl");
+    ok = ok && consumer != NULL;
+    ok = ok && cairosdl_export_wait(consumer, 0, 0) == 1;
+    pixels = ok ? cairosdl_export_get_pixels(consumer, 1) : NULL;
+    ok = ok && pixels != NULL;
+    for (y = 0; ok && y < 100; y++) {
+        ok = 0 == memcmp(pixels + y*400,
+                         (unsigned char *)ref->pixels + y*ref->pitch, 400);
+    }
+    ok = ok && cairosdl_export_frame_is_intact(consumer, 1);
+
+    /* Two more frames go around the ring of two. */
+    ok = ok && cairosdl_export_frame(producer, ref) == 0;
+    ok = ok && cairosdl_export_frame(producer, ref) == 0;
+    ok = ok && cairosdl_export_wait(consumer, 1, 0) == 3;
+    ok = ok && !cairosdl_export_frame_is_intact(consumer, 1);
+    ok = ok && cairosdl_export_get_pixels(consumer, 1) == NULL;
+    ok = ok && cairosdl_export_get_pixels(consumer, 3) != NULL;
+
+    /* A producer restarted at a smaller size doesn't pull the pages
+     * out from under a consumer still reading the old frames. */
+    pixels = ok ? cairosdl_export_get_pixels(consumer, 3) : NULL;
+    restarted = cairosdl_export_create(
+        "/test-cairosdl", 10, 10, CAIROSDL_EXPORT_XRGB32, 2);
+    ok = ok && restarted != NULL && pixels != NULL;
+    for (y = 0; ok && y < 100; y++) {
+        ok = 0 == memcmp(pixels + y*400,
+                         (unsigned char *)ref->pixels + y*ref->pitch, 400);
+    }
+
+    if (restarted)
+        cairosdl_export_destroy(restarted);
+    cairosdl_export_destroy(consumer);
+    cairosdl_export_destroy(producer);
+    SDL_FreeSurface(ref);
+    return ok;
+}
+
+static int
+test_record()
+{
+    static char const expected[] =
+        "YUV4MPEG2 W20 H2 F25:1 Ip A1:1 C420jpeg\n"
+        "FRAME\n";
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 20, 2, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, 0);
+    cairosdl_record_t *record;
+    unsigned char data[sizeof(expected) - 1 + 40 + 2*10 + 1];
+    size_t header_size = sizeof(expected) - 1;
+    size_t size = 0;
+    FILE *f;
+    int ok = 1;
+    int i;
+
+    /* White on the left, red on the right. */
+    SDL_FillRect(sdlsurf, NULL, SDL_MapRGB(sdlsurf->format, 255, 255, 255));
+    for (i = 10; i < 20; i++) {
+        ((Uint32 *)sdlsurf->pixels)[i] = 0xFF0000;
+        ((Uint32 *)((unsigned char *)sdlsurf->pixels + sdlsurf->pitch))[i] =
+            0xFF0000;
+    }
+
+    record = cairosdl_record_open("test-cairosdl.y4m", 20, 2, 25);
+    ok = ok && record != NULL;
+    ok = ok && cairosdl_record_frame(record, sdlsurf) == 0;
+    ok = ok && cairosdl_record_destroy(record) == 0;
+
+    f = fopen("test-cairosdl.y4m", "rb");
+    if (f) {
+        size = fread(data, 1, sizeof(data), f);
+        fclose(f);
+    }
+    remove("test-cairosdl.y4m");
+
+    ok = ok && size == sizeof(data) - 1;
+    ok = ok && 0 == memcmp(data, expected, header_size);
+    for (i = 0; ok && i < 20; i++) {
+        int y = i < 10 ? 235 : 82;
+        ok = data[header_size + i] == y && data[header_size + 20 + i] == y;
+    }
+    for (i = 0; ok && i < 10; i++) {
+        int u = i < 5 ? 128 : 90;
+        int v = i < 5 ? 128 : 240;
+        ok = data[header_size + 40 + i] == u &&
+            data[header_size + 50 + i] == v;
+    }
+
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
+static int
+receive_remote_frames(void *closure)
+{
+    cairosdl_remote_t **viewer = (cairosdl_remote_t **)closure;
+    int n = 0;
+    *viewer = cairosdl_remote_accept("./test-cairosdl.sock");
+    while (*viewer && cairosdl_remote_receive_frame(*viewer, NULL) == 1)
+        n++;
+    return n;
+}
+
+static int
+test_remote()
+{
+    SDL_Surface *sdlsurf = SDL_CreateRGBSurface(
+        SDL_SWSURFACE, 100, 100, 32,
+        CAIROSDL_RMASK, CAIROSDL_GMASK, CAIROSDL_BMASK, 0);
+    cairosdl_remote_t *viewer = NULL;
+    cairosdl_remote_t *sender = NULL;
+    cairosdl_remote_stats_t stats;
+    SDL_Thread *thread;
+    cairo_t *cr;
+    int num_received = 0;
+    int ok = 1;
+    int i;
+
+    SDL_FillRect(sdlsurf, NULL, SDL_MapRGB(sdlsurf->format, 10, 20, 30));
+    thread = SDL_CreateThread(receive_remote_frames, &viewer);
+    for (i = 0; i < 100 && sender == NULL; i++) {
+        sender = cairosdl_remote_connect("./test-cairosdl.sock");
+        if (sender == NULL)
+            SDL_Delay(10);
+    }
+    if (sender == NULL) {
+        /* No sockets here. */
+        SDL_WaitThread(thread, NULL);
+        cairosdl_remote_destroy(viewer);
+        SDL_FreeSurface(sdlsurf);
+        return 1;
+    }
+
+    /* The first frame has every tile, a run of one colour each. */
+    ok = ok && cairosdl_remote_send_frame(sender, sdlsurf, &stats) == 0;
+    ok = ok && stats.tiles == 4;
+    ok = ok && stats.bytes == 16 + 4*12 + 4*(16 + 9 + 9 + 6);
+
+    /* An unchanged frame isn't sent. */
+    ok = ok && cairosdl_remote_send_frame(sender, sdlsurf, &stats) == 0;
+    ok = ok && stats.tiles == 0 && stats.bytes == 0;
+
+    /* Nor is one that only differs in the X byte. */
+    for (i = 0; i < 100*100; i++)
+        ((Uint32 *)sdlsurf->pixels)[i] ^= ~(CAIROSDL_RMASK |
+                                            CAIROSDL_GMASK |
+                                            CAIROSDL_BMASK);
+    ok = ok && cairosdl_remote_send_frame(sender, sdlsurf, &stats) == 0;
+    ok = ok && stats.tiles == 0 && stats.bytes == 0;
+
+    /* Only the tiles drawn on are. */
+    cr = cairosdl_create(sdlsurf);
+    cairo_set_source_rgb(cr, 1, 1, 0);
+    cairo_rectangle(cr, 70, 10, 20, 20);
+    cairo_fill(cr);
+    cairosdl_destroy(cr);
+    ok = ok && cairosdl_remote_send_frame(sender, sdlsurf, &stats) == 0;
+    ok = ok && stats.tiles == 1;
+
+    cairosdl_remote_destroy(sender);
+    SDL_WaitThread(thread, &num_received);
+    ok = ok && num_received == 2;
+    for (i = 0; ok && i < 100*100; i++) {
+        Uint32 rgb = CAIROSDL_RMASK | CAIROSDL_GMASK | CAIROSDL_BMASK;
+        Uint32 *received = cairosdl_remote_get_frame(viewer)->pixels;
+        ok = (received[i] & rgb) == (((Uint32 *)sdlsurf->pixels)[i] & rgb);
+    }
+
+    cairosdl_remote_destroy(viewer);
+    SDL_FreeSurface(sdlsurf);
+    return ok;
+}
+
 int
 main()
 {
+    int ok = 1;
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_NOPARACHUTE);
     atexit(SDL_Quit);
 
-    return test_argb32() ? 0 : 1;
+    ok = test_argb32() && ok;
+    ok = test_composite_sprites() && ok;
+    ok = test_composite_spans() && ok;
+    ok = test_blit_image(0) && ok;
+    ok = test_blit_image(CAIROSDL_AMASK) && ok;
+    ok = test_draw_tiled() && ok;
+    ok = test_scaled() && ok;
+    ok = test_flush_async() && ok;
+    ok = test_flush_async_destroy() && ok;
+    ok = test_flush_many() && ok;
+    ok = test_layers() && ok;
+    ok = test_lock_on_flush() && ok;
+    ok = test_in_place() && ok;
+    ok = test_pattern_cache() && ok;
+    ok = test_assets() && ok;
+    ok = test_canvas() && ok;
+    ok = test_export() && ok;
+    ok = test_record() && ok;
+    ok = test_remote() && ok;
+    return ok ? 0 : 1;
 }